@@ -5,8 +5,6 @@
             clutter_stagePaintDone */
 /* eslint camelcase: ["error", { properties: "never", allow: ["^script_", "^malloc", "^glx", "^clutter"] }] */
 
-const System = imports.system;
-
 const Main = imports.ui.main;
 const Scripting = imports.ui.scripting;
 
@@ -112,7 +110,7 @@ function *run() {
         Main.overview.hide();
         yield Scripting.waitLeisure();
 
-        System.gc();
+        global.gc();
         yield Scripting.sleep(1000);
         Scripting.collectStatistics();
         Scripting.scriptEvent('afterShowHide');
@@ -0,0 +1,355 @@
+// -*- mode: js; js-indent-level: 4; indent-tabs-mode: nil -*-
+/* exported run, finish, script_scenarioStart, script_scenarioDone,
+            script_scenarioStep, clutter_stagePaintDone */
+/* eslint camelcase: ["error", { properties: "never", allow: ["^script_", "^clutter"] }] */
+
+const { GLib } = imports.gi;
+
+const AppDisplay = imports.ui.appDisplay;
+const BoxPointer = imports.ui.boxpointer;
+const Main = imports.ui.main;
+const MessageTray = imports.ui.messageTray;
+const Scripting = imports.ui.scripting;
+
+// This performance script runs a set of small, self-contained scenarios
+// that each exercise one part of the shell user interface. Unlike core.js
+// and hwtest.js it doesn't depend on any particular applications being
+// installed, and all scenarios but the workspace switching one work
+// without gnome-shell-perf-helper, so it can be run in a nested or
+// headless session:
+//
+//   gnome-shell-perf-tool --perf=micro --wayland --headless
+//
+// Each scenario brackets the work it measures with the scenarioStart and
+// scenarioDone events; scenarioStep marks an individual iteration within
+// a scenario (a keystroke, a menu open, ...) and frames painted between
+// start and done are counted to compute frame rates.
+
+var METRICS = {
+    appGridScrollFps:
+    { description: "Frame rate when scrolling through all pages of the app grid",
+      units: "frames / s" },
+    searchTypingLatency:
+    { description: "Mean time from a keystroke to search results being shown, including the search timeout",
+      units: "us" },
+    searchTypingLatencyMax:
+    { description: "Maximum time from a keystroke to search results being shown, including the search timeout",
+      units: "us" },
+    popupMenuOpenTime:
+    { description: "Mean time to open the system menu until the shell is idle",
+      units: "us" },
+    notificationStormTime:
+    { description: "Time to process a storm of 100 notification banners",
+      units: "us" },
+    notificationStormFps:
+    { description: "Frame rate while processing a storm of 100 notification banners",
+      units: "frames / s" },
+    messageListOpenTime:
+    { description: "Time to open the message list with 500 notifications",
+      units: "us" },
+    workspaceSwitchTime:
+    { description: "Mean time to switch workspaces with 50 windows open",
+      units: "us" },
+    workspaceSwitchFps:
+    { description: "Frame rate when switching workspaces with 50 windows open",
+      units: "frames / s" },
+    themeReloadTime:
+    { description: "Mean time to reload the theme and restyle the stage",
+      units: "us" },
+};
+
+const SEARCH_STRING = 'settings';
+const N_MENU_OPENS = 5;
+const N_STORM_NOTIFICATIONS = 100;
+const N_LIST_NOTIFICATIONS = 500;
+const N_WORKSPACE_WINDOWS = 50;
+const N_WORKSPACE_SWITCHES = 6;
+const N_THEME_RELOADS = 3;
+
+function waitSearchDone(searchResults) {
+    return new Promise(resolve => {
+        let id = GLib.timeout_add(GLib.PRIORITY_DEFAULT, 5, () => {
+            if (searchResults.searchInProgress)
+                return GLib.SOURCE_CONTINUE;
+
+            global.run_at_leisure(resolve);
+            return GLib.SOURCE_REMOVE;
+        });
+        GLib.Source.set_name_by_id(id, '[gnome-shell] waitSearchDone');
+    });
+}
+
+function createNotificationSources(nNotifications, showBanners) {
+    let sources = [];
+    let source = null;
+
+    for (let i = 0; i < nNotifications; i++) {
+        if (source == null ||
+            source.count >= MessageTray.MAX_NOTIFICATIONS_PER_SOURCE) {
+            source = new MessageTray.Source(`Source ${sources.length}`,
+                                            'dialog-information-symbolic');
+            Main.messageTray.add(source);
+            sources.push(source);
+        }
+
+        let notification = new MessageTray.Notification(source,
+                                                        `Notification ${i}`,
+                                                        'Body text of a test notification');
+        if (showBanners)
+            source.showNotification(notification);
+        else
+            source.pushNotification(notification);
+    }
+
+    return sources;
+}
+
+function *runAppGridScroll() {
+    Main.overview.show();
+    yield Scripting.waitLeisure();
+
+    // eslint-disable-next-line require-atomic-updates
+    Main.overview.dash.showAppsButton.checked = true;
+    yield Scripting.waitLeisure();
+
+    let appDisplay = Main.overview.viewSelector.appDisplay;
+    appDisplay._showView(AppDisplay.Views.ALL);
+    yield Scripting.waitLeisure();
+
+    let allView = appDisplay._views[AppDisplay.Views.ALL].view;
+    let nPages = allView._grid.nPages();
+
+    Scripting.scriptEvent('scenarioStart', 'appGridScroll');
+    for (let i = 1; i < nPages; i++) {
+        allView.goToPage(i);
+        yield Scripting.waitLeisure();
+    }
+    for (let i = nPages - 2; i >= 0; i--) {
+        allView.goToPage(i);
+        yield Scripting.waitLeisure();
+    }
+    Scripting.scriptEvent('scenarioDone', 'appGridScroll');
+
+    // eslint-disable-next-line require-atomic-updates
+    Main.overview.dash.showAppsButton.checked = false;
+    Main.overview.hide();
+    yield Scripting.waitLeisure();
+}
+
+function *runSearchTyping() {
+    Main.overview.show();
+    yield Scripting.waitLeisure();
+
+    let searchResults = Main.overview.viewSelector._searchResults;
+
+    Scripting.scriptEvent('scenarioStart', 'searchTyping');
+    for (let i = 1; i <= SEARCH_STRING.length; i++) {
+        Scripting.scriptEvent('scenarioStep', 'searchTyping');
+        Main.overview.searchEntry.text = SEARCH_STRING.slice(0, i);
+        yield waitSearchDone(searchResults);
+    }
+    Scripting.scriptEvent('scenarioStep', 'searchTyping');
+    Scripting.scriptEvent('scenarioDone', 'searchTyping');
+
+    Main.overview.searchEntry.text = '';
+    Main.overview.hide();
+    yield Scripting.waitLeisure();
+}
+
+function *runPopupMenuOpen() {
+    let menu = Main.panel.statusArea.aggregateMenu.menu;
+
+    Scripting.scriptEvent('scenarioStart', 'popupMenuOpen');
+    for (let i = 0; i < N_MENU_OPENS; i++) {
+        Scripting.scriptEvent('scenarioStep', 'popupMenuOpen');
+        menu.open(BoxPointer.PopupAnimation.NONE);
+        yield Scripting.waitLeisure();
+        Scripting.scriptEvent('scenarioStep', 'popupMenuOpen');
+
+        menu.close(BoxPointer.PopupAnimation.NONE);
+        yield Scripting.waitLeisure();
+    }
+    Scripting.scriptEvent('scenarioDone', 'popupMenuOpen');
+}
+
+function *runNotificationStorm() {
+    Scripting.scriptEvent('scenarioStart', 'notificationStorm');
+    let sources = createNotificationSources(N_STORM_NOTIFICATIONS, true);
+    yield Scripting.waitLeisure();
+    Scripting.scriptEvent('scenarioDone', 'notificationStorm');
+
+    sources.forEach(s => s.destroy());
+    yield Scripting.waitLeisure();
+}
+
+function *runMessageList() {
+    let sources = createNotificationSources(N_LIST_NOTIFICATIONS, false);
+    yield Scripting.waitLeisure();
+
+    let menu = Main.panel.statusArea.dateMenu.menu;
+
+    Scripting.scriptEvent('scenarioStart', 'messageListOpen');
+    menu.open(BoxPointer.PopupAnimation.NONE);
+    yield Scripting.waitLeisure();
+    Scripting.scriptEvent('scenarioDone', 'messageListOpen');
+
+    menu.close(BoxPointer.PopupAnimation.NONE);
+    yield Scripting.waitLeisure();
+
+    sources.forEach(s => s.destroy());
+    yield Scripting.waitLeisure();
+}
+
+function *runWorkspaceSwitch() {
+    let workspaceManager = global.workspace_manager;
+
+    // Spread the windows over the first two workspaces; with dynamic
+    // workspaces a new empty one is appended as soon as the second
+    // workspace gets its first window.
+    for (let ws = 0; ws < 2; ws++) {
+        workspaceManager.get_workspace_by_index(ws).activate(global.get_current_time());
+        yield Scripting.waitLeisure();
+
+        for (let k = 0; k < N_WORKSPACE_WINDOWS / 2; k++)
+            yield Scripting.createTestWindow({ width: 320, height: 240 });
+        yield Scripting.waitTestWindows();
+        yield Scripting.waitLeisure();
+    }
+
+    Scripting.scriptEvent('scenarioStart', 'workspaceSwitch');
+    for (let i = 0; i < N_WORKSPACE_SWITCHES; i++) {
+        let workspace = workspaceManager.get_workspace_by_index(i % 2);
+
+        Scripting.scriptEvent('scenarioStep', 'workspaceSwitch');
+        Main.wm.actionMoveWorkspace(workspace);
+        yield Scripting.waitLeisure();
+        Scripting.scriptEvent('scenarioStep', 'workspaceSwitch');
+    }
+    Scripting.scriptEvent('scenarioDone', 'workspaceSwitch');
+
+    yield Scripting.destroyTestWindows();
+    yield Scripting.sleep(1000);
+}
+
+function *runThemeReload() {
+    Scripting.scriptEvent('scenarioStart', 'themeReload');
+    for (let i = 0; i < N_THEME_RELOADS; i++) {
+        Scripting.scriptEvent('scenarioStep', 'themeReload');
+        Main.loadTheme();
+        yield Scripting.waitLeisure();
+        Scripting.scriptEvent('scenarioStep', 'themeReload');
+    }
+    Scripting.scriptEvent('scenarioDone', 'themeReload');
+}
+
+function *run() {
+    Scripting.defineScriptEvent('scenarioStart', 'Start of a benchmark scenario', 's');
+    Scripting.defineScriptEvent('scenarioDone', 'End of a benchmark scenario', 's');
+    Scripting.defineScriptEvent('scenarioStep', 'Boundary of an iteration within a benchmark scenario', 's');
+
+    global.frame_timestamps = true;
+    global.main_loop_watchdog_threshold = 20;
+
+    yield Scripting.sleep(1000);
+    yield Scripting.waitLeisure();
+
+    yield* runAppGridScroll();
+    yield* runSearchTyping();
+    yield* runPopupMenuOpen();
+    yield* runNotificationStorm();
+    yield* runMessageList();
+    yield* runWorkspaceSwitch();
+    yield* runThemeReload();
+
+    global.frame_timestamps = false;
+    global.main_loop_watchdog_threshold = 0;
+
+    Scripting.collectStatistics();
+}
+
+let scenarios = {};
+let currentScenario = null;
+
+function _getScenario(name) {
+    if (!(name in scenarios))
+        scenarios[name] = { start: 0, end: 0, frames: 0, steps: [] };
+    return scenarios[name];
+}
+
+function script_scenarioStart(time, name) {
+    let scenario = _getScenario(name);
+    scenario.start = time;
+    currentScenario = scenario;
+}
+
+function script_scenarioDone(time, name) {
+    _getScenario(name).end = time;
+    currentScenario = null;
+}
+
+function script_scenarioStep(time, name) {
+    _getScenario(name).steps.push(time);
+}
+
+function clutter_stagePaintDone(_time) {
+    if (currentScenario)
+        currentScenario.frames++;
+}
+
+// Steps are recorded as pairs of (begin, end) timestamps, except for
+// search typing where each step marks both the end of the previous
+// keystroke and the start of the next one.
+function _stepDurations(scenario, contiguous) {
+    let durations = [];
+    let stride = contiguous ? 1 : 2;
+
+    for (let i = 0; i + 1 < scenario.steps.length; i += stride)
+        durations.push(scenario.steps[i + 1] - scenario.steps[i]);
+
+    return durations;
+}
+
+function _mean(values) {
+    if (values.length == 0)
+        return -1;
+    return Math.round(values.reduce((a, b) => a + b) / values.length);
+}
+
+function _fps(scenario) {
+    let dt = (scenario.end - scenario.start) / 1000000;
+    return dt > 0 ? scenario.frames / dt : 0;
+}
+
+function finish() {
+    if ('appGridScroll' in scenarios)
+        METRICS.appGridScrollFps.value = _fps(scenarios.appGridScroll);
+
+    if ('searchTyping' in scenarios) {
+        let durations = _stepDurations(scenarios.searchTyping, true);
+        METRICS.searchTypingLatency.value = _mean(durations);
+        METRICS.searchTypingLatencyMax.value = Math.max(-1, ...durations);
+    }
+
+    if ('popupMenuOpen' in scenarios)
+        METRICS.popupMenuOpenTime.value = _mean(_stepDurations(scenarios.popupMenuOpen, false));
+
+    if ('notificationStorm' in scenarios) {
+        let scenario = scenarios.notificationStorm;
+        METRICS.notificationStormTime.value = scenario.end - scenario.start;
+        METRICS.notificationStormFps.value = _fps(scenario);
+    }
+
+    if ('messageListOpen' in scenarios) {
+        let scenario = scenarios.messageListOpen;
+        METRICS.messageListOpenTime.value = scenario.end - scenario.start;
+    }
+
+    if ('workspaceSwitch' in scenarios) {
+        let scenario = scenarios.workspaceSwitch;
+        METRICS.workspaceSwitchTime.value = _mean(_stepDurations(scenario, false));
+        METRICS.workspaceSwitchFps.value = _fps(scenario);
+    }
+
+    if ('themeReload' in scenarios)
+        METRICS.themeReloadTime.value = _mean(_stepDurations(scenarios.themeReload, false));
+}
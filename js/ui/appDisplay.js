@@ -918,7 +918,8 @@ class FrequentView extends BaseAppView {
     }
 
     hasUsefulData() {
-        return this._usage.get_most_used().length >= MIN_FREQUENT_APPS_COUNT;
+        let topApps = this._usage.get_top_apps(MIN_FREQUENT_APPS_COUNT, false);
+        return topApps.length >= MIN_FREQUENT_APPS_COUNT;
     }
 
     _compareItems() {
@@ -1215,28 +1216,19 @@ var AppSearchProvider = class AppSearchProvider {
         return results.slice(0, maxNumber);
     }
 
-    getInitialResultSet(terms, callback, _cancellable) {
+    _getResultSet(terms, previousResults) {
         let query = terms.join(' ');
-        let groups = Shell.AppSystem.search(query);
-        let usage = Shell.AppUsage.get_default();
-        let results = [];
-        groups.forEach(group => {
-            group = group.filter(appID => {
-                let app = Gio.DesktopAppInfo.new(appID);
-                return app && app.should_show();
-            });
-            results = results.concat(group.sort(
-                (a, b) => usage.compare(a, b)
-            ));
-        });
+        let results = this._appSys.search_ranked(query, previousResults);
 
-        results = results.concat(this._systemActions.getMatchingActions(terms));
+        return results.concat(this._systemActions.getMatchingActions(terms));
+    }
 
-        callback(results);
+    getInitialResultSet(terms, callback, _cancellable) {
+        callback(this._getResultSet(terms, null));
     }
 
-    getSubsearchResultSet(previousResults, terms, callback, cancellable) {
-        this.getInitialResultSet(terms, callback, cancellable);
+    getSubsearchResultSet(previousResults, terms, callback, _cancellable) {
+        callback(this._getResultSet(terms, previousResults));
     }
 
     createResultObject(resultMeta) {
@@ -378,7 +378,7 @@ var Dash = GObject.registerClass({
             this._queueRedisplay();
         });
         AppFavorites.getAppFavorites().connect('changed', this._queueRedisplay.bind(this));
-        this._appSystem.connect('app-state-changed', this._queueRedisplay.bind(this));
+        this._appSystem.connect('apps-state-changed', this._queueRedisplay.bind(this));
 
         Main.overview.connect('item-drag-begin',
                               this._onDragBegin.bind(this));
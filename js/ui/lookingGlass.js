@@ -4,7 +4,6 @@
 const { Clutter, Cogl, Gio, GLib, GObject,
         Graphene, Meta, Pango, Shell, St } = imports.gi;
 const Signals = imports.signals;
-const System = imports.system;
 
 const History = imports.misc.history;
 const ExtensionUtils = imports.misc.extensionUtils;
@@ -839,7 +838,7 @@ class LookingGlass extends St.BoxLayout {
         gcIcon.reactive = true;
         gcIcon.connect('button-press-event', () => {
             gcIcon.icon_name = 'user-trash';
-            System.gc();
+            global.gc();
             this._timeoutId = GLib.timeout_add(GLib.PRIORITY_DEFAULT, 500, () => {
                 gcIcon.icon_name = 'user-trash-full';
                 this._timeoutId = 0;
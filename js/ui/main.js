@@ -280,8 +280,9 @@ function _initializeUI() {
         let perfModuleName = GLib.getenv("SHELL_PERF_MODULE");
         if (perfModuleName) {
             let perfOutput = GLib.getenv("SHELL_PERF_OUTPUT");
+            let perfBinaryLog = GLib.getenv("SHELL_PERF_BINARY_LOG");
             let module = eval(`imports.perf.${perfModuleName};`);
-            Scripting.runPerfScript(module, perfOutput);
+            Scripting.runPerfScript(module, perfOutput, perfBinaryLog);
         }
     });
 }
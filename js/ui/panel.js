@@ -250,7 +250,7 @@ var AppMenuButton = GObject.registerClass({
         this._focusAppNotifyId =
             tracker.connect('notify::focus-app', this._focusAppChanged.bind(this));
         this._appStateChangedSignalId =
-            appSys.connect('app-state-changed', this._onAppStateChanged.bind(this));
+            appSys.connect('apps-state-changed', this._onAppsStateChanged.bind(this));
         this._switchWorkspaceNotifyId =
             global.window_manager.connect('switch-workspace', this._sync.bind(this));
 
@@ -310,12 +310,12 @@ var AppMenuButton = GObject.registerClass({
         this._spinner.play();
     }
 
-    _onAppStateChanged(appSys, app) {
-        let state = app.state;
-        if (state != Shell.AppState.STARTING)
+    _onAppsStateChanged(appSys, apps) {
+        apps.forEach(app => {
             this._startingApps = this._startingApps.filter(a => a != app);
-        else if (state == Shell.AppState.STARTING)
-            this._startingApps.push(app);
+            if (app.state == Shell.AppState.STARTING)
+                this._startingApps.push(app);
+        });
         // For now just resync on all running state changes; this is mainly to handle
         // cases where the focused window's application changes without the focus
         // changing.  An example case is how we map OpenOffice.org based on the window
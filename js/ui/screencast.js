@@ -76,6 +76,10 @@ var ScreencastService = class {
             recorder.set_framerate(options['framerate']);
         if ('draw-cursor' in options)
             recorder.set_draw_cursor(options['draw-cursor']);
+        if (options['segment-duration'] || options['segment-size']) {
+            recorder.set_segment_limits(options['segment-duration'] || 0,
+                                        options['segment-size'] || 0);
+        }
     }
 
     ScreencastAsync(params, invocation) {
@@ -142,5 +146,21 @@ var ScreencastService = class {
         let success = this._stopRecordingForSender(invocation.get_sender());
         invocation.return_value(GLib.Variant.new('(b)', [success]));
     }
+
+    GetScreencastStatsAsync(params, invocation) {
+        let recorder = this._recorders.get(invocation.get_sender());
+        if (!recorder || !recorder.is_recording()) {
+            invocation.return_value(GLib.Variant.new('(ba{sv})', [false, {}]));
+            return;
+        }
+
+        let [captured, dropped, encoded, latency] = recorder.get_stats();
+        invocation.return_value(GLib.Variant.new('(ba{sv})', [true, {
+            'frames-captured': GLib.Variant.new('u', captured),
+            'frames-dropped': GLib.Variant.new('u', dropped),
+            'frames-encoded': GLib.Variant.new('u', encoded),
+            'latency': GLib.Variant.new('u', latency),
+        }]));
+    }
 };
 Signals.addSignalMethods(ScreencastService.prototype);
@@ -30,7 +30,14 @@ var ScreenshotService = class {
 
         let sender = invocation.get_sender();
         if (this._screenShooter.has(sender) || lockedDown) {
-            invocation.return_value(GLib.Variant.new('(bs)', [false, '']));
+            // Only the methods writing files reply with (bs)
+            if (needsDisk) {
+                invocation.return_value(GLib.Variant.new('(bs)', [false, '']));
+            } else {
+                invocation.return_error_literal(Gio.IOErrorEnum,
+                                                Gio.IOErrorEnum.PENDING,
+                                                "Only one screenshot operation at a time is permitted");
+            }
             return null;
         }
 
@@ -159,6 +166,106 @@ var ScreenshotService = class {
             });
     }
 
+    ScreenshotToFdAsync(params, invocation) {
+        let [includeCursor, flash] = params;
+        let screenshot = this._createScreenshot(invocation, false);
+        if (!screenshot)
+            return;
+        screenshot.screenshot_to_fd(includeCursor,
+            (o, res) => {
+                let result, area, fd, width, height, stride, scale;
+                try {
+                    [result, area, fd, width, height, stride, scale] =
+                        screenshot.screenshot_to_fd_finish(res);
+                } catch (e) {
+                    this._removeShooterForSender(invocation.get_sender());
+                    invocation.return_gerror(e);
+                    return;
+                }
+
+                if (!result) {
+                    this._removeShooterForSender(invocation.get_sender());
+                    invocation.return_error_literal(Gio.IOErrorEnum,
+                                                    Gio.IOErrorEnum.FAILED,
+                                                    "Failed to take screenshot");
+                    return;
+                }
+
+                if (flash) {
+                    let flashspot = new Flashspot(area);
+                    flashspot.fire(() => {
+                        this._removeShooterForSender(invocation.get_sender());
+                    });
+                } else {
+                    this._removeShooterForSender(invocation.get_sender());
+                }
+
+                let fdList = Gio.UnixFDList.new_from_array([fd]);
+                let retval = GLib.Variant.new('(bha{sv})', [result, 0, {
+                    format: GLib.Variant.new('s', 'argb32-premultiplied'),
+                    width: GLib.Variant.new('i', width),
+                    height: GLib.Variant.new('i', height),
+                    stride: GLib.Variant.new('i', stride),
+                    scale: GLib.Variant.new('d', scale),
+                }]);
+                invocation.return_value_with_unix_fd_list(retval, fdList);
+            });
+    }
+
+    ScreenshotAreasToFdAsync(params, invocation) {
+        let [areas, maxWidth, maxHeight] = params;
+        if (areas.length === 0 || maxWidth < 0 || maxHeight < 0) {
+            invocation.return_error_literal(Gio.IOErrorEnum,
+                                            Gio.IOErrorEnum.CANCELLED,
+                                            "Invalid params");
+            return;
+        }
+
+        let values = [];
+        for (let area of areas) {
+            let [x, y, width, height] = this._scaleArea(...area);
+            if (!this._checkArea(x, y, width, height)) {
+                invocation.return_error_literal(Gio.IOErrorEnum,
+                                                Gio.IOErrorEnum.CANCELLED,
+                                                "Invalid params");
+                return;
+            }
+            values.push(x, y, width, height);
+        }
+
+        let screenshot = this._createScreenshot(invocation, false);
+        if (!screenshot)
+            return;
+        screenshot.screenshot_areas_to_fd(values, maxWidth, maxHeight,
+            (o, res) => {
+                this._removeShooterForSender(invocation.get_sender());
+
+                let result, fd, images;
+                try {
+                    [result, fd, images] =
+                        screenshot.screenshot_areas_to_fd_finish(res);
+                } catch (e) {
+                    invocation.return_gerror(e);
+                    return;
+                }
+
+                if (!result) {
+                    invocation.return_error_literal(Gio.IOErrorEnum,
+                                                    Gio.IOErrorEnum.FAILED,
+                                                    "Failed to take screenshot");
+                    return;
+                }
+
+                let fdList = Gio.UnixFDList.new_from_array([fd]);
+                let retval = GLib.Variant.new_tuple([
+                    GLib.Variant.new_boolean(result),
+                    GLib.Variant.new_handle(0),
+                    images,
+                ]);
+                invocation.return_value_with_unix_fd_list(retval, fdList);
+            });
+    }
+
     SelectAreaAsync(params, invocation) {
         let selectArea = new SelectArea();
         selectArea.show();
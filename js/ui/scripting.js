@@ -1,6 +1,7 @@
 // -*- mode: js; js-indent-level: 4; indent-tabs-mode: nil -*-
-/* exported sleep, waitLeisure, createTestWindow, waitTestWindows,
-            destroyTestWindows, defineScriptEvent, scriptEvent,
+/* exported sleep, waitLeisure, createTestWindow, createDamageWindow,
+            setTitleChangeRate, sendTestNotifications, mapUnmapTestWindows,
+            waitTestWindows, destroyTestWindows, defineScriptEvent, scriptEvent,
             collectStatistics, runPerfScript */
 
 const { Gio, GLib, Meta, Shell } = imports.gi;
@@ -117,6 +118,90 @@ function createTestWindow(params) {
                        params.alpha, params.maximized, params.redraws);
 }
 
+/**
+ * createDamageWindow:
+ * @params: options for window creation.
+ *   width - width of window, in pixels (default 640)
+ *   height - height of window, in pixels (default 480)
+ *   rate - number of redraws per second (default 60)
+ *   damageWidth - width of the area redrawn each time, in pixels (default 64)
+ *   damageHeight - height of the area redrawn each time, in pixels (default 64)
+ *
+ * Like createTestWindow(), but creates a window that keeps redrawing
+ * an area of the given size at a fixed rate, to measure the cost of
+ * client damage independently of the window size.
+ */
+function createDamageWindow(params) {
+    params = Params.parse(params, { width: 640,
+                                    height: 480,
+                                    rate: 60,
+                                    damageWidth: 64,
+                                    damageHeight: 64 });
+
+    let perfHelper = _getPerfHelper();
+    return _callRemote(perfHelper, perfHelper.CreateDamageWindowRemote,
+                       params.width, params.height, params.rate,
+                       params.damageWidth, params.damageHeight);
+}
+
+/**
+ * setTitleChangeRate:
+ * @rate: number of title changes per second, or 0 to stop changing titles
+ * @icons: whether the window icons should change along with the titles
+ *
+ * Makes all windows created with gnome-shell-perf-helper change their
+ * title (and optionally their icon) at the given rate. The changes stop
+ * when the windows are destroyed with destroyTestWindows().
+ */
+function setTitleChangeRate(rate, icons = false) {
+    let perfHelper = _getPerfHelper();
+    return _callRemote(perfHelper, perfHelper.SetTitleChangeRateRemote,
+                       rate, icons);
+}
+
+/**
+ * sendTestNotifications:
+ * @count: number of notifications to send
+ * @interval: (optional) milliseconds between notifications, 0 (the
+ *   default) to send them all at once
+ *
+ * Makes gnome-shell-perf-helper send notifications over the
+ * org.freedesktop.Notifications D-Bus interface, so they go through
+ * the same path as notifications of real applications. Use with yield
+ * to wait until all notifications have been received by the shell.
+ */
+function sendTestNotifications(count, interval = 0) {
+    let perfHelper = _getPerfHelper();
+    return _callRemote(perfHelper, perfHelper.SendNotificationsRemote,
+                       count, interval);
+}
+
+/**
+ * mapUnmapTestWindows:
+ * @params: options for the burst.
+ *   count - number of windows (default 10)
+ *   width - width of the windows, in pixels (default 320)
+ *   height - height of the windows, in pixels (default 240)
+ *   cycles - how often the windows are unmapped and mapped again (default 10)
+ *   interval - milliseconds between each map or unmap (default 50)
+ *
+ * Creates windows using gnome-shell-perf-helper and repeatedly unmaps and
+ * maps all of them at once. Use with yield to wait until the burst is
+ * over; the windows are removed with destroyTestWindows().
+ */
+function mapUnmapTestWindows(params) {
+    params = Params.parse(params, { count: 10,
+                                    width: 320,
+                                    height: 240,
+                                    cycles: 10,
+                                    interval: 50 });
+
+    let perfHelper = _getPerfHelper();
+    return _callRemote(perfHelper, perfHelper.MapUnmapWindowsRemote,
+                       params.count, params.width, params.height,
+                       params.cycles, params.interval);
+}
+
 /**
  * waitTestWindows:
  *
@@ -146,26 +231,32 @@ function destroyTestWindows() {
  * defineScriptEvent
  * @name: The event will be called script.<name>
  * @description: Short human-readable description of the event
+ * @signature: (optional) signature of the event argument, '' (the
+ *   default) for no argument or 's' for a single string argument
  *
- * Convenience function to define a zero-argument performance event
- * within the 'script' namespace that is reserved for events defined locally
+ * Convenience function to define a performance event within the
+ * 'script' namespace that is reserved for events defined locally
  * within a performance automation script
  */
-function defineScriptEvent(name, description) {
+function defineScriptEvent(name, description, signature = '') {
     Shell.PerfLog.get_default().define_event(`script.${name}`,
                                              description,
-                                             "");
+                                             signature);
 }
 
 /**
  * scriptEvent
  * @name: Name registered with defineScriptEvent()
+ * @arg: (optional) string argument, for events defined with signature 's'
  *
  * Convenience function to record a script-local performance event
  * previously defined with defineScriptEvent
  */
-function scriptEvent(name) {
-    Shell.PerfLog.get_default().event(`script.${name}`);
+function scriptEvent(name, arg) {
+    if (arg === undefined)
+        Shell.PerfLog.get_default().event(`script.${name}`);
+    else
+        Shell.PerfLog.get_default().event_s(`script.${name}`, arg);
 }
 
 /**
@@ -272,10 +363,33 @@ function _collect(scriptModule, outputFile) {
     }
 }
 
+function _dumpBinaryLog(path) {
+    let file = Gio.File.new_for_path(path);
+    let out = file.replace(null, false, Gio.FileCreateFlags.NONE, null);
+    let compress = path.endsWith('.gz');
+
+    return new Promise((resolve, reject) => {
+        Shell.PerfLog.get_default().dump_binary_async(out, compress, null,
+            (perfLog, res) => {
+                try {
+                    perfLog.dump_binary_finish(res);
+                    out.close(null);
+                    resolve();
+                } catch (e) {
+                    reject(e);
+                }
+            });
+    });
+}
+
 /**
  * runPerfScript
  * @scriptModule: module object with run and finish functions
  *    and event handlers
+ * @outputFile: (optional) file to write the metrics and event log to
+ * @binaryLogFile: (optional) file to additionally write the event log
+ *    to in the binary format; it is gzip compressed if the name ends
+ *    with '.gz'
  *
  * Runs a script for automated collection of performance data. The
  * script is defined as a Javascript module with specified contents.
@@ -307,12 +421,14 @@ function _collect(scriptModule, outputFile) {
  *  value: computed value of the metric
  *
  * The resulting metrics will be written to @outputFile as JSON, or,
- * if @outputFile is not provided, logged.
+ * if @outputFile is not provided, logged. The event log can be written
+ * to @binaryLogFile without blocking the main loop, and converted to
+ * JSON later with gnome-shell-perf-log-to-json.
  *
  * After running the script and collecting statistics from the
  * event log, GNOME Shell will exit.
  **/
-async function runPerfScript(scriptModule, outputFile) {
+async function runPerfScript(scriptModule, outputFile, binaryLogFile) {
     Shell.PerfLog.get_default().set_enabled(true);
 
     for (let step of scriptModule.run()) {
@@ -326,6 +442,8 @@ async function runPerfScript(scriptModule, outputFile) {
 
     try {
         _collect(scriptModule, outputFile);
+        if (binaryLogFile)
+            await _dumpBinaryLog(binaryLogFile);
     } catch (err) {
         log(`Script failed: ${err}\n${err.stack}`);
         Meta.exit(Meta.ExitCode.ERROR);
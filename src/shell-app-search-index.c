@@ -0,0 +1,792 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+#include "config.h"
+
+#include <string.h>
+
+#include "shell-app-search-index.h"
+
+/*
+ * ShellAppSearchIndex keeps the search tokens of all installed
+ * applications, so that searching doesn't need to go through GLib's
+ * global desktop file index (and re-read it when it changed) for
+ * every keystroke.
+ *
+ * Tokens are kept in a sorted array for prefix matches, and in a
+ * trigram index for substring matches. Terms shorter than a trigram
+ * only match by prefix: they would be found in the middle of nearly
+ * every app, and finding them there would mean checking every token
+ * for what is usually the first thing typed. Entries are only
+ * re-tokenized when the strings of their desktop file actually
+ * changed.
+ *
+ * The searchable strings of an app are passed in serialized form, see
+ * _shell_app_search_index_serialize_info(), so that they can be stored
+ * in the desktop file cache and indexed without loading the desktop file.
+ */
+
+/* Match categories, in the order of preference used by
+ * g_desktop_app_info_search(). Tokens of all categories but the
+ * comment are also matched by substring; those matches rank after
+ * all prefix matches.
+ */
+typedef enum {
+  MATCH_NAME,
+  MATCH_EXEC,
+  MATCH_KEYWORDS,
+  MATCH_GENERIC_NAME,
+  MATCH_FULL_NAME,
+  MATCH_COMMENT,
+  N_MATCH_CATEGORIES
+} MatchCategory;
+
+#define N_SUBSTRING_CATEGORIES MATCH_COMMENT
+#define N_GROUPS (N_MATCH_CATEGORIES + N_SUBSTRING_CATEGORIES)
+
+#define TRIGRAM_LENGTH 3
+
+#define SEARCH_DATA_SEPARATOR "\x1f"
+
+typedef struct _IndexEntry IndexEntry;
+
+typedef struct {
+  char *token;
+  IndexEntry *entry;
+  MatchCategory category;
+} IndexToken;
+
+struct _IndexEntry {
+  char *id;
+  char *search_data;
+  GPtrArray *tokens;
+};
+
+typedef struct {
+  MatchCategory category;
+  char *value;
+} SearchString;
+
+struct _ShellAppSearchIndex {
+  GHashTable *entries;
+  GHashTable *trigrams;
+
+  GPtrArray *sorted_tokens;
+  gboolean sorted_tokens_dirty;
+
+  /* Whether the last search had terms that only matched by prefix */
+  gboolean last_search_prefix_only;
+};
+
+static void
+index_token_free (IndexToken *token)
+{
+  g_free (token->token);
+  g_free (token);
+}
+
+static void
+index_entry_free (IndexEntry *entry)
+{
+  g_free (entry->id);
+  g_free (entry->search_data);
+  g_ptr_array_unref (entry->tokens);
+  g_free (entry);
+}
+
+static void
+search_string_clear (SearchString *string)
+{
+  g_free (string->value);
+}
+
+static void
+add_search_string (GArray        *strings,
+                   MatchCategory  category,
+                   char          *value)
+{
+  SearchString string = { category, value };
+
+  if (value == NULL || *value == '\0')
+    {
+      g_free (value);
+      return;
+    }
+
+  g_array_append_val (strings, string);
+}
+
+static GArray *
+get_search_strings (GDesktopAppInfo *info)
+{
+  GAppInfo *app_info = G_APP_INFO (info);
+  const char * const *keywords;
+  const char *executable;
+  GArray *strings;
+
+  strings = g_array_new (FALSE, FALSE, sizeof (SearchString));
+  g_array_set_clear_func (strings, (GDestroyNotify) search_string_clear);
+
+  /* Besides the localized name, match the untranslated one as well */
+  add_search_string (strings, MATCH_NAME,
+                     g_strdup (g_app_info_get_name (app_info)));
+  add_search_string (strings, MATCH_NAME,
+                     g_desktop_app_info_get_string (info, "Name"));
+
+  /* Like GLib, only match the program name and not its arguments */
+  executable = g_app_info_get_executable (app_info);
+  if (executable != NULL)
+    add_search_string (strings, MATCH_EXEC, g_path_get_basename (executable));
+
+  keywords = g_desktop_app_info_get_keywords (info);
+  for (; keywords && *keywords; keywords++)
+    add_search_string (strings, MATCH_KEYWORDS, g_strdup (*keywords));
+
+  add_search_string (strings, MATCH_GENERIC_NAME,
+                     g_strdup (g_desktop_app_info_get_generic_name (info)));
+  add_search_string (strings, MATCH_FULL_NAME,
+                     g_desktop_app_info_get_locale_string (info, "X-GNOME-FullName"));
+  add_search_string (strings, MATCH_COMMENT,
+                     g_strdup (g_app_info_get_description (app_info)));
+
+  return strings;
+}
+
+/* Parses search data as written by _shell_app_search_index_serialize_info() */
+static GArray *
+parse_search_data (const char *search_data)
+{
+  GArray *strings;
+  char **values, **v;
+
+  strings = g_array_new (FALSE, FALSE, sizeof (SearchString));
+  g_array_set_clear_func (strings, (GDestroyNotify) search_string_clear);
+
+  values = g_strsplit (search_data, SEARCH_DATA_SEPARATOR, -1);
+
+  for (v = values; *v; v++)
+    {
+      guint64 category;
+      char *value;
+
+      if (!g_ascii_isdigit (**v))
+        continue;
+
+      category = g_ascii_strtoull (*v, &value, 10);
+      if (*value != ':' || category >= N_MATCH_CATEGORIES)
+        continue;
+
+      add_search_string (strings, category, g_strdup (value + 1));
+    }
+
+  g_strfreev (values);
+
+  return strings;
+}
+
+static gboolean
+is_substring_category (MatchCategory category)
+{
+  return category < N_SUBSTRING_CATEGORIES;
+}
+
+/* Whether @term is too short to contain a trigram */
+static gboolean
+is_short_term (const char *term)
+{
+  int i;
+
+  for (i = 0; i < TRIGRAM_LENGTH; i++)
+    {
+      if (*term == '\0')
+        return TRUE;
+
+      term = g_utf8_next_char (term);
+    }
+
+  return FALSE;
+}
+
+static gboolean
+has_short_terms (char **terms)
+{
+  for (; *terms; terms++)
+    if (is_short_term (*terms))
+      return TRUE;
+
+  return FALSE;
+}
+
+/* Returns the trigram starting at @start, or %NULL if fewer
+ * than TRIGRAM_LENGTH characters are left.
+ */
+static char *
+get_trigram (const char *start)
+{
+  const char *end = start;
+  int i;
+
+  for (i = 0; i < TRIGRAM_LENGTH; i++)
+    {
+      if (*end == '\0')
+        return NULL;
+
+      end = g_utf8_next_char (end);
+    }
+
+  return g_strndup (start, end - start);
+}
+
+static void
+add_trigrams (ShellAppSearchIndex *index,
+              IndexToken          *token)
+{
+  const char *start;
+  char *trigram;
+
+  for (start = token->token;
+       (trigram = get_trigram (start)) != NULL;
+       start = g_utf8_next_char (start))
+    {
+      GPtrArray *tokens;
+
+      tokens = g_hash_table_lookup (index->trigrams, trigram);
+      if (tokens == NULL)
+        {
+          tokens = g_ptr_array_new ();
+          g_hash_table_insert (index->trigrams, trigram, tokens);
+        }
+      else
+        {
+          g_free (trigram);
+        }
+
+      /* Tokens like "aaaa" contain the same trigram more than once */
+      if (tokens->len == 0 ||
+          g_ptr_array_index (tokens, tokens->len - 1) != token)
+        g_ptr_array_add (tokens, token);
+    }
+}
+
+static void
+remove_trigrams (ShellAppSearchIndex *index,
+                 IndexToken          *token)
+{
+  const char *start;
+  char *trigram;
+
+  for (start = token->token;
+       (trigram = get_trigram (start)) != NULL;
+       start = g_utf8_next_char (start))
+    {
+      GPtrArray *tokens;
+
+      tokens = g_hash_table_lookup (index->trigrams, trigram);
+      if (tokens != NULL)
+        {
+          g_ptr_array_remove_fast (tokens, token);
+          if (tokens->len == 0)
+            g_hash_table_remove (index->trigrams, trigram);
+        }
+      g_free (trigram);
+    }
+}
+
+static void
+add_token (ShellAppSearchIndex *index,
+           IndexEntry          *entry,
+           GHashTable          *seen,
+           const char          *value,
+           MatchCategory        category)
+{
+  IndexToken *token;
+
+  /* Strings are added in order of preference, so a token that was
+   * already added for this entry has a better category already.
+   */
+  if (g_hash_table_contains (seen, value))
+    return;
+
+  token = g_new0 (IndexToken, 1);
+  token->token = g_strdup (value);
+  token->entry = entry;
+  token->category = category;
+
+  g_hash_table_add (seen, token->token);
+  g_ptr_array_add (entry->tokens, token);
+
+  if (is_substring_category (category))
+    add_trigrams (index, token);
+}
+
+static void
+add_entry (ShellAppSearchIndex *index,
+           const char          *id,
+           const char          *search_data)
+{
+  IndexEntry *entry;
+  GHashTable *seen;
+  GArray *strings;
+  guint i;
+
+  strings = parse_search_data (search_data);
+
+  entry = g_new0 (IndexEntry, 1);
+  entry->id = g_strdup (id);
+  entry->search_data = g_strdup (search_data);
+  entry->tokens = g_ptr_array_new_with_free_func ((GDestroyNotify) index_token_free);
+
+  seen = g_hash_table_new (g_str_hash, g_str_equal);
+
+  for (i = 0; i < strings->len; i++)
+    {
+      SearchString *string = &g_array_index (strings, SearchString, i);
+      char **tokens, **alternates, **t;
+
+      tokens = g_str_tokenize_and_fold (string->value, NULL, &alternates);
+
+      for (t = tokens; *t; t++)
+        add_token (index, entry, seen, *t, string->category);
+      for (t = alternates; *t; t++)
+        add_token (index, entry, seen, *t, string->category);
+
+      g_strfreev (tokens);
+      g_strfreev (alternates);
+    }
+
+  g_hash_table_destroy (seen);
+  g_array_unref (strings);
+
+  g_hash_table_insert (index->entries, entry->id, entry);
+  index->sorted_tokens_dirty = TRUE;
+}
+
+static void
+remove_entry (ShellAppSearchIndex *index,
+              IndexEntry          *entry)
+{
+  guint i;
+
+  for (i = 0; i < entry->tokens->len; i++)
+    {
+      IndexToken *token = g_ptr_array_index (entry->tokens, i);
+
+      if (is_substring_category (token->category))
+        remove_trigrams (index, token);
+    }
+
+  index->sorted_tokens_dirty = TRUE;
+}
+
+static int
+compare_tokens (gconstpointer a,
+                gconstpointer b)
+{
+  const IndexToken *token_a = *(const IndexToken **) a;
+  const IndexToken *token_b = *(const IndexToken **) b;
+
+  return strcmp (token_a->token, token_b->token);
+}
+
+static void
+ensure_sorted_tokens (ShellAppSearchIndex *index)
+{
+  GHashTableIter iter;
+  gpointer value;
+
+  if (!index->sorted_tokens_dirty)
+    return;
+
+  g_ptr_array_set_size (index->sorted_tokens, 0);
+
+  g_hash_table_iter_init (&iter, index->entries);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+      IndexEntry *entry = value;
+      guint i;
+
+      for (i = 0; i < entry->tokens->len; i++)
+        g_ptr_array_add (index->sorted_tokens,
+                         g_ptr_array_index (entry->tokens, i));
+    }
+
+  g_ptr_array_sort (index->sorted_tokens, compare_tokens);
+  index->sorted_tokens_dirty = FALSE;
+}
+
+ShellAppSearchIndex *
+_shell_app_search_index_new (void)
+{
+  ShellAppSearchIndex *index = g_new0 (ShellAppSearchIndex, 1);
+
+  index->entries = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+                                          (GDestroyNotify) index_entry_free);
+  index->trigrams = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                           (GDestroyNotify) g_ptr_array_unref);
+  index->sorted_tokens = g_ptr_array_new ();
+
+  return index;
+}
+
+void
+_shell_app_search_index_free (ShellAppSearchIndex *index)
+{
+  g_ptr_array_unref (index->sorted_tokens);
+  g_hash_table_destroy (index->trigrams);
+  g_hash_table_destroy (index->entries);
+  g_free (index);
+}
+
+/**
+ * _shell_app_search_index_serialize_info:
+ * @info: a #GDesktopAppInfo
+ *
+ * Returns: (transfer full): the searchable strings of @info, in the
+ *   form expected by _shell_app_search_index_update_app()
+ */
+char *
+_shell_app_search_index_serialize_info (GDesktopAppInfo *info)
+{
+  GString *search_data = g_string_new (NULL);
+  GArray *strings;
+  guint i;
+
+  strings = get_search_strings (info);
+
+  for (i = 0; i < strings->len; i++)
+    {
+      SearchString *string = &g_array_index (strings, SearchString, i);
+
+      g_strdelimit (string->value, SEARCH_DATA_SEPARATOR, ' ');
+      g_string_append_printf (search_data, "%d:%s" SEARCH_DATA_SEPARATOR,
+                              string->category, string->value);
+    }
+
+  g_array_unref (strings);
+
+  return g_string_free (search_data, FALSE);
+}
+
+/**
+ * _shell_app_search_index_update_app:
+ * @index: a #ShellAppSearchIndex
+ * @id: an application ID
+ * @search_data: (nullable): the serialized searchable strings of @id,
+ *   or %NULL if @id is no longer installed
+ *
+ * Updates the entry for @id after its desktop file changed. The
+ * entry is only re-indexed if its searchable strings changed.
+ */
+void
+_shell_app_search_index_update_app (ShellAppSearchIndex *index,
+                                    const char          *id,
+                                    const char          *search_data)
+{
+  IndexEntry *entry;
+
+  entry = g_hash_table_lookup (index->entries, id);
+
+  if (entry != NULL && g_strcmp0 (entry->search_data, search_data) == 0)
+    return;
+
+  if (entry != NULL)
+    {
+      remove_entry (index, entry);
+      g_hash_table_remove (index->entries, id);
+    }
+
+  if (search_data != NULL)
+    add_entry (index, id, search_data);
+}
+
+static void
+add_match (GHashTable *matches,
+           IndexEntry *entry,
+           guint       group)
+{
+  gpointer old_group;
+
+  /* Groups are stored off by one, to tell them apart from a missing entry */
+  old_group = g_hash_table_lookup (matches, entry);
+  if (old_group == NULL || group + 1 < GPOINTER_TO_UINT (old_group))
+    g_hash_table_insert (matches, entry, GUINT_TO_POINTER (group + 1));
+}
+
+static void
+add_substring_matches (ShellAppSearchIndex *index,
+                       const char          *term,
+                       GHashTable          *matches)
+{
+  GPtrArray *candidates = NULL;
+  const char *start;
+  char *trigram;
+  guint i;
+
+  if (is_short_term (term))
+    return;
+
+  /* Use the shortest list of tokens containing one of the trigrams
+   * of @term */
+  for (start = term;
+       (trigram = get_trigram (start)) != NULL;
+       start = g_utf8_next_char (start))
+    {
+      GPtrArray *tokens;
+
+      tokens = g_hash_table_lookup (index->trigrams, trigram);
+      g_free (trigram);
+
+      if (tokens == NULL)
+        return;
+
+      if (candidates == NULL || tokens->len < candidates->len)
+        candidates = tokens;
+    }
+
+  for (i = 0; i < candidates->len; i++)
+    {
+      IndexToken *token = g_ptr_array_index (candidates, i);
+
+      if (!is_substring_category (token->category))
+        continue;
+
+      if (strstr (token->token, term) != NULL)
+        add_match (matches, token->entry, N_MATCH_CATEGORIES + token->category);
+    }
+}
+
+static GHashTable *
+match_term (ShellAppSearchIndex *index,
+            const char          *term)
+{
+  GHashTable *matches;
+  guint lower, upper;
+  guint i;
+
+  matches = g_hash_table_new (NULL, NULL);
+
+  /* Find the first token that is not smaller than @term, all prefix
+   * matches follow it.
+   */
+  lower = 0;
+  upper = index->sorted_tokens->len;
+  while (lower < upper)
+    {
+      guint middle = lower + (upper - lower) / 2;
+      IndexToken *token = g_ptr_array_index (index->sorted_tokens, middle);
+
+      if (strcmp (token->token, term) < 0)
+        lower = middle + 1;
+      else
+        upper = middle;
+    }
+
+  for (i = lower; i < index->sorted_tokens->len; i++)
+    {
+      IndexToken *token = g_ptr_array_index (index->sorted_tokens, i);
+
+      if (!g_str_has_prefix (token->token, term))
+        break;
+
+      add_match (matches, token->entry, token->category);
+    }
+
+  add_substring_matches (index, term, matches);
+
+  return matches;
+}
+
+static guint
+match_entry (IndexEntry *entry,
+             const char *term)
+{
+  gboolean match_substrings = !is_short_term (term);
+  guint group = G_MAXUINT;
+  guint i;
+
+  for (i = 0; i < entry->tokens->len; i++)
+    {
+      IndexToken *token = g_ptr_array_index (entry->tokens, i);
+
+      if (g_str_has_prefix (token->token, term))
+        group = MIN (group, (guint) token->category);
+      else if (match_substrings &&
+               is_substring_category (token->category) &&
+               strstr (token->token, term) != NULL)
+        group = MIN (group, N_MATCH_CATEGORIES + token->category);
+    }
+
+  return group;
+}
+
+static int
+compare_ids (gconstpointer a,
+             gconstpointer b)
+{
+  return strcmp (*(const char **) a, *(const char **) b);
+}
+
+/* Turns a hash table of entries to groups into the result format of
+ * g_desktop_app_info_search(), with an entry matching several terms
+ * ending up in the worst group it matched.
+ */
+static char ***
+get_results (GHashTable *matches)
+{
+  GPtrArray *groups[N_GROUPS] = { NULL, };
+  GHashTableIter iter;
+  gpointer key, value;
+  char ***results;
+  int i, n_results;
+
+  g_hash_table_iter_init (&iter, matches);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      IndexEntry *entry = key;
+      guint group = GPOINTER_TO_UINT (value) - 1;
+
+      if (groups[group] == NULL)
+        groups[group] = g_ptr_array_new ();
+
+      g_ptr_array_add (groups[group], g_strdup (entry->id));
+    }
+
+  results = g_new0 (char **, N_GROUPS + 1);
+  n_results = 0;
+
+  for (i = 0; i < N_GROUPS; i++)
+    {
+      if (groups[i] == NULL)
+        continue;
+
+      g_ptr_array_sort (groups[i], compare_ids);
+      g_ptr_array_add (groups[i], NULL);
+      results[n_results++] = (char **) g_ptr_array_free (groups[i], FALSE);
+    }
+
+  return results;
+}
+
+/**
+ * _shell_app_search_index_search:
+ * @index: a #ShellAppSearchIndex
+ * @search_string: the search string to use
+ *
+ * Searches @index like g_desktop_app_info_search() searches the
+ * desktop file index, except that terms of at least three characters
+ * matching in the middle of a token produce results as well, grouped
+ * after all other results.
+ *
+ * Returns: (transfer full): a %NULL-terminated list of groups of
+ *   application IDs
+ */
+char ***
+_shell_app_search_index_search (ShellAppSearchIndex *index,
+                                const char          *search_string)
+{
+  GHashTable *matches = NULL;
+  char ***results;
+  char **terms;
+  int i;
+
+  ensure_sorted_tokens (index);
+
+  terms = g_str_tokenize_and_fold (search_string, NULL, NULL);
+  index->last_search_prefix_only = has_short_terms (terms);
+
+  for (i = 0; terms[i]; i++)
+    {
+      GHashTable *term_matches = match_term (index, terms[i]);
+      GHashTableIter iter;
+      gpointer key, value;
+
+      if (matches == NULL)
+        {
+          matches = term_matches;
+          continue;
+        }
+
+      /* Only keep entries matching all terms */
+      g_hash_table_iter_init (&iter, matches);
+      while (g_hash_table_iter_next (&iter, &key, &value))
+        {
+          gpointer term_group = g_hash_table_lookup (term_matches, key);
+
+          if (term_group == NULL)
+            g_hash_table_iter_remove (&iter);
+          else if (GPOINTER_TO_UINT (term_group) > GPOINTER_TO_UINT (value))
+            g_hash_table_iter_replace (&iter, term_group);
+        }
+
+      g_hash_table_destroy (term_matches);
+    }
+
+  g_strfreev (terms);
+
+  if (matches == NULL)
+    return g_new0 (char **, 1);
+
+  results = get_results (matches);
+  g_hash_table_destroy (matches);
+
+  return results;
+}
+
+/**
+ * _shell_app_search_index_subsearch:
+ * @index: a #ShellAppSearchIndex
+ * @previous_results: the IDs returned by a previous search
+ * @search_string: the search string to use
+ *
+ * Like _shell_app_search_index_search(), but only considers the
+ * applications in @previous_results. If @search_string extends the
+ * search string of the previous search, the results are the same
+ * as for a full search, as adding terms or characters only ever
+ * removes matches. The exception is a term growing long enough to
+ * match in the middle of tokens; if the last search had terms that
+ * short, this does a full search instead.
+ *
+ * IDs in @previous_results that are not known to @index are ignored.
+ *
+ * Returns: (transfer full): a %NULL-terminated list of groups of
+ *   application IDs
+ */
+char ***
+_shell_app_search_index_subsearch (ShellAppSearchIndex *index,
+                                   const char * const  *previous_results,
+                                   const char          *search_string)
+{
+  GHashTable *matches;
+  char ***results;
+  char **terms;
+  int i, j;
+
+  if (index->last_search_prefix_only)
+    return _shell_app_search_index_search (index, search_string);
+
+  terms = g_str_tokenize_and_fold (search_string, NULL, NULL);
+  index->last_search_prefix_only = has_short_terms (terms);
+  matches = g_hash_table_new (NULL, NULL);
+
+  for (i = 0; terms[0] && previous_results[i]; i++)
+    {
+      IndexEntry *entry;
+      guint group = 0;
+
+      entry = g_hash_table_lookup (index->entries, previous_results[i]);
+      if (entry == NULL)
+        continue;
+
+      for (j = 0; terms[j] && group != G_MAXUINT; j++)
+        group = MAX (group, match_entry (entry, terms[j]));
+
+      if (group != G_MAXUINT)
+        g_hash_table_insert (matches, entry, GUINT_TO_POINTER (group + 1));
+    }
+
+  g_strfreev (terms);
+
+  results = get_results (matches);
+  g_hash_table_destroy (matches);
+
+  return results;
+}
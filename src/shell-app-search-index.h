@@ -0,0 +1,29 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+#ifndef __SHELL_APP_SEARCH_INDEX_H__
+#define __SHELL_APP_SEARCH_INDEX_H__
+
+#include <gio/gio.h>
+#include <gio/gdesktopappinfo.h>
+
+G_BEGIN_DECLS
+
+typedef struct _ShellAppSearchIndex ShellAppSearchIndex;
+
+ShellAppSearchIndex *_shell_app_search_index_new            (void);
+void                 _shell_app_search_index_free           (ShellAppSearchIndex *index);
+
+char                *_shell_app_search_index_serialize_info (GDesktopAppInfo     *info);
+
+void                 _shell_app_search_index_update_app     (ShellAppSearchIndex *index,
+                                                             const char          *id,
+                                                             const char          *search_data);
+
+char              ***_shell_app_search_index_search         (ShellAppSearchIndex *index,
+                                                             const char          *search_string);
+char              ***_shell_app_search_index_subsearch      (ShellAppSearchIndex *index,
+                                                             const char * const  *previous_results,
+                                                             const char          *search_string);
+
+G_END_DECLS
+
+#endif /* __SHELL_APP_SEARCH_INDEX_H__ */
@@ -5,5 +5,15 @@
 #include "shell-app-system.h"
 
 void _shell_app_system_notify_app_state_changed (ShellAppSystem *self, ShellApp *app);
+void _shell_app_system_invalidate_running (ShellAppSystem *self);
+
+void      _shell_app_system_add_app_window    (ShellAppSystem *self,
+                                               ShellApp       *app,
+                                               MetaWindow     *window);
+void      _shell_app_system_remove_app_window (ShellAppSystem *self,
+                                               ShellApp       *app,
+                                               MetaWindow     *window);
+ShellApp *_shell_app_system_lookup_pid        (ShellAppSystem *self,
+                                               int             pid);
 
 #endif
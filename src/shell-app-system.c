@@ -8,8 +8,11 @@
 
 #include <gio/gio.h>
 #include <glib/gi18n.h>
+#include <meta/compositor.h>
 
 #include "shell-app-private.h"
+#include "shell-app-search-index.h"
+#include "shell-desktop-file-cache.h"
 #include "shell-window-tracker-private.h"
 #include "shell-app-system-private.h"
 #include "shell-global.h"
@@ -39,6 +42,7 @@ enum {
 
 enum {
   APP_STATE_CHANGED,
+  APPS_STATE_CHANGED,
   INSTALLED_CHANGED,
   LAST_SIGNAL
 };
@@ -47,6 +51,11 @@ static guint signals[LAST_SIGNAL] = { 0 };
 
 typedef struct _ShellAppSystemPrivate ShellAppSystemPrivate;
 
+typedef struct {
+  ShellApp *app;
+  guint n_windows;
+} PidApp;
+
 struct _ShellAppSystem
 {
   GObject parent;
@@ -56,9 +65,30 @@ struct _ShellAppSystem
 
 struct _ShellAppSystemPrivate {
   GHashTable *running_apps;
+  /* running_apps sorted by shell_app_compare(), rebuilt on demand */
+  GSList *sorted_running_apps;
+  gboolean sorted_running_apps_stale;
+  /* Apps whose state changed since ::apps-state-changed was last emitted */
+  GHashTable *state_changed_apps;
+  guint apps_state_changed_later_id;
+  /* <int pid, GSList *PidApp> */
+  GHashTable *pid_to_apps;
+  /* <MetaWindow *window, int pid> */
+  GHashTable *window_to_pid;
+  /* <MetaWindow *window, ShellApp *app> of windows that had no pid yet
+   * when they were added; X11 clients may set _NET_WM_PID after mapping */
+  GHashTable *windows_without_pid;
   GHashTable *id_to_app;
   GHashTable *startup_wm_class_to_id;
+  /* Loaded on demand, see shell_app_system_get_installed() */
   GList *installed_apps;
+  gboolean installed_apps_stale;
+  ShellAppSearchIndex *search_index;
+
+  /* <char *id, ShellDesktopFile *file> */
+  GHashTable *desktop_files;
+  GPtrArray *desktop_dirs;
+  guint installed_changed_id;
 
   guint rescan_icons_timeout_id;
   guint n_rescan_retries;
@@ -81,6 +111,25 @@ static void shell_app_system_class_init(ShellAppSystemClass *klass)
                                              NULL, NULL, NULL,
                                              G_TYPE_NONE, 1,
                                              SHELL_TYPE_APP);
+
+  /**
+   * ShellAppSystem::apps-state-changed:
+   * @self: the #ShellAppSystem
+   * @apps: (element-type ShellApp): the applications whose state changed
+   *
+   * Like #ShellAppSystem::app-state-changed, but emitted at most once
+   * per frame for all applications whose state changed since the last
+   * emission, so that handlers doing expensive work like relayouts
+   * only need to do it once when many applications change state.
+   * Only the final state of each application is reported.
+   */
+  signals[APPS_STATE_CHANGED] = g_signal_new ("apps-state-changed",
+                                              SHELL_TYPE_APP_SYSTEM,
+                                              G_SIGNAL_RUN_LAST,
+                                              0,
+                                              NULL, NULL, NULL,
+                                              G_TYPE_NONE, 1,
+                                              G_TYPE_PTR_ARRAY);
   signals[INSTALLED_CHANGED] =
     g_signal_new ("installed-changed",
 		  SHELL_TYPE_APP_SYSTEM,
@@ -90,28 +139,143 @@ static void shell_app_system_class_init(ShellAppSystemClass *klass)
 		  G_TYPE_NONE, 0);
 }
 
+/* GLib only monitors the desktop file directories again after they
+ * were used for a lookup, which wouldn't happen if none of the desktop
+ * files changed in a way we notice.
+ */
 static void
-scan_startup_wm_class_to_id (ShellAppSystem *self)
+ensure_desktop_file_dirs_monitored (void)
+{
+  GDesktopAppInfo *info = g_desktop_app_info_new ("org.gnome.Shell.desktop");
+
+  g_clear_object (&info);
+}
+
+static gboolean
+desktop_file_equal (ShellDesktopFile *a,
+                    ShellDesktopFile *b)
+{
+  return a->mtime == b->mtime &&
+         a->inode == b->inode &&
+         a->size == b->size &&
+         strcmp (a->filename, b->filename) == 0;
+}
+
+static gboolean
+has_startup_wm_class (ShellDesktopFile *file)
+{
+  return file != NULL && !file->hidden && file->startup_wm_class != NULL;
+}
+
+static void
+desktop_file_take_data (ShellDesktopFile *file,
+                        ShellDesktopFile *old_file)
+{
+  file->has_metadata = old_file->has_metadata;
+  file->hidden = old_file->hidden;
+  file->should_show = old_file->should_show;
+  file->startup_wm_class = g_steal_pointer (&old_file->startup_wm_class);
+  file->search_data = g_steal_pointer (&old_file->search_data);
+  file->info = g_steal_pointer (&old_file->info);
+}
+
+/* Rescans the desktop file directories, only loading desktop files
+ * that were added or changed since the last scan. The first scan uses
+ * the desktop file cache instead if it's still valid.
+ *
+ * Returns: (transfer full): the IDs of apps that were added, changed
+ *   or removed
+ */
+static GPtrArray *
+update_desktop_files (ShellAppSystem *self,
+                      gboolean       *startup_wm_class_changed)
 {
   ShellAppSystemPrivate *priv = self->priv;
-  GList *l;
+  GHashTable *files = NULL;
+  GHashTableIter iter;
+  GPtrArray *changed, *dirs;
+  gpointer key, value;
+  gboolean from_cache;
 
-  g_hash_table_remove_all (priv->startup_wm_class_to_id);
+  ensure_desktop_file_dirs_monitored ();
 
-  g_list_free_full (priv->installed_apps, g_object_unref);
-  priv->installed_apps = g_app_info_get_all ();
+  changed = g_ptr_array_new_with_free_func (g_free);
+
+  if (priv->desktop_dirs == NULL)
+    files = _shell_desktop_file_cache_load (&dirs);
+
+  from_cache = files != NULL;
+  if (!from_cache)
+    files = _shell_desktop_file_cache_scan (&dirs);
 
-  for (l = priv->installed_apps; l != NULL; l = l->next)
+  *startup_wm_class_changed = FALSE;
+
+  g_hash_table_iter_init (&iter, files);
+  while (g_hash_table_iter_next (&iter, &key, &value))
     {
-      GAppInfo *info = l->data;
-      const char *startup_wm_class, *id, *old_id;
+      ShellDesktopFile *file = value;
+      ShellDesktopFile *old_file;
 
-      id = g_app_info_get_id (info);
-      startup_wm_class = g_desktop_app_info_get_startup_wm_class (G_DESKTOP_APP_INFO (info));
+      old_file = g_hash_table_lookup (priv->desktop_files, key);
+      if (old_file != NULL && desktop_file_equal (file, old_file))
+        {
+          desktop_file_take_data (file, old_file);
+          continue;
+        }
+
+      if (!file->has_metadata)
+        _shell_desktop_file_load (file, key);
+
+      if (has_startup_wm_class (file) || has_startup_wm_class (old_file))
+        *startup_wm_class_changed = TRUE;
+
+      g_ptr_array_add (changed, g_strdup (key));
+    }
 
-      if (startup_wm_class == NULL)
+  g_hash_table_iter_init (&iter, priv->desktop_files);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      if (g_hash_table_contains (files, key))
         continue;
 
+      if (has_startup_wm_class (value))
+        *startup_wm_class_changed = TRUE;
+
+      g_ptr_array_add (changed, g_strdup (key));
+    }
+
+  g_hash_table_destroy (priv->desktop_files);
+  priv->desktop_files = files;
+
+  g_clear_pointer (&priv->desktop_dirs, g_ptr_array_unref);
+  priv->desktop_dirs = dirs;
+
+  if (!from_cache && changed->len > 0)
+    _shell_desktop_file_cache_save (priv->desktop_files, priv->desktop_dirs);
+
+  return changed;
+}
+
+static void
+scan_startup_wm_class_to_id (ShellAppSystem *self)
+{
+  ShellAppSystemPrivate *priv = self->priv;
+  GHashTableIter iter;
+  gpointer key, value;
+
+  g_hash_table_remove_all (priv->startup_wm_class_to_id);
+
+  g_hash_table_iter_init (&iter, priv->desktop_files);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      ShellDesktopFile *file = value;
+      const char *startup_wm_class, *id = key, *old_id;
+
+      if (!has_startup_wm_class (file))
+        continue;
+
+      startup_wm_class = file->startup_wm_class;
+
       /* In case multiple .desktop files set the same StartupWMClass, prefer
        * the one where ID and StartupWMClass match */
       old_id = g_hash_table_lookup (priv->startup_wm_class_to_id, startup_wm_class);
@@ -122,16 +286,16 @@ scan_startup_wm_class_to_id (ShellAppSystem *self)
 }
 
 static gboolean
-app_is_stale (ShellApp *app)
+app_is_stale (ShellApp        *app,
+              GDesktopAppInfo *info)
 {
-  GDesktopAppInfo *info, *old;
+  GDesktopAppInfo *old;
   GAppInfo *old_info, *new_info;
   gboolean is_unchanged;
 
   if (shell_app_is_window_backed (app))
     return FALSE;
 
-  info = g_desktop_app_info_new (shell_app_get_id (app));
   if (!info)
     return TRUE;
 
@@ -156,18 +320,9 @@ app_is_stale (ShellApp *app)
     g_icon_equal (g_app_info_get_icon (old_info),
                   g_app_info_get_icon (new_info));
 
-  g_object_unref (info);
   return !is_unchanged;
 }
 
-static gboolean
-stale_app_remove_func (gpointer key,
-                       gpointer value,
-                       gpointer user_data)
-{
-  return app_is_stale (value);
-}
-
 static gboolean
 rescan_icon_theme_cb (gpointer user_data)
 {
@@ -209,18 +364,88 @@ rescan_icon_theme (ShellAppSystem *self)
                                                  self);
 }
 
+static void
+rescan_installed_apps (ShellAppSystem *self)
+{
+  ShellAppSystemPrivate *priv = self->priv;
+  gboolean startup_wm_class_changed;
+  GPtrArray *changed;
+  guint i;
+
+  changed = update_desktop_files (self, &startup_wm_class_changed);
+
+  if (changed->len > 0)
+    {
+      g_list_free_full (priv->installed_apps, g_object_unref);
+      priv->installed_apps = NULL;
+      priv->installed_apps_stale = TRUE;
+    }
+
+  if (startup_wm_class_changed)
+    scan_startup_wm_class_to_id (self);
+
+  for (i = 0; i < changed->len; i++)
+    {
+      const char *id = g_ptr_array_index (changed, i);
+      ShellDesktopFile *file = g_hash_table_lookup (priv->desktop_files, id);
+      ShellApp *app;
+
+      _shell_app_search_index_update_app (priv->search_index, id,
+                                          file ? file->search_data : NULL);
+
+      app = g_hash_table_lookup (priv->id_to_app, id);
+      if (app != NULL &&
+          app_is_stale (app, file ? _shell_desktop_file_get_info (file, id) : NULL))
+        g_hash_table_remove (priv->id_to_app, id);
+    }
+
+  g_ptr_array_unref (changed);
+
+  g_signal_emit (self, signals[INSTALLED_CHANGED], 0, NULL);
+}
+
+static gboolean
+installed_changed_idle (gpointer user_data)
+{
+  ShellAppSystem *self = user_data;
+
+  self->priv->installed_changed_id = 0;
+
+  rescan_icon_theme (self);
+  rescan_installed_apps (self);
+
+  return G_SOURCE_REMOVE;
+}
+
 static void
 installed_changed (GAppInfoMonitor *monitor,
                    gpointer         user_data)
 {
   ShellAppSystem *self = user_data;
+  ShellAppSystemPrivate *priv = self->priv;
 
-  rescan_icon_theme (self);
-  scan_startup_wm_class_to_id (self);
+  /* Package installations tend to change many desktop files in a row,
+   * handle all of them at once.
+   */
+  if (priv->installed_changed_id != 0)
+    return;
 
-  g_hash_table_foreach_remove (self->priv->id_to_app, stale_app_remove_func, NULL);
+  priv->installed_changed_id = g_idle_add (installed_changed_idle, self);
+  g_source_set_name_by_id (priv->installed_changed_id,
+                           "[gnome-shell] installed_changed_idle");
+}
 
-  g_signal_emit (self, signals[INSTALLED_CHANGED], 0, NULL);
+static void
+pid_app_free (PidApp *pid_app)
+{
+  g_object_unref (pid_app->app);
+  g_free (pid_app);
+}
+
+static void
+pid_apps_free (GSList *apps)
+{
+  g_slist_free_full (apps, (GDestroyNotify) pid_app_free);
 }
 
 static void
@@ -232,15 +457,23 @@ shell_app_system_init (ShellAppSystem *self)
   self->priv = priv = shell_app_system_get_instance_private (self);
 
   priv->running_apps = g_hash_table_new_full (NULL, NULL, (GDestroyNotify) g_object_unref, NULL);
+  priv->pid_to_apps = g_hash_table_new_full (NULL, NULL, NULL, (GDestroyNotify) pid_apps_free);
+  priv->window_to_pid = g_hash_table_new (NULL, NULL);
+  priv->windows_without_pid = g_hash_table_new (NULL, NULL);
+  priv->state_changed_apps = g_hash_table_new_full (NULL, NULL, g_object_unref, NULL);
   priv->id_to_app = g_hash_table_new_full (g_str_hash, g_str_equal,
                                            NULL,
                                            (GDestroyNotify)g_object_unref);
 
   priv->startup_wm_class_to_id = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+  priv->search_index = _shell_app_search_index_new ();
+  priv->desktop_files = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                               g_free, (GDestroyNotify) _shell_desktop_file_free);
 
   monitor = g_app_info_monitor_get ();
   g_signal_connect (monitor, "changed", G_CALLBACK (installed_changed), self);
-  installed_changed (monitor, self);
+  rescan_icon_theme (self);
+  rescan_installed_apps (self);
 }
 
 static void
@@ -250,9 +483,20 @@ shell_app_system_finalize (GObject *object)
   ShellAppSystemPrivate *priv = self->priv;
 
   g_hash_table_destroy (priv->running_apps);
+  g_slist_free (priv->sorted_running_apps);
+  g_hash_table_destroy (priv->state_changed_apps);
+  if (priv->apps_state_changed_later_id)
+    meta_later_remove (priv->apps_state_changed_later_id);
+  g_hash_table_destroy (priv->pid_to_apps);
+  g_hash_table_destroy (priv->window_to_pid);
+  g_hash_table_destroy (priv->windows_without_pid);
   g_hash_table_destroy (priv->id_to_app);
   g_hash_table_destroy (priv->startup_wm_class_to_id);
   g_list_free_full (priv->installed_apps, g_object_unref);
+  _shell_app_search_index_free (priv->search_index);
+  g_hash_table_destroy (priv->desktop_files);
+  g_clear_pointer (&priv->desktop_dirs, g_ptr_array_unref);
+  g_clear_handle_id (&priv->installed_changed_id, g_source_remove);
   g_clear_handle_id (&priv->rescan_icons_timeout_id, g_source_remove);
 
   G_OBJECT_CLASS (shell_app_system_parent_class)->finalize (object);
@@ -286,6 +530,7 @@ shell_app_system_lookup_app (ShellAppSystem   *self,
                              const char       *id)
 {
   ShellAppSystemPrivate *priv = self->priv;
+  ShellDesktopFile *file;
   ShellApp *app;
   GDesktopAppInfo *info;
 
@@ -293,10 +538,19 @@ shell_app_system_lookup_app (ShellAppSystem   *self,
   if (app)
     return app;
 
-  info = g_desktop_app_info_new (id);
+  /* Share the info with the installed apps if we know the desktop file */
+  file = g_hash_table_lookup (priv->desktop_files, id);
+  if (file != NULL)
+    info = _shell_desktop_file_get_info (file, id);
+  else
+    info = g_desktop_app_info_new (id);
+
   if (!info)
     return NULL;
 
+  if (file != NULL)
+    g_object_ref (info);
+
   app = _shell_app_new (info);
   g_hash_table_insert (priv->id_to_app, (char *) shell_app_get_id (app), app);
   g_object_unref (info);
@@ -414,6 +668,52 @@ shell_app_system_lookup_startup_wmclass (ShellAppSystem *system,
   return shell_app_system_lookup_app (system, id);
 }
 
+static gboolean
+emit_apps_state_changed (gpointer user_data)
+{
+  ShellAppSystem *self = user_data;
+  ShellAppSystemPrivate *priv = self->priv;
+  GHashTableIter iter;
+  GPtrArray *apps;
+  gpointer key;
+
+  priv->apps_state_changed_later_id = 0;
+
+  apps = g_ptr_array_new_full (g_hash_table_size (priv->state_changed_apps),
+                               g_object_unref);
+
+  g_hash_table_iter_init (&iter, priv->state_changed_apps);
+  while (g_hash_table_iter_next (&iter, &key, NULL))
+    {
+      g_ptr_array_add (apps, key);
+      g_hash_table_iter_steal (&iter);
+    }
+
+  g_signal_emit (self, signals[APPS_STATE_CHANGED], 0, apps);
+  g_ptr_array_unref (apps);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+queue_apps_state_changed (ShellAppSystem *self,
+                          ShellApp       *app)
+{
+  ShellAppSystemPrivate *priv = self->priv;
+
+  /* Nobody opted in to batched notifications */
+  if (!g_signal_has_handler_pending (self, signals[APPS_STATE_CHANGED], 0, TRUE))
+    return;
+
+  if (!g_hash_table_contains (priv->state_changed_apps, app))
+    g_hash_table_add (priv->state_changed_apps, g_object_ref (app));
+
+  if (priv->apps_state_changed_later_id == 0)
+    priv->apps_state_changed_later_id = meta_later_add (META_LATER_BEFORE_REDRAW,
+                                                        emit_apps_state_changed,
+                                                        self, NULL);
+}
+
 void
 _shell_app_system_notify_app_state_changed (ShellAppSystem *self,
                                             ShellApp       *app)
@@ -434,7 +734,172 @@ _shell_app_system_notify_app_state_changed (ShellAppSystem *self,
       g_warn_if_reached();
       break;
     }
+  _shell_app_system_invalidate_running (self);
   g_signal_emit (self, signals[APP_STATE_CHANGED], 0, app);
+  queue_apps_state_changed (self, app);
+}
+
+static PidApp *
+find_pid_app (GSList   *apps,
+              ShellApp *app)
+{
+  GSList *l;
+
+  for (l = apps; l; l = l->next)
+    {
+      PidApp *pid_app = l->data;
+
+      if (pid_app->app == app)
+        return pid_app;
+    }
+
+  return NULL;
+}
+
+static void
+add_window_pid (ShellAppSystem *self,
+                ShellApp       *app,
+                MetaWindow     *window,
+                int             pid)
+{
+  ShellAppSystemPrivate *priv = self->priv;
+  GSList *apps;
+  PidApp *pid_app;
+
+  g_hash_table_insert (priv->window_to_pid, window, GINT_TO_POINTER (pid));
+
+  apps = g_hash_table_lookup (priv->pid_to_apps, GINT_TO_POINTER (pid));
+  pid_app = find_pid_app (apps, app);
+  if (pid_app == NULL)
+    {
+      pid_app = g_new0 (PidApp, 1);
+      pid_app->app = g_object_ref (app);
+
+      g_hash_table_steal (priv->pid_to_apps, GINT_TO_POINTER (pid));
+      apps = g_slist_prepend (apps, pid_app);
+      g_hash_table_insert (priv->pid_to_apps, GINT_TO_POINTER (pid), apps);
+    }
+
+  pid_app->n_windows++;
+}
+
+/*
+ * _shell_app_system_add_app_window:
+ *
+ * Records that @window, owned by @app, belongs to the process of the
+ * window, so that _shell_app_system_lookup_pid() doesn't need to walk
+ * all running applications and their windows. Windows without a pid
+ * yet are kept aside, and checked again when a lookup finds nothing.
+ */
+void
+_shell_app_system_add_app_window (ShellAppSystem *self,
+                                  ShellApp       *app,
+                                  MetaWindow     *window)
+{
+  ShellAppSystemPrivate *priv = self->priv;
+  int pid;
+
+  if (g_hash_table_contains (priv->window_to_pid, window) ||
+      g_hash_table_contains (priv->windows_without_pid, window))
+    return;
+
+  pid = meta_window_get_pid (window);
+  if (pid <= 0)
+    {
+      g_hash_table_insert (priv->windows_without_pid, window, app);
+      return;
+    }
+
+  add_window_pid (self, app, window, pid);
+}
+
+/* Adds the windows whose pid became known since they were added */
+static void
+add_windows_without_pid (ShellAppSystem *self)
+{
+  GHashTableIter iter;
+  gpointer window, app;
+
+  g_hash_table_iter_init (&iter, self->priv->windows_without_pid);
+  while (g_hash_table_iter_next (&iter, &window, &app))
+    {
+      int pid = meta_window_get_pid (window);
+
+      if (pid <= 0)
+        continue;
+
+      g_hash_table_iter_remove (&iter);
+      add_window_pid (self, app, window, pid);
+    }
+}
+
+void
+_shell_app_system_remove_app_window (ShellAppSystem *self,
+                                     ShellApp       *app,
+                                     MetaWindow     *window)
+{
+  ShellAppSystemPrivate *priv = self->priv;
+  gpointer pid_ptr;
+  GSList *apps;
+  PidApp *pid_app;
+
+  if (g_hash_table_remove (priv->windows_without_pid, window))
+    return;
+
+  /* Use the pid recorded when the window was added, the window's
+   * _NET_WM_PID may have changed since then.
+   */
+  if (!g_hash_table_lookup_extended (priv->window_to_pid, window, NULL, &pid_ptr))
+    return;
+
+  g_hash_table_remove (priv->window_to_pid, window);
+
+  apps = g_hash_table_lookup (priv->pid_to_apps, pid_ptr);
+  pid_app = find_pid_app (apps, app);
+  if (pid_app == NULL || --pid_app->n_windows > 0)
+    return;
+
+  g_hash_table_steal (priv->pid_to_apps, pid_ptr);
+  apps = g_slist_remove (apps, pid_app);
+  pid_app_free (pid_app);
+
+  if (apps != NULL)
+    g_hash_table_insert (priv->pid_to_apps, pid_ptr, apps);
+}
+
+/*
+ * _shell_app_system_lookup_pid:
+ *
+ * Returns: (transfer none): The running application with a window
+ * belonging to process @pid; if several match, the first one in
+ * shell_app_compare() order.
+ */
+ShellApp *
+_shell_app_system_lookup_pid (ShellAppSystem *self,
+                              int             pid)
+{
+  ShellApp *result = NULL;
+  GSList *l;
+
+  l = g_hash_table_lookup (self->priv->pid_to_apps, GINT_TO_POINTER (pid));
+  if (l == NULL && g_hash_table_size (self->priv->windows_without_pid) > 0)
+    {
+      add_windows_without_pid (self);
+      l = g_hash_table_lookup (self->priv->pid_to_apps, GINT_TO_POINTER (pid));
+    }
+
+  for (; l; l = l->next)
+    {
+      PidApp *pid_app = l->data;
+
+      if (shell_app_get_state (pid_app->app) != SHELL_APP_STATE_RUNNING)
+        continue;
+
+      if (result == NULL || shell_app_compare (pid_app->app, result) < 0)
+        result = pid_app->app;
+    }
+
+  return result;
 }
 
 /**
@@ -449,31 +914,64 @@ _shell_app_system_notify_app_state_changed (ShellAppSystem *self,
 GSList *
 shell_app_system_get_running (ShellAppSystem *self)
 {
-  gpointer key, value;
-  GSList *ret;
-  GHashTableIter iter;
-
-  g_hash_table_iter_init (&iter, self->priv->running_apps);
+  ShellAppSystemPrivate *priv = self->priv;
 
-  ret = NULL;
-  while (g_hash_table_iter_next (&iter, &key, &value))
+  if (priv->sorted_running_apps_stale)
     {
-      ShellApp *app = key;
+      GHashTableIter iter;
+      gpointer key;
+
+      g_clear_pointer (&priv->sorted_running_apps, g_slist_free);
+
+      g_hash_table_iter_init (&iter, priv->running_apps);
+      while (g_hash_table_iter_next (&iter, &key, NULL))
+        priv->sorted_running_apps = g_slist_prepend (priv->sorted_running_apps, key);
 
-      ret = g_slist_prepend (ret, app);
+      priv->sorted_running_apps = g_slist_sort (priv->sorted_running_apps,
+                                                (GCompareFunc)shell_app_compare);
+      priv->sorted_running_apps_stale = FALSE;
     }
 
-  ret = g_slist_sort (ret, (GCompareFunc)shell_app_compare);
+  return g_slist_copy (priv->sorted_running_apps);
+}
+
+/*
+ * _shell_app_system_invalidate_running:
+ *
+ * Called when anything shell_app_compare() depends on changes for a
+ * running application: its state, windows, their user time or whether
+ * they are minimized.
+ */
+void
+_shell_app_system_invalidate_running (ShellAppSystem *self)
+{
+  self->priv->sorted_running_apps_stale = TRUE;
+}
+
+static char ***
+validate_results (char ***results)
+{
+  char ***groups, **ids;
 
-  return ret;
+  for (groups = results; *groups; groups++)
+    for (ids = *groups; *ids; ids++)
+      if (!g_utf8_validate (*ids, -1, NULL))
+        **ids = '\0';
+
+  return results;
 }
 
 /**
  * shell_app_system_search:
  * @search_string: the search string to use
  *
- * Wrapper around g_desktop_app_info_search() that replaces results that
- * don't validate as UTF-8 with the empty string.
+ * Searches the installed applications, returning the results grouped
+ * like g_desktop_app_info_search() does. The search uses an index that
+ * is kept up to date with the installed applications, and also matches
+ * terms of three or more characters in the middle of words; those
+ * results are in the last groups.
+ *
+ * Results that don't validate as UTF-8 are replaced with the empty string.
  *
  * Returns: (array zero-terminated=1) (element-type GStrv) (transfer full): a
  *   list of strvs.  Free each item with g_strfreev() and free the outer
@@ -482,15 +980,113 @@ shell_app_system_get_running (ShellAppSystem *self)
 char ***
 shell_app_system_search (const char *search_string)
 {
-  char ***results = g_desktop_app_info_search (search_string);
-  char ***groups, **ids;
+  ShellAppSystem *self = shell_app_system_get_default ();
 
-  for (groups = results; *groups; groups++)
-    for (ids = *groups; *ids; ids++)
-      if (!g_utf8_validate (*ids, -1, NULL))
-        **ids = '\0';
+  return validate_results (_shell_app_search_index_search (self->priv->search_index,
+                                                           search_string));
+}
 
-  return results;
+/**
+ * shell_app_system_subsearch:
+ * @previous_results: (array zero-terminated=1): the IDs returned by
+ *   a previous search
+ * @search_string: the search string to use
+ *
+ * Refines the results of a previous search, for a search string that
+ * extends the previous one. This gives the same results as
+ * shell_app_system_search(), but only considers the applications
+ * in @previous_results, so it doesn't get slower with the number
+ * of installed applications.
+ *
+ * Returns: (array zero-terminated=1) (element-type GStrv) (transfer full): a
+ *   list of strvs.  Free each item with g_strfreev() and free the outer
+ *   list with g_free().
+ */
+char ***
+shell_app_system_subsearch (const char * const *previous_results,
+                            const char         *search_string)
+{
+  ShellAppSystem *self = shell_app_system_get_default ();
+
+  return validate_results (_shell_app_search_index_subsearch (self->priv->search_index,
+                                                              previous_results,
+                                                              search_string));
+}
+
+static int
+compare_by_usage (gconstpointer a,
+                  gconstpointer b,
+                  gpointer      user_data)
+{
+  ShellAppUsage *usage = user_data;
+
+  return shell_app_usage_compare (usage, *(const char **) a, *(const char **) b);
+}
+
+/**
+ * shell_app_system_search_ranked:
+ * @self: the #ShellAppSystem
+ * @search_string: the search string to use
+ * @previous_results: (array zero-terminated=1) (nullable): the results
+ *   of a previous search whose search string @search_string extends,
+ *   or %NULL
+ *
+ * Searches like shell_app_system_search(), or shell_app_system_subsearch()
+ * if @previous_results is given, but only returns applications that should
+ * be shown, and orders the results within each group by usage.
+ *
+ * Returns: (array zero-terminated=1) (transfer full): the IDs of the
+ *   matching applications, best match first
+ */
+char **
+shell_app_system_search_ranked (ShellAppSystem     *self,
+                                const char         *search_string,
+                                const char * const *previous_results)
+{
+  ShellAppSystemPrivate *priv = self->priv;
+  ShellAppUsage *usage = shell_app_usage_get_default ();
+  char ***groups, ***group, **ids;
+  GPtrArray *results;
+
+  if (previous_results != NULL)
+    groups = _shell_app_search_index_subsearch (priv->search_index,
+                                                previous_results,
+                                                search_string);
+  else
+    groups = _shell_app_search_index_search (priv->search_index,
+                                             search_string);
+
+  results = g_ptr_array_new ();
+
+  for (group = groups; *group; group++)
+    {
+      guint group_start = results->len;
+
+      for (ids = *group; *ids; ids++)
+        {
+          ShellDesktopFile *file;
+
+          file = g_hash_table_lookup (priv->desktop_files, *ids);
+
+          if (file != NULL && !file->hidden && file->should_show &&
+              g_utf8_validate (*ids, -1, NULL))
+            g_ptr_array_add (results, *ids);
+          else
+            g_free (*ids);
+        }
+
+      g_free (*group);
+
+      g_qsort_with_data (results->pdata + group_start,
+                         results->len - group_start,
+                         sizeof (char *),
+                         compare_by_usage, usage);
+    }
+
+  g_free (groups);
+
+  g_ptr_array_add (results, NULL);
+  return (char **) g_ptr_array_free (results, FALSE);
 }
 
 /**
@@ -507,6 +1103,23 @@ GList *
 shell_app_system_get_installed (ShellAppSystem *self)
 {
   ShellAppSystemPrivate *priv = self->priv;
+  GHashTableIter iter;
+  gpointer key, value;
+
+  if (!priv->installed_apps_stale)
+    return priv->installed_apps;
+
+  g_hash_table_iter_init (&iter, priv->desktop_files);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      GDesktopAppInfo *info = _shell_desktop_file_get_info (value, key);
+
+      if (info != NULL)
+        priv->installed_apps = g_list_prepend (priv->installed_apps,
+                                               g_object_ref (info));
+    }
+
+  priv->installed_apps_stale = FALSE;
 
   return priv->installed_apps;
 }
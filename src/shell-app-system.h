@@ -26,6 +26,11 @@ ShellApp       *shell_app_system_lookup_desktop_wmclass       (ShellAppSystem *s
 
 GSList         *shell_app_system_get_running               (ShellAppSystem  *self);
 char         ***shell_app_system_search                    (const char *search_string);
+char         ***shell_app_system_subsearch                 (const char * const *previous_results,
+                                                            const char         *search_string);
+char          **shell_app_system_search_ranked             (ShellAppSystem     *self,
+                                                            const char         *search_string,
+                                                            const char * const *previous_results);
 
 GList          *shell_app_system_get_installed             (ShellAppSystem  *self);
 
@@ -2,6 +2,7 @@
 
 #include "config.h"
 
+#include <math.h>
 #include <string.h>
 #include <stdlib.h>
 
@@ -12,10 +13,12 @@
 #include <glib.h>
 #include <gio/gio.h>
 #include <meta/display.h>
+#include <meta/meta-workspace-manager.h>
 #include <meta/group.h>
 #include <meta/window.h>
 
 #include "shell-app-usage.h"
+#include "shell-binary-util.h"
 #include "shell-window-tracker.h"
 #include "shell-global.h"
 
@@ -37,6 +40,12 @@
  * and computing a time delta between them.  Also we watch the
  * GNOME Session "StatusChanged" signal which by default is emitted after 5
  * minutes to signify idle.
+ *
+ * The data is stored in a binary snapshot, and changes since the snapshot
+ * was written are appended to a log, so saving doesn't need to rewrite
+ * the data of all applications. Every record holds the complete state
+ * of an application, so replaying the log is idempotent, and a record
+ * that was only partially written is detected by its checksum.
  */
 
 #define PRIVACY_SCHEMA "org.gnome.desktop.privacy"
@@ -46,16 +55,40 @@
 
 #define USAGE_CLEAN_DAYS 7 /* If after 7 days we haven't seen an app, purge it */
 
-/* Data is saved to file SHELL_CONFIG_DIR/DATA_FILENAME */
+/* Data is saved to files SHELL_CONFIG_DIR/SNAPSHOT_FILENAME and
+ * SHELL_CONFIG_DIR/LOG_FILENAME. SHELL_CONFIG_DIR/DATA_FILENAME is the
+ * XML file used by earlier versions, which we migrate from.
+ */
 #define DATA_FILENAME "application_state"
+#define SNAPSHOT_FILENAME "application_state.bin"
+#define LOG_FILENAME "application_state.log"
+
+/* The snapshot is SNAPSHOT_MAGIC, STORE_VERSION, the number of entries
+ * and the entries. The log is LOG_MAGIC and STORE_VERSION, followed by
+ * records, each an entry and its checksum. See append_entry().
+ */
+#define SNAPSHOT_MAGIC "GSAPPUSG"
+#define LOG_MAGIC "GSAPPLOG"
+#define STORE_VERSION 1
+
+/* Write a new snapshot instead of appending to the log once the log
+ * would have more records than this, or than twice the number of apps */
+#define MIN_COMPACT_RECORDS 256
 
 #define IDLE_TIME_TRANSITION_SECONDS 30 /* If we transition to idle, only count
                                          * this many seconds of usage */
 
-/* The ranking algorithm we use is: every time an app score reaches SCORE_MAX,
- * divide all scores by 2. Scores are raised by 1 unit every SAVE_APPS_TIMEOUT
- * seconds. This mechanism allows the list to update relatively fast when
- * a new app is used intensively.
+/* The ranking algorithm we use is: scores are raised by 1 unit for every
+ * FOCUS_TIME_MIN_SECONDS of focus, and decay exponentially with a half-life
+ * of SCORE_HALF_LIFE_SECONDS. Only the score as of its last update is
+ * stored, and the decay is applied when it is read, so all scores decay
+ * without ever having to update all of them. This allows the list to
+ * update relatively fast when a new app is used intensively.
+ *
+ * Besides the overall score, each app has scores for the time of day and
+ * the workspace it was used on, which can be used to favor apps that are
+ * used in the current context.
+ *
  * To keep the list clean, and avoid being Big Brother, apps that have not been
  * seen for a week and whose score is below SCORE_MIN are removed.
  */
@@ -63,13 +96,17 @@
 /* How often we save internally app data, in seconds */
 #define SAVE_APPS_TIMEOUT_SECONDS (5 * 60)
 
-/* With this value, an app goes from bottom to top of the
- * usage list in 50 hours of use */
-#define SCORE_MAX (3600 * 50 / FOCUS_TIME_MIN_SECONDS)
+#define SCORE_HALF_LIFE_SECONDS (14 * 24 * 60 * 60)
 
 /* If an app's score in lower than this and the app has not been used in a week,
  * remove it */
-#define SCORE_MIN (SCORE_MAX >> 3)
+#define SCORE_MIN (3600 / FOCUS_TIME_MIN_SECONDS)
+
+/* Time of day buckets, each covering 24 / N_TIME_OF_DAY_BUCKETS hours */
+#define N_TIME_OF_DAY_BUCKETS 4
+
+/* Workspaces beyond the last bucket share it */
+#define N_WORKSPACE_BUCKETS 8
 
 /* http://www.gnome.org/~mccann/gnome-session/docs/gnome-session.html#org.gnome.SessionManager.Presence */
 #define GNOME_SESSION_STATUS_IDLE 3
@@ -81,6 +118,8 @@ struct _ShellAppUsage
   GObject parent;
 
   GFile *configfile;
+  GFile *snapshot_file;
+  GFile *log_file;
   GDBusProxy *session_proxy;
   GSettings *privacy_settings;
   guint idle_focus_change_id;
@@ -93,14 +132,22 @@ struct _ShellAppUsage
 
   /* <char *appid, UsageData *usage> */
   GHashTable *app_usages;
+
+  /* <char *appid> of apps changed since the last save */
+  GHashTable *dirty_apps;
+  guint n_log_records;
 };
 
 G_DEFINE_TYPE (ShellAppUsage, shell_app_usage, G_TYPE_OBJECT);
 
-/* Represents an application record for a given context */
+/* Represents an application record */
 struct UsageData
 {
-  gdouble score; /* Based on the number of times we'e seen the app and normalized */
+  /* Based on the time the app was focused, as of last_update */
+  gdouble score;
+  gdouble time_of_day_scores[N_TIME_OF_DAY_BUCKETS];
+  gdouble workspace_scores[N_WORKSPACE_BUCKETS];
+  long last_update;
   long last_seen; /* Used to clear old apps we've only seen a few times */
 };
 
@@ -113,6 +160,7 @@ static void ensure_queued_save (ShellAppUsage *self);
 static gboolean idle_save_application_usage (gpointer data);
 
 static void restore_from_file (ShellAppUsage *self);
+static void write_snapshot (ShellAppUsage *self);
 
 static void update_enable_monitoring (ShellAppUsage *self);
 
@@ -134,6 +182,13 @@ shell_app_usage_class_init (ShellAppUsageClass *klass)
   gobject_class->finalize = shell_app_usage_finalize;
 }
 
+static void
+mark_dirty (ShellAppUsage *self,
+            const char    *appid)
+{
+  g_hash_table_add (self->dirty_apps, g_strdup (appid));
+}
+
 static UsageData *
 get_usage_for_app (ShellAppUsage *self,
                    ShellApp      *app)
@@ -151,17 +206,79 @@ get_usage_for_app (ShellAppUsage *self,
   return usage;
 }
 
-/* Limit the score to a certain level so that most used apps can change */
+static double
+get_decay (long from,
+           long to)
+{
+  if (to <= from)
+    return 1.0;
+
+  return exp2 (- (double) (to - from) / SCORE_HALF_LIFE_SECONDS);
+}
+
+/* Applies the decay since the last update to all scores of @usage */
 static void
-normalize_usage (ShellAppUsage *self)
+decay_usage (UsageData *usage,
+             long       time)
 {
-  GHashTableIter iter;
-  UsageData *usage;
+  double decay = get_decay (usage->last_update, time);
+  int i;
 
-  g_hash_table_iter_init (&iter, self->app_usages);
+  usage->score *= decay;
+  for (i = 0; i < N_TIME_OF_DAY_BUCKETS; i++)
+    usage->time_of_day_scores[i] *= decay;
+  for (i = 0; i < N_WORKSPACE_BUCKETS; i++)
+    usage->workspace_scores[i] *= decay;
 
-  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &usage))
-    usage->score /= 2;
+  usage->last_update = MAX (usage->last_update, time);
+}
+
+static int
+get_time_of_day_bucket (long time)
+{
+  GDateTime *date_time = g_date_time_new_from_unix_local (time);
+  int bucket;
+
+  bucket = g_date_time_get_hour (date_time) * N_TIME_OF_DAY_BUCKETS / 24;
+  g_date_time_unref (date_time);
+
+  return bucket;
+}
+
+static int
+get_workspace_bucket (void)
+{
+  MetaDisplay *display = shell_global_get_display (shell_global_get ());
+  MetaWorkspaceManager *workspace_manager;
+  int index;
+
+  workspace_manager = meta_display_get_workspace_manager (display);
+  index = meta_workspace_manager_get_active_workspace_index (workspace_manager);
+
+  return CLAMP (index, 0, N_WORKSPACE_BUCKETS - 1);
+}
+
+/* As all scores decay at the same rate, their order doesn't change
+ * over time. Comparing log2 (score) + last_update / SCORE_HALF_LIFE_SECONDS,
+ * which is log2 of the score at any point in time plus a constant, gives
+ * the same order without having to decay scores to a common time first.
+ */
+static double
+get_rank (UsageData *usage,
+          gboolean   use_context,
+          int        time_of_day_bucket,
+          int        workspace_bucket)
+{
+  double score = usage->score;
+
+  if (use_context)
+    score += usage->time_of_day_scores[time_of_day_bucket] +
+             usage->workspace_scores[workspace_bucket];
+
+  if (score <= 0)
+    return -G_MAXDOUBLE;
+
+  return log2 (score) + (double) usage->last_update / SCORE_HALF_LIFE_SECONDS;
 }
 
 static void
@@ -176,14 +293,16 @@ increment_usage_for_app_at_time (ShellAppUsage *self,
   usage = get_usage_for_app (self, app);
 
   usage->last_seen = time;
+  mark_dirty (self, shell_app_get_id (app));
 
   elapsed = time - self->watch_start_time;
   usage_count = elapsed / FOCUS_TIME_MIN_SECONDS;
   if (usage_count > 0)
     {
+      decay_usage (usage, time);
       usage->score += usage_count;
-      if (usage->score > SCORE_MAX)
-        normalize_usage (self);
+      usage->time_of_day_scores[get_time_of_day_bucket (time)] += usage_count;
+      usage->workspace_scores[get_workspace_bucket ()] += usage_count;
       ensure_queued_save (self);
     }
 }
@@ -213,7 +332,10 @@ on_app_state_changed (ShellAppSystem *app_system,
   running = shell_app_get_state (app) == SHELL_APP_STATE_RUNNING;
 
   if (running)
-    usage->last_seen = get_time ();
+    {
+      usage->last_seen = get_time ();
+      mark_dirty (self, shell_app_get_id (app));
+    }
 }
 
 static void
@@ -286,6 +408,7 @@ shell_app_usage_init (ShellAppUsage *self)
   global = shell_global_get ();
 
   self->app_usages = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+  self->dirty_apps = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
 
   tracker = shell_window_tracker_get_default ();
   g_signal_connect (tracker, "notify::focus-app", G_CALLBACK (on_focus_app_changed), self);
@@ -310,9 +433,15 @@ shell_app_usage_init (ShellAppUsage *self)
 
   g_object_get (global, "userdatadir", &shell_userdata_dir, NULL),
   path = g_build_filename (shell_userdata_dir, DATA_FILENAME, NULL);
-  g_free (shell_userdata_dir);
   self->configfile = g_file_new_for_path (path);
   g_free (path);
+  path = g_build_filename (shell_userdata_dir, SNAPSHOT_FILENAME, NULL);
+  self->snapshot_file = g_file_new_for_path (path);
+  g_free (path);
+  path = g_build_filename (shell_userdata_dir, LOG_FILENAME, NULL);
+  self->log_file = g_file_new_for_path (path);
+  g_free (path);
+  g_free (shell_userdata_dir);
   restore_from_file (self);
 
   self->privacy_settings = g_settings_new(PRIVACY_SCHEMA);
@@ -334,64 +463,179 @@ shell_app_usage_finalize (GObject *object)
   g_object_unref (self->privacy_settings);
 
   g_object_unref (self->configfile);
+  g_object_unref (self->snapshot_file);
+  g_object_unref (self->log_file);
+
+  g_hash_table_destroy (self->dirty_apps);
 
   g_object_unref (self->session_proxy);
 
   G_OBJECT_CLASS (shell_app_usage_parent_class)->finalize(object);
 }
 
-static int
-sort_apps_by_usage (gconstpointer a,
-                    gconstpointer b,
-                    gpointer      datap)
+typedef struct {
+  ShellApp *app;
+  double rank;
+} RankedApp;
+
+static void
+swap_ranked_apps (RankedApp *a,
+                  RankedApp *b)
 {
-  ShellAppUsage *self = datap;
-  ShellApp *app_a, *app_b;
-  UsageData *usage_a, *usage_b;
+  RankedApp tmp = *a;
 
-  app_a = (ShellApp*)a;
-  app_b = (ShellApp*)b;
+  *a = *b;
+  *b = tmp;
+}
 
-  usage_a = g_hash_table_lookup (self->app_usages, shell_app_get_id (app_a));
-  usage_b = g_hash_table_lookup (self->app_usages, shell_app_get_id (app_b));
+/* Moves the app at @index up a min-heap ordered by rank */
+static void
+heap_sift_up (GArray *heap,
+              guint   index)
+{
+  RankedApp *apps = (RankedApp *) heap->data;
+
+  while (index > 0)
+    {
+      guint parent = (index - 1) / 2;
 
-  return usage_b->score - usage_a->score;
+      if (apps[parent].rank <= apps[index].rank)
+        break;
+
+      swap_ranked_apps (&apps[parent], &apps[index]);
+      index = parent;
+    }
+}
+
+/* Moves the app at @index down a min-heap ordered by rank */
+static void
+heap_sift_down (GArray *heap,
+                guint   index)
+{
+  RankedApp *apps = (RankedApp *) heap->data;
+
+  while (TRUE)
+    {
+      guint smallest = index;
+      guint child;
+
+      for (child = 2 * index + 1; child <= 2 * index + 2 && child < heap->len; child++)
+        if (apps[child].rank < apps[smallest].rank)
+          smallest = child;
+
+      if (smallest == index)
+        break;
+
+      swap_ranked_apps (&apps[smallest], &apps[index]);
+      index = smallest;
+    }
+}
+
+static int
+compare_ranked_apps (gconstpointer a,
+                     gconstpointer b)
+{
+  const RankedApp *app_a = a;
+  const RankedApp *app_b = b;
+
+  if (app_a->rank > app_b->rank)
+    return -1;
+  else if (app_a->rank < app_b->rank)
+    return 1;
+
+  return 0;
 }
 
 /**
- * shell_app_usage_get_most_used:
- * @usage: the usage instance to request
+ * shell_app_usage_get_top_apps:
+ * @self: the usage instance to request
+ * @max_apps: the maximum number of applications to return
+ * @use_context: whether to favor applications that were used at the
+ *   current time of day and on the active workspace
  *
- * Returns: (element-type ShellApp) (transfer full): List of applications
+ * Returns: (element-type ShellApp) (transfer full): The @max_apps most
+ *   used applications, most used first
  */
 GSList *
-shell_app_usage_get_most_used (ShellAppUsage   *self)
+shell_app_usage_get_top_apps (ShellAppUsage *self,
+                              guint          max_apps,
+                              gboolean       use_context)
 {
-  GSList *apps;
-  char *appid;
+  int time_of_day_bucket = 0, workspace_bucket = 0;
   ShellAppSystem *appsys;
   GHashTableIter iter;
+  UsageData *usage;
+  GSList *apps;
+  GArray *heap;
+  char *appid;
+  guint i;
+
+  if (max_apps == 0)
+    return NULL;
+
+  if (use_context)
+    {
+      time_of_day_bucket = get_time_of_day_bucket (get_time ());
+      workspace_bucket = get_workspace_bucket ();
+    }
 
   appsys = shell_app_system_get_default ();
+  heap = g_array_sized_new (FALSE, FALSE, sizeof (RankedApp),
+                            MIN (max_apps, g_hash_table_size (self->app_usages)));
 
+  /* Keep the best @max_apps apps seen so far in a min-heap, so an app
+   * only has to be compared against the worst of them */
   g_hash_table_iter_init (&iter, self->app_usages);
-  apps = NULL;
-  while (g_hash_table_iter_next (&iter, (gpointer *) &appid, NULL))
+  while (g_hash_table_iter_next (&iter, (gpointer *) &appid, (gpointer *) &usage))
     {
-      ShellApp *app;
+      RankedApp ranked;
 
-      app = shell_app_system_lookup_app (appsys, appid);
-      if (!app)
+      ranked.rank = get_rank (usage, use_context, time_of_day_bucket, workspace_bucket);
+
+      if (heap->len == max_apps &&
+          ranked.rank <= g_array_index (heap, RankedApp, 0).rank)
+        continue;
+
+      ranked.app = shell_app_system_lookup_app (appsys, appid);
+      if (!ranked.app)
         continue;
 
-      apps = g_slist_prepend (apps, g_object_ref (app));
+      if (heap->len < max_apps)
+        {
+          g_array_append_val (heap, ranked);
+          heap_sift_up (heap, heap->len - 1);
+        }
+      else
+        {
+          g_array_index (heap, RankedApp, 0) = ranked;
+          heap_sift_down (heap, 0);
+        }
     }
 
-  apps = g_slist_sort_with_data (apps, sort_apps_by_usage, self);
+  g_array_sort (heap, compare_ranked_apps);
+
+  apps = NULL;
+  for (i = heap->len; i > 0; i--)
+    apps = g_slist_prepend (apps,
+                            g_object_ref (g_array_index (heap, RankedApp, i - 1).app));
+
+  g_array_unref (heap);
 
   return apps;
 }
 
+/**
+ * shell_app_usage_get_most_used:
+ * @usage: the usage instance to request
+ *
+ * Returns: (element-type ShellApp) (transfer full): List of applications
+ */
+GSList *
+shell_app_usage_get_most_used (ShellAppUsage   *self)
+{
+  return shell_app_usage_get_top_apps (self, G_MAXUINT, FALSE);
+}
+
 
 /**
  * shell_app_usage_compare:
@@ -410,6 +654,7 @@ shell_app_usage_compare (ShellAppUsage *self,
                          const char    *id_b)
 {
   UsageData *usage_a, *usage_b;
+  double rank_a, rank_b;
 
   usage_a = g_hash_table_lookup (self->app_usages, id_a);
   usage_b = g_hash_table_lookup (self->app_usages, id_b);
@@ -421,7 +666,15 @@ shell_app_usage_compare (ShellAppUsage *self,
   else if (usage_b == NULL)
     return -1;
 
-  return usage_b->score - usage_a->score;
+  rank_a = get_rank (usage_a, FALSE, 0, 0);
+  rank_b = get_rank (usage_b, FALSE, 0, 0);
+
+  if (rank_a > rank_b)
+    return -1;
+  else if (rank_a < rank_b)
+    return 1;
+
+  return 0;
 }
 
 static void
@@ -444,6 +697,7 @@ idle_clean_usage (ShellAppUsage *self)
   UsageData *usage;
   long current_time;
   long week_ago;
+  gboolean removed = FALSE;
 
   current_time = get_time ();
   week_ago = current_time - (7 * 24 * 60 * 60);
@@ -452,151 +706,248 @@ idle_clean_usage (ShellAppUsage *self)
 
   while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &usage))
     {
-      if ((usage->score < SCORE_MIN) &&
+      if ((usage->score * get_decay (usage->last_update, current_time) < SCORE_MIN) &&
           (usage->last_seen < week_ago))
-        g_hash_table_iter_remove (&iter);
+        {
+          g_hash_table_iter_remove (&iter);
+          removed = TRUE;
+        }
     }
 
-  return FALSE;
+  return removed;
 }
 
-static gboolean
-write_escaped (GDataOutputStream   *stream,
-               const char          *str,
-               GError             **error)
+/* An entry is the ID length as 16 bit integer, the ID, the score as
+ * double, the last-seen and last-update times as 64 bit integers and
+ * the time of day and workspace scores as doubles, all little endian.
+ */
+static void
+append_entry (GByteArray *buffer,
+              const char *appid,
+              UsageData  *usage)
 {
-  gboolean ret;
-  char *quoted = g_markup_escape_text (str, -1);
-  ret = g_data_output_stream_put_string (stream, quoted, NULL, error);
-  g_free (quoted);
-  return ret;
+  guint16 id_length = GUINT16_TO_LE (strlen (appid));
+  int i;
+
+  g_byte_array_append (buffer, (guint8 *) &id_length, sizeof (id_length));
+  g_byte_array_append (buffer, (guint8 *) appid, strlen (appid));
+  _shell_binary_append_double (buffer, usage->score);
+  _shell_binary_append_int64 (buffer, usage->last_seen);
+  _shell_binary_append_int64 (buffer, usage->last_update);
+
+  for (i = 0; i < N_TIME_OF_DAY_BUCKETS; i++)
+    _shell_binary_append_double (buffer, usage->time_of_day_scores[i]);
+  for (i = 0; i < N_WORKSPACE_BUCKETS; i++)
+    _shell_binary_append_double (buffer, usage->workspace_scores[i]);
 }
 
 static gboolean
-write_attribute_string (GDataOutputStream *stream,
-                        const char        *elt_name,
-                        const char        *str,
-                        GError           **error)
-{
-  gboolean ret = FALSE;
-  char *elt;
-
-  elt = g_strdup_printf (" %s=\"", elt_name);
-  ret = g_data_output_stream_put_string (stream, elt, NULL, error);
-  g_free (elt);
-  if (!ret)
-    goto out;
+read_entry (ShellBinaryReader  *reader,
+            char              **appid,
+            UsageData          *usage)
+{
+  const guint8 *bytes;
+  guint16 id_length;
+  gint64 last_seen, last_update;
+  int i;
 
-  ret = write_escaped (stream, str, error);
-  if (!ret)
-    goto out;
+  memset (usage, 0, sizeof (UsageData));
 
-  ret = g_data_output_stream_put_string (stream, "\"", NULL, error);
+  if (!_shell_binary_read_bytes (reader, sizeof (id_length), &bytes))
+    return FALSE;
+  memcpy (&id_length, bytes, sizeof (id_length));
+  id_length = GUINT16_FROM_LE (id_length);
 
-out:
-  return ret;
-}
+  if (!_shell_binary_read_bytes (reader, id_length, &bytes))
+    return FALSE;
+  *appid = g_strndup ((const char *) bytes, id_length);
 
-static gboolean
-write_attribute_uint (GDataOutputStream *stream,
-                      const char        *elt_name,
-                      guint              value,
-                      GError           **error)
-{
-  gboolean ret;
-  char *buf;
+  if (!_shell_binary_read_double (reader, &usage->score) ||
+      !_shell_binary_read_int64 (reader, &last_seen))
+    goto fail;
 
-  buf = g_strdup_printf ("%u", value);
-  ret = write_attribute_string (stream, elt_name, buf, error);
-  g_free (buf);
+  usage->last_seen = last_seen;
 
-  return ret;
-}
+  if (!_shell_binary_read_int64 (reader, &last_update))
+    goto fail;
 
-static gboolean
-write_attribute_double (GDataOutputStream *stream,
-                        const char        *elt_name,
-                        double             value,
-                        GError           **error)
-{
-  gchar buf[G_ASCII_DTOSTR_BUF_SIZE];
-  gboolean ret;
+  usage->last_update = last_update;
 
-  g_ascii_dtostr (buf, sizeof (buf), value);
-  ret = write_attribute_string (stream, elt_name, buf, error);
+  for (i = 0; i < N_TIME_OF_DAY_BUCKETS; i++)
+    if (!_shell_binary_read_double (reader, &usage->time_of_day_scores[i]))
+      goto fail;
+  for (i = 0; i < N_WORKSPACE_BUCKETS; i++)
+    if (!_shell_binary_read_double (reader, &usage->workspace_scores[i]))
+      goto fail;
 
-  return ret;
+  return TRUE;
+
+fail:
+  g_clear_pointer (appid, g_free);
+  return FALSE;
+}
+
+static void
+set_usage (ShellAppUsage *self,
+           char          *appid,
+           UsageData     *usage)
+{
+  g_hash_table_insert (self->app_usages, appid, g_memdup (usage, sizeof (UsageData)));
 }
 
-/* Save app data lists to file */
 static gboolean
-idle_save_application_usage (gpointer data)
+should_save_app (const char *appid)
+{
+  return shell_app_system_lookup_app (shell_app_system_get_default (), appid) != NULL;
+}
+
+/* Write all app data to a new snapshot, which makes the log obsolete */
+static void
+write_snapshot (ShellAppUsage *self)
 {
-  ShellAppUsage *self = SHELL_APP_USAGE (data);
-  char *id;
   GHashTableIter iter;
-  UsageData *usage;
-  GFileOutputStream *output;
-  GOutputStream *buffered_output;
-  GDataOutputStream *data_output;
+  GByteArray *buffer;
   GError *error = NULL;
+  UsageData *usage;
+  guint n_entries = 0;
+  char *appid;
 
-  self->save_id = 0;
+  buffer = g_byte_array_new ();
+  g_byte_array_append (buffer, (guint8 *) SNAPSHOT_MAGIC, strlen (SNAPSHOT_MAGIC));
+  _shell_binary_append_uint32 (buffer, STORE_VERSION);
+  _shell_binary_append_uint32 (buffer, 0); /* number of entries, filled in below */
+
+  g_hash_table_iter_init (&iter, self->app_usages);
+  while (g_hash_table_iter_next (&iter, (gpointer *) &appid, (gpointer *) &usage))
+    {
+      if (!should_save_app (appid))
+        continue;
+
+      append_entry (buffer, appid, usage);
+      n_entries++;
+    }
+
+  n_entries = GUINT32_TO_LE (n_entries);
+  memcpy (buffer->data + strlen (SNAPSHOT_MAGIC) + sizeof (guint32),
+          &n_entries, sizeof (n_entries));
 
   /* Parent directory is already created by shell-global */
-  output = g_file_replace (self->configfile, NULL, FALSE, G_FILE_CREATE_NONE, NULL, &error);
-  if (!output)
+  if (!g_file_replace_contents (self->snapshot_file,
+                                (const char *) buffer->data, buffer->len,
+                                NULL, FALSE, G_FILE_CREATE_NONE,
+                                NULL, NULL, &error))
     {
       g_debug ("Could not save applications usage data: %s", error->message);
       g_error_free (error);
-      return FALSE;
+      g_byte_array_unref (buffer);
+      return;
     }
-  buffered_output = g_buffered_output_stream_new (G_OUTPUT_STREAM (output));
-  g_object_unref (output);
-  data_output = g_data_output_stream_new (G_OUTPUT_STREAM (buffered_output));
-  g_object_unref (buffered_output);
 
-  if (!g_data_output_stream_put_string (data_output, "<?xml version=\"1.0\"?>\n<application-state>\n", NULL, &error))
-    goto out;
-  if (!g_data_output_stream_put_string (data_output, "  <context id=\"\">\n", NULL, &error))
-    goto out;
+  g_byte_array_unref (buffer);
 
-  g_hash_table_iter_init (&iter, self->app_usages);
+  /* Replaying the log on top of the new snapshot wouldn't do harm,
+   * so it's fine if we don't get here */
+  if (!g_file_delete (self->log_file, NULL, &error))
+    {
+      if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
+        g_debug ("Could not remove applications usage log: %s", error->message);
+      g_error_free (error);
+    }
 
-  while (g_hash_table_iter_next (&iter, (gpointer *) &id, (gpointer *) &usage))
+  self->n_log_records = 0;
+  g_hash_table_remove_all (self->dirty_apps);
+}
+
+/* Append the data of changed apps to the log */
+static void
+append_to_log (ShellAppUsage *self)
+{
+  GFileOutputStream *output;
+  GHashTableIter iter;
+  GByteArray *buffer;
+  GError *error = NULL;
+  guint n_records = 0;
+  char *appid;
+
+  buffer = g_byte_array_new ();
+
+  /* The snapshot holds everything that was in the log before, so
+   * start a new log with a header instead of appending */
+  if (self->n_log_records == 0)
     {
-      ShellApp *app;
+      g_byte_array_append (buffer, (guint8 *) LOG_MAGIC, strlen (LOG_MAGIC));
+      _shell_binary_append_uint32 (buffer, STORE_VERSION);
+    }
 
-      app = shell_app_system_lookup_app (shell_app_system_get_default(), id);
+  g_hash_table_iter_init (&iter, self->dirty_apps);
+  while (g_hash_table_iter_next (&iter, (gpointer *) &appid, NULL))
+    {
+      UsageData *usage = g_hash_table_lookup (self->app_usages, appid);
+      guint record_start = buffer->len;
 
-      if (!app)
+      if (usage == NULL || !should_save_app (appid))
         continue;
 
-      if (!g_data_output_stream_put_string (data_output, "    <application", NULL, &error))
-        goto out;
-      if (!write_attribute_string (data_output, "id", id, &error))
-        goto out;
-      if (!write_attribute_double (data_output, "score", usage->score, &error))
-        goto out;
-      if (!write_attribute_uint (data_output, "last-seen", usage->last_seen, &error))
-        goto out;
-      if (!g_data_output_stream_put_string (data_output, "/>\n", NULL, &error))
-        goto out;
+      append_entry (buffer, appid, usage);
+      _shell_binary_append_uint32 (buffer,
+                                   _shell_binary_checksum (buffer->data + record_start,
+                                                           buffer->len - record_start));
+      n_records++;
     }
-  if (!g_data_output_stream_put_string (data_output, "  </context>\n", NULL, &error))
+
+  if (n_records == 0)
     goto out;
-  if (!g_data_output_stream_put_string (data_output, "</application-state>\n", NULL, &error))
+
+  if (self->n_log_records == 0)
+    output = g_file_replace (self->log_file, NULL, FALSE, G_FILE_CREATE_NONE, NULL, &error);
+  else
+    output = g_file_append_to (self->log_file, G_FILE_CREATE_NONE, NULL, &error);
+  if (!output)
     goto out;
 
+  if (g_output_stream_write_all (G_OUTPUT_STREAM (output),
+                                 buffer->data, buffer->len,
+                                 NULL, NULL, &error))
+    g_output_stream_close (G_OUTPUT_STREAM (output), NULL, &error);
+
+  g_object_unref (output);
+
+  self->n_log_records += n_records;
+
 out:
-  if (!error)
-    g_output_stream_close_async (G_OUTPUT_STREAM (data_output), 0, NULL, NULL, NULL);
-  g_object_unref (data_output);
+  g_byte_array_unref (buffer);
+
   if (error)
     {
-      g_debug ("Could not save applications usage data: %s", error->message);
+      g_debug ("Could not append to applications usage log: %s", error->message);
       g_error_free (error);
+
+      /* The log might end with a partially written record now, which
+       * would hide anything appended after it; start over instead */
+      write_snapshot (self);
+      return;
     }
+
+  g_hash_table_remove_all (self->dirty_apps);
+}
+
+/* Save app data lists to file */
+static gboolean
+idle_save_application_usage (gpointer data)
+{
+  ShellAppUsage *self = SHELL_APP_USAGE (data);
+  guint max_log_records;
+
+  self->save_id = 0;
+
+  max_log_records = MAX (MIN_COMPACT_RECORDS,
+                         2 * g_hash_table_size (self->app_usages));
+
+  if (self->n_log_records + g_hash_table_size (self->dirty_apps) > max_log_records)
+    write_snapshot (self);
+  else
+    append_to_log (self);
+
   return FALSE;
 }
 
@@ -656,6 +1007,10 @@ shell_app_usage_start_element_handler  (GMarkupParseContext *context,
               usage->last_seen = (guint) g_ascii_strtoull (*value, NULL, 10);
             }
         }
+
+      /* Scores didn't decay before, start decaying them from the
+       * last time the app was seen */
+      usage->last_update = usage->last_seen;
     }
   else
     {
@@ -676,9 +1031,9 @@ static GMarkupParser app_state_parse_funcs =
   NULL
 };
 
-/* Load data about apps usage from file */
+/* Load data about apps usage from the XML file of earlier versions */
 static void
-restore_from_file (ShellAppUsage *self)
+restore_from_xml_file (ShellAppUsage *self)
 {
   GFileInputStream *input;
   GMarkupParseContext *parse_context;
@@ -711,8 +1066,6 @@ out:
   g_input_stream_close ((GInputStream*)input, NULL, NULL);
   g_object_unref (input);
 
-  idle_clean_usage (self);
-
   if (error)
     {
       g_warning ("Could not load applications usage data: %s", error->message);
@@ -720,6 +1073,152 @@ out:
     }
 }
 
+static GMappedFile *
+map_file (GFile    *file,
+          gboolean *exists)
+{
+  GMappedFile *mapped_file;
+  GError *error = NULL;
+  char *path;
+
+  path = g_file_get_path (file);
+  mapped_file = g_mapped_file_new (path, FALSE, &error);
+  g_free (path);
+
+  *exists = TRUE;
+
+  if (error)
+    {
+      if (g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+        *exists = FALSE;
+      else
+        g_warning ("Could not load applications usage data: %s", error->message);
+
+      g_error_free (error);
+    }
+
+  return mapped_file;
+}
+
+/* Returns %FALSE if the snapshot needs to be rewritten */
+static gboolean
+restore_from_snapshot (ShellAppUsage *self,
+                       GMappedFile   *mapped_file)
+{
+  ShellBinaryReader reader = { 0, };
+  const guint8 *magic;
+  guint32 version, n_entries, i;
+
+  reader.data = (const guint8 *) g_mapped_file_get_contents (mapped_file);
+  reader.length = g_mapped_file_get_length (mapped_file);
+
+  if (!_shell_binary_read_bytes (&reader, strlen (SNAPSHOT_MAGIC), &magic) ||
+      memcmp (magic, SNAPSHOT_MAGIC, strlen (SNAPSHOT_MAGIC)) != 0 ||
+      !_shell_binary_read_uint32 (&reader, &version) || version != STORE_VERSION ||
+      !_shell_binary_read_uint32 (&reader, &n_entries))
+    {
+      g_warning ("Could not load applications usage data: Invalid snapshot");
+      return FALSE;
+    }
+
+  for (i = 0; i < n_entries; i++)
+    {
+      UsageData usage;
+      char *appid;
+
+      if (!read_entry (&reader, &appid, &usage))
+        {
+          g_warning ("Could not load applications usage data: Truncated snapshot");
+          return FALSE;
+        }
+
+      set_usage (self, appid, &usage);
+    }
+
+  return TRUE;
+}
+
+/* Returns %FALSE if the log ends with a partially written record,
+ * or is invalid in another way */
+static gboolean
+replay_log (ShellAppUsage *self,
+            GMappedFile   *mapped_file)
+{
+  ShellBinaryReader reader = { 0, };
+  const guint8 *magic;
+  guint32 version;
+
+  reader.data = (const guint8 *) g_mapped_file_get_contents (mapped_file);
+  reader.length = g_mapped_file_get_length (mapped_file);
+
+  if (!_shell_binary_read_bytes (&reader, strlen (LOG_MAGIC), &magic) ||
+      memcmp (magic, LOG_MAGIC, strlen (LOG_MAGIC)) != 0 ||
+      !_shell_binary_read_uint32 (&reader, &version) || version != STORE_VERSION)
+    return FALSE;
+
+  while (reader.pos < reader.length)
+    {
+      gsize record_start = reader.pos;
+      guint32 checksum;
+      UsageData usage;
+      char *appid;
+
+      if (!read_entry (&reader, &appid, &usage))
+        return FALSE;
+
+      if (!_shell_binary_read_uint32 (&reader, &checksum) ||
+          checksum != _shell_binary_checksum (reader.data + record_start,
+                                              reader.pos - sizeof (checksum) - record_start))
+        {
+          g_free (appid);
+          return FALSE;
+        }
+
+      set_usage (self, appid, &usage);
+      self->n_log_records++;
+    }
+
+  return TRUE;
+}
+
+/* Load data about apps usage from file */
+static void
+restore_from_file (ShellAppUsage *self)
+{
+  GMappedFile *snapshot, *log;
+  gboolean have_snapshot, have_log;
+  gboolean needs_snapshot = FALSE;
+
+  snapshot = map_file (self->snapshot_file, &have_snapshot);
+  if (snapshot)
+    {
+      if (!restore_from_snapshot (self, snapshot))
+        needs_snapshot = TRUE;
+      g_mapped_file_unref (snapshot);
+    }
+
+  log = map_file (self->log_file, &have_log);
+  if (log)
+    {
+      /* Don't append after a partially written record */
+      if (!replay_log (self, log))
+        needs_snapshot = TRUE;
+      g_mapped_file_unref (log);
+    }
+
+  if (!have_snapshot && !have_log)
+    {
+      restore_from_xml_file (self);
+      needs_snapshot = g_hash_table_size (self->app_usages) > 0;
+    }
+
+  if (idle_clean_usage (self))
+    needs_snapshot = TRUE;
+
+  if (needs_snapshot)
+    write_snapshot (self);
+}
+
 /* Enable or disable the timers, depending on the value of ENABLE_MONITORING_KEY
  * and taking care of the previous state.  If selfing is disabled, we still
  * report apps usage based on (possibly) saved data, but don't collect data.
@@ -14,6 +14,9 @@ G_DECLARE_FINAL_TYPE (ShellAppUsage, shell_app_usage,
 ShellAppUsage* shell_app_usage_get_default(void);
 
 GSList *shell_app_usage_get_most_used (ShellAppUsage *usage);
+GSList *shell_app_usage_get_top_apps (ShellAppUsage *usage,
+                                      guint          max_apps,
+                                      gboolean       use_context);
 int shell_app_usage_compare (ShellAppUsage *self,
                              const char    *id_a,
                              const char    *id_b);
@@ -41,6 +41,10 @@ typedef struct {
 
   guint interesting_windows;
 
+  /* Most recent user time of all windows, kept up to date so that
+   * sorting running apps doesn't need to walk their windows */
+  guint32 last_user_time;
+
   /* Whether or not we need to resort the windows; this is done on demand */
   guint window_sort_stale : 1;
 
@@ -776,19 +780,25 @@ shell_app_is_on_workspace (ShellApp *app,
 
 static int
 shell_app_get_last_user_time (ShellApp *app)
+{
+  if (app->running_state == NULL)
+    return 0;
+
+  return (int)app->running_state->last_user_time;
+}
+
+static void
+shell_app_update_last_user_time (ShellApp *app)
 {
   GSList *iter;
   guint32 last_user_time;
 
   last_user_time = 0;
 
-  if (app->running_state != NULL)
-    {
-      for (iter = app->running_state->windows; iter; iter = iter->next)
-        last_user_time = MAX (last_user_time, meta_window_get_user_time (iter->data));
-    }
+  for (iter = app->running_state->windows; iter; iter = iter->next)
+    last_user_time = MAX (last_user_time, meta_window_get_user_time (iter->data));
 
-  return (int)last_user_time;
+  app->running_state->last_user_time = last_user_time;
 }
 
 static gboolean
@@ -922,6 +932,10 @@ shell_app_on_user_time_changed (MetaWindow *window,
 {
   g_assert (app->running_state != NULL);
 
+  app->running_state->last_user_time = MAX (app->running_state->last_user_time,
+                                            meta_window_get_user_time (window));
+  _shell_app_system_invalidate_running (shell_app_system_get_default ());
+
   /* Ideally we don't want to emit windows-changed if the sort order
    * isn't actually changing. This check catches most of those.
    */
@@ -932,6 +946,14 @@ shell_app_on_user_time_changed (MetaWindow *window,
     }
 }
 
+static void
+shell_app_on_minimized_changed (MetaWindow *window,
+                                GParamSpec *pspec,
+                                ShellApp   *app)
+{
+  _shell_app_system_invalidate_running (shell_app_system_get_default ());
+}
+
 static void
 shell_app_sync_running_state (ShellApp *app)
 {
@@ -1079,9 +1101,14 @@ _shell_app_add_window (ShellApp        *app,
 
   app->running_state->window_sort_stale = TRUE;
   app->running_state->windows = g_slist_prepend (app->running_state->windows, g_object_ref (window));
+  app->running_state->last_user_time = MAX (app->running_state->last_user_time,
+                                            meta_window_get_user_time (window));
+  _shell_app_system_add_app_window (shell_app_system_get_default (), app, window);
+  _shell_app_system_invalidate_running (shell_app_system_get_default ());
   g_signal_connect_object (window, "unmanaged", G_CALLBACK(shell_app_on_unmanaged), app, 0);
   g_signal_connect_object (window, "notify::user-time", G_CALLBACK(shell_app_on_user_time_changed), app, 0);
   g_signal_connect_object (window, "notify::skip-taskbar", G_CALLBACK(shell_app_on_skip_taskbar_changed), app, 0);
+  g_signal_connect_object (window, "notify::minimized", G_CALLBACK(shell_app_on_minimized_changed), app, 0);
 
   shell_app_update_app_actions (app, window);
   shell_app_ensure_busy_watch (app);
@@ -1107,8 +1134,12 @@ _shell_app_remove_window (ShellApp   *app,
   g_signal_handlers_disconnect_by_func (window, G_CALLBACK(shell_app_on_unmanaged), app);
   g_signal_handlers_disconnect_by_func (window, G_CALLBACK(shell_app_on_user_time_changed), app);
   g_signal_handlers_disconnect_by_func (window, G_CALLBACK(shell_app_on_skip_taskbar_changed), app);
+  g_signal_handlers_disconnect_by_func (window, G_CALLBACK(shell_app_on_minimized_changed), app);
+  _shell_app_system_remove_app_window (shell_app_system_get_default (), app, window);
+  _shell_app_system_invalidate_running (shell_app_system_get_default ());
   g_object_unref (window);
   app->running_state->windows = g_slist_remove (app->running_state->windows, window);
+  shell_app_update_last_user_time (app);
 
   if (!meta_window_is_skip_taskbar (window))
     app->running_state->interesting_windows--;
@@ -0,0 +1,151 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+#include "config.h"
+
+#include <string.h>
+
+#include "shell-binary-util.h"
+
+/*
+ * Helpers for the binary files the shell keeps its caches and usage
+ * data in. Numbers are little endian, strings are prefixed by their
+ * length as 32 bit integer. Reads that would go past the end of the
+ * data fail and leave the value unset.
+ */
+
+/*
+ * _shell_binary_checksum:
+ * @data: the data to checksum
+ * @length: the length of @data
+ *
+ * Computes the FNV-1a hash of @data. It is not meant to protect
+ * against anything but files that were only partially written.
+ *
+ * Returns: the checksum
+ */
+guint32
+_shell_binary_checksum (const guint8 *data,
+                        gsize         length)
+{
+  guint32 hash = 2166136261u;
+  gsize i;
+
+  for (i = 0; i < length; i++)
+    {
+      hash ^= data[i];
+      hash *= 16777619u;
+    }
+
+  return hash;
+}
+
+void
+_shell_binary_append_uint32 (GByteArray *buffer,
+                             guint32     value)
+{
+  value = GUINT32_TO_LE (value);
+  g_byte_array_append (buffer, (guint8 *) &value, sizeof (value));
+}
+
+void
+_shell_binary_append_int64 (GByteArray *buffer,
+                            gint64      value)
+{
+  value = GINT64_TO_LE (value);
+  g_byte_array_append (buffer, (guint8 *) &value, sizeof (value));
+}
+
+void
+_shell_binary_append_double (GByteArray *buffer,
+                             double      value)
+{
+  union { double d; guint64 u; } bits;
+
+  bits.d = value;
+  bits.u = GUINT64_TO_LE (bits.u);
+  g_byte_array_append (buffer, (guint8 *) &bits.u, sizeof (bits.u));
+}
+
+/* %NULL is written as the empty string */
+void
+_shell_binary_append_string (GByteArray *buffer,
+                             const char *value)
+{
+  guint32 length = value ? strlen (value) : 0;
+
+  _shell_binary_append_uint32 (buffer, length);
+  g_byte_array_append (buffer, (guint8 *) value, length);
+}
+
+gboolean
+_shell_binary_read_bytes (ShellBinaryReader  *reader,
+                          gsize               length,
+                          const guint8      **bytes)
+{
+  if (reader->length - reader->pos < length)
+    return FALSE;
+
+  *bytes = reader->data + reader->pos;
+  reader->pos += length;
+  return TRUE;
+}
+
+gboolean
+_shell_binary_read_uint32 (ShellBinaryReader *reader,
+                           guint32           *value)
+{
+  const guint8 *bytes;
+
+  if (!_shell_binary_read_bytes (reader, sizeof (guint32), &bytes))
+    return FALSE;
+
+  memcpy (value, bytes, sizeof (guint32));
+  *value = GUINT32_FROM_LE (*value);
+  return TRUE;
+}
+
+gboolean
+_shell_binary_read_int64 (ShellBinaryReader *reader,
+                          gint64            *value)
+{
+  const guint8 *bytes;
+
+  if (!_shell_binary_read_bytes (reader, sizeof (gint64), &bytes))
+    return FALSE;
+
+  memcpy (value, bytes, sizeof (gint64));
+  *value = GINT64_FROM_LE (*value);
+  return TRUE;
+}
+
+gboolean
+_shell_binary_read_double (ShellBinaryReader *reader,
+                           double            *value)
+{
+  union { double d; guint64 u; } bits;
+  const guint8 *bytes;
+
+  if (!_shell_binary_read_bytes (reader, sizeof (guint64), &bytes))
+    return FALSE;
+
+  memcpy (&bits.u, bytes, sizeof (guint64));
+  bits.u = GUINT64_FROM_LE (bits.u);
+  *value = bits.d;
+  return TRUE;
+}
+
+/* Empty strings are read as %NULL */
+gboolean
+_shell_binary_read_string (ShellBinaryReader  *reader,
+                           char              **value)
+{
+  const guint8 *bytes;
+  guint32 length;
+
+  if (!_shell_binary_read_uint32 (reader, &length) ||
+      !_shell_binary_read_bytes (reader, length, &bytes))
+    return FALSE;
+
+  *value = length > 0 ? g_strndup ((const char *) bytes, length) : NULL;
+  return TRUE;
+}
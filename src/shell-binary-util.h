@@ -0,0 +1,41 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+#ifndef __SHELL_BINARY_UTIL_H__
+#define __SHELL_BINARY_UTIL_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct {
+  const guint8 *data;
+  gsize length;
+  gsize pos;
+} ShellBinaryReader;
+
+guint32  _shell_binary_checksum      (const guint8       *data,
+                                      gsize               length);
+
+void     _shell_binary_append_uint32 (GByteArray         *buffer,
+                                      guint32             value);
+void     _shell_binary_append_int64  (GByteArray         *buffer,
+                                      gint64              value);
+void     _shell_binary_append_double (GByteArray         *buffer,
+                                      double              value);
+void     _shell_binary_append_string (GByteArray         *buffer,
+                                      const char         *value);
+
+gboolean _shell_binary_read_bytes    (ShellBinaryReader  *reader,
+                                      gsize               length,
+                                      const guint8      **bytes);
+gboolean _shell_binary_read_uint32   (ShellBinaryReader  *reader,
+                                      guint32            *value);
+gboolean _shell_binary_read_int64    (ShellBinaryReader  *reader,
+                                      gint64             *value);
+gboolean _shell_binary_read_double   (ShellBinaryReader  *reader,
+                                      double             *value);
+gboolean _shell_binary_read_string   (ShellBinaryReader  *reader,
+                                      char              **value);
+
+G_END_DECLS
+
+#endif /* __SHELL_BINARY_UTIL_H__ */
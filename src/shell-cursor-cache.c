@@ -0,0 +1,195 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+#include "config.h"
+
+#include <math.h>
+
+#include <clutter/clutter.h>
+#include <cogl/cogl.h>
+
+#include "shell-cursor-cache.h"
+
+/*
+ * Reading the cursor sprite back from its texture and scaling it is
+ * far more work than blending it into a frame, and the sprite only
+ * changes when the cursor tracker says so. So we keep the images of
+ * the current sprite, at each scale they were asked for, on the
+ * tracker until the next "cursor-changed".
+ */
+
+#define CURSOR_CACHE_KEY "shell-cursor-cache"
+
+typedef struct
+{
+  double scale;
+  cairo_surface_t *image;
+} CachedImage;
+
+typedef struct
+{
+  gboolean valid;
+  int hot_x;
+  int hot_y;
+  GArray *images; /* CachedImage, the first one at scale 1 */
+} CursorCache;
+
+static void
+cursor_cache_clear (CursorCache *cache)
+{
+  guint i;
+
+  for (i = 0; i < cache->images->len; i++)
+    cairo_surface_destroy (g_array_index (cache->images, CachedImage, i).image);
+  g_array_set_size (cache->images, 0);
+
+  cache->valid = FALSE;
+}
+
+static void
+cursor_cache_free (CursorCache *cache)
+{
+  cursor_cache_clear (cache);
+  g_array_free (cache->images, TRUE);
+  g_free (cache);
+}
+
+static void
+on_cursor_changed (MetaCursorTracker *tracker,
+                   CursorCache       *cache)
+{
+  cursor_cache_clear (cache);
+}
+
+static CursorCache *
+cursor_cache_get (MetaCursorTracker *tracker)
+{
+  CursorCache *cache;
+
+  cache = g_object_get_data (G_OBJECT (tracker), CURSOR_CACHE_KEY);
+  if (cache != NULL)
+    return cache;
+
+  cache = g_new0 (CursorCache, 1);
+  cache->images = g_array_new (FALSE, FALSE, sizeof (CachedImage));
+
+  /* The cache goes away with the tracker, and the handler with it */
+  g_object_set_data_full (G_OBJECT (tracker), CURSOR_CACHE_KEY,
+                          cache, (GDestroyNotify) cursor_cache_free);
+  g_signal_connect (tracker, "cursor-changed",
+                    G_CALLBACK (on_cursor_changed), cache);
+
+  return cache;
+}
+
+/* Reads the sprite back into an image surface that owns its memory */
+static cairo_surface_t *
+fetch_sprite (MetaCursorTracker *tracker)
+{
+  CoglTexture *texture;
+  cairo_surface_t *image;
+  int width, height;
+
+  texture = meta_cursor_tracker_get_sprite (tracker);
+  if (!texture)
+    return NULL;
+
+  width = cogl_texture_get_width (texture);
+  height = cogl_texture_get_height (texture);
+
+  image = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, width, height);
+  if (cairo_surface_status (image) != CAIRO_STATUS_SUCCESS)
+    {
+      cairo_surface_destroy (image);
+      return NULL;
+    }
+
+  /* FIXME: cairo-gl? */
+  cogl_texture_get_data (texture, CLUTTER_CAIRO_FORMAT_ARGB32,
+                         cairo_image_surface_get_stride (image),
+                         cairo_image_surface_get_data (image));
+  cairo_surface_mark_dirty (image);
+
+  return image;
+}
+
+static cairo_surface_t *
+scale_sprite (cairo_surface_t *sprite,
+              double           scale)
+{
+  cairo_surface_t *image;
+  cairo_t *cr;
+  int width, height;
+
+  width = ceil (cairo_image_surface_get_width (sprite) * scale);
+  height = ceil (cairo_image_surface_get_height (sprite) * scale);
+
+  image = cairo_image_surface_create (CAIRO_FORMAT_ARGB32,
+                                      MAX (width, 1), MAX (height, 1));
+
+  cr = cairo_create (image);
+  cairo_scale (cr, scale, scale);
+  cairo_set_source_surface (cr, sprite, 0, 0);
+  cairo_paint (cr);
+  cairo_destroy (cr);
+
+  cairo_surface_flush (image);
+
+  return image;
+}
+
+/*
+ * _shell_cursor_cache_get_image:
+ * @tracker: the #MetaCursorTracker
+ * @scale: the number of image pixels per sprite pixel
+ * @hot_x: (out): return location for the X coordinate of the hot spot,
+ *   in sprite pixels
+ * @hot_y: (out): return location for the Y coordinate of the hot spot,
+ *   in sprite pixels
+ *
+ * Gets an image of the current cursor sprite of @tracker, scaled by
+ * @scale. The image is created once for each scale and kept until the
+ * sprite changes; it must not be modified, but may be used from other
+ * threads.
+ *
+ * Returns: (transfer full) (nullable): the image of the sprite, or
+ *   %NULL if there is no sprite
+ */
+cairo_surface_t *
+_shell_cursor_cache_get_image (MetaCursorTracker *tracker,
+                               double             scale,
+                               int               *hot_x,
+                               int               *hot_y)
+{
+  CursorCache *cache = cursor_cache_get (tracker);
+  CachedImage cached;
+  guint i;
+
+  if (!cache->valid)
+    {
+      cached.scale = 1.0;
+      cached.image = fetch_sprite (tracker);
+      if (cached.image == NULL)
+        return NULL;
+
+      meta_cursor_tracker_get_hot (tracker, &cache->hot_x, &cache->hot_y);
+      g_array_append_val (cache->images, cached);
+      cache->valid = TRUE;
+    }
+
+  *hot_x = cache->hot_x;
+  *hot_y = cache->hot_y;
+
+  for (i = 0; i < cache->images->len; i++)
+    {
+      cached = g_array_index (cache->images, CachedImage, i);
+      if (cached.scale == scale)
+        return cairo_surface_reference (cached.image);
+    }
+
+  cached.scale = scale;
+  cached.image = scale_sprite (g_array_index (cache->images, CachedImage, 0).image,
+                               scale);
+  g_array_append_val (cache->images, cached);
+
+  return cairo_surface_reference (cached.image);
+}
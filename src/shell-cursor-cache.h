@@ -0,0 +1,17 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+#ifndef __SHELL_CURSOR_CACHE_H__
+#define __SHELL_CURSOR_CACHE_H__
+
+#include <cairo.h>
+#include <meta/meta-cursor-tracker.h>
+
+G_BEGIN_DECLS
+
+cairo_surface_t *_shell_cursor_cache_get_image (MetaCursorTracker *tracker,
+                                                double             scale,
+                                                int               *hot_x,
+                                                int               *hot_y);
+
+G_END_DECLS
+
+#endif /* __SHELL_CURSOR_CACHE_H__ */
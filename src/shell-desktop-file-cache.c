@@ -0,0 +1,538 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+#include "config.h"
+
+#include <string.h>
+
+#include <glib/gstdio.h>
+
+#include "shell-app-search-index.h"
+#include "shell-binary-util.h"
+#include "shell-desktop-file-cache.h"
+
+/*
+ * Loading every desktop file on startup is a noticeable part of the
+ * login time on systems with many applications installed. Instead,
+ * the metadata the shell needs about every app is kept in a cache,
+ * which is valid as long as none of the directories containing the
+ * desktop files were modified, and desktop files are only parsed when
+ * a #GDesktopAppInfo is actually needed.
+ *
+ * Desktop files that are modified in place without replacing them
+ * don't change the directory modification time; those changes are
+ * only picked up by the next rescan. Files and directories are
+ * compared by their modification time in nanoseconds, where the file
+ * system has them, and by their inode, which changes when they are
+ * replaced by a rename.
+ *
+ * The cache consists of the magic bytes, the version, the time it
+ * was written, a key identifying the environment the metadata depends
+ * on, the directories with their modification times and inodes and
+ * the desktop files, followed by a checksum of all of it. Numbers are
+ * little endian, strings are prefixed by their length.
+ */
+
+#define CACHE_FILENAME "desktop-files.bin"
+#define CACHE_MAGIC "GSDSKTOP"
+#define CACHE_VERSION 2
+
+#define NSEC_PER_SEC G_GINT64_CONSTANT (1000000000)
+
+enum {
+  FLAG_HIDDEN = 1 << 0,
+  FLAG_SHOULD_SHOW = 1 << 1
+};
+
+static void
+desktop_file_dir_free (ShellDesktopFileDir *dir)
+{
+  g_free (dir->path);
+  g_free (dir);
+}
+
+static void
+add_dir (GPtrArray  *dirs,
+         const char *path,
+         gint64      mtime,
+         guint64     inode)
+{
+  ShellDesktopFileDir *dir = g_new0 (ShellDesktopFileDir, 1);
+
+  dir->path = g_strdup (path);
+  dir->mtime = mtime;
+  dir->inode = inode;
+  g_ptr_array_add (dirs, dir);
+}
+
+static gint64
+get_mtime (const GStatBuf *buf)
+{
+  return buf->st_mtim.tv_sec * NSEC_PER_SEC + buf->st_mtim.tv_nsec;
+}
+
+void
+_shell_desktop_file_free (ShellDesktopFile *file)
+{
+  g_free (file->filename);
+  g_free (file->startup_wm_class);
+  g_free (file->search_data);
+  g_clear_object (&file->info);
+  g_free (file);
+}
+
+/**
+ * _shell_desktop_file_load:
+ * @file: a #ShellDesktopFile
+ * @id: the desktop ID of @file
+ *
+ * Loads @file and fills in its metadata.
+ */
+void
+_shell_desktop_file_load (ShellDesktopFile *file,
+                          const char       *id)
+{
+  g_clear_object (&file->info);
+  g_clear_pointer (&file->startup_wm_class, g_free);
+  g_clear_pointer (&file->search_data, g_free);
+
+  file->info = g_desktop_app_info_new (id);
+  file->has_metadata = TRUE;
+  file->hidden = file->info == NULL;
+
+  if (file->hidden)
+    return;
+
+  file->should_show = g_app_info_should_show (G_APP_INFO (file->info));
+  file->startup_wm_class =
+    g_strdup (g_desktop_app_info_get_startup_wm_class (file->info));
+  file->search_data = _shell_app_search_index_serialize_info (file->info);
+}
+
+/**
+ * _shell_desktop_file_get_info:
+ * @file: a #ShellDesktopFile
+ * @id: the desktop ID of @file
+ *
+ * Returns: (transfer none) (nullable): the #GDesktopAppInfo of @file,
+ *   loading it if that didn't happen yet, or %NULL if @file is hidden
+ */
+GDesktopAppInfo *
+_shell_desktop_file_get_info (ShellDesktopFile *file,
+                              const char       *id)
+{
+  if (file->info == NULL && !file->hidden)
+    {
+      file->info = g_desktop_app_info_new (id);
+      file->hidden = file->info == NULL;
+    }
+
+  return file->info;
+}
+
+static GPtrArray *
+get_data_dirs (void)
+{
+  const char * const *data_dirs;
+  GPtrArray *paths;
+
+  paths = g_ptr_array_new_with_free_func (g_free);
+
+  g_ptr_array_add (paths, g_build_filename (g_get_user_data_dir (),
+                                            "applications", NULL));
+
+  for (data_dirs = g_get_system_data_dirs (); *data_dirs; data_dirs++)
+    g_ptr_array_add (paths, g_build_filename (*data_dirs, "applications", NULL));
+
+  return paths;
+}
+
+/* Identifies everything besides the desktop files themselves that the
+ * cached metadata depends on */
+static char *
+get_cache_key (void)
+{
+  GString *key = g_string_new (NULL);
+  const char * const *languages;
+  const char *current_desktop;
+  GPtrArray *paths;
+  guint i;
+
+  for (languages = g_get_language_names (); *languages; languages++)
+    g_string_append_printf (key, "%s:", *languages);
+
+  current_desktop = g_getenv ("XDG_CURRENT_DESKTOP");
+  g_string_append_printf (key, "\n%s\n", current_desktop ? current_desktop : "");
+
+  paths = get_data_dirs ();
+  for (i = 0; i < paths->len; i++)
+    g_string_append_printf (key, "%s:", (char *) g_ptr_array_index (paths, i));
+  g_ptr_array_unref (paths);
+
+  return g_string_free (key, FALSE);
+}
+
+/* Sets @mtime to -1 if @path is not a directory */
+static void
+stat_dir (const char *path,
+          gint64     *mtime,
+          guint64    *inode)
+{
+  GStatBuf buf;
+
+  if (g_stat (path, &buf) != 0 || !S_ISDIR (buf.st_mode))
+    {
+      *mtime = -1;
+      *inode = 0;
+      return;
+    }
+
+  *mtime = get_mtime (&buf);
+  *inode = buf.st_ino;
+}
+
+/* Collects the desktop files in @path and its subdirectories, the same
+ * way GLib assigns desktop IDs to them; earlier directories take
+ * precedence over later ones.
+ */
+static void
+scan_desktop_file_dir (GHashTable *files,
+                       GPtrArray  *dirs,
+                       const char *path,
+                       const char *prefix)
+{
+  const char *name;
+  guint64 inode;
+  gint64 mtime;
+  GDir *dir;
+
+  stat_dir (path, &mtime, &inode);
+  add_dir (dirs, path, mtime, inode);
+
+  dir = g_dir_open (path, 0, NULL);
+  if (dir == NULL)
+    return;
+
+  while ((name = g_dir_read_name (dir)) != NULL)
+    {
+      char *filename = g_build_filename (path, name, NULL);
+
+      if (g_str_has_suffix (name, ".desktop"))
+        {
+          char *id = g_strconcat (prefix, name, NULL);
+          GStatBuf buf;
+
+          if (!g_hash_table_contains (files, id) &&
+              g_stat (filename, &buf) == 0)
+            {
+              ShellDesktopFile *file = g_new0 (ShellDesktopFile, 1);
+
+              file->filename = g_steal_pointer (&filename);
+              file->mtime = get_mtime (&buf);
+              file->inode = buf.st_ino;
+              file->size = buf.st_size;
+              g_hash_table_insert (files, g_steal_pointer (&id), file);
+            }
+
+          g_free (id);
+        }
+      else if (g_file_test (filename, G_FILE_TEST_IS_DIR))
+        {
+          char *subprefix = g_strconcat (prefix, name, "-", NULL);
+
+          scan_desktop_file_dir (files, dirs, filename, subprefix);
+          g_free (subprefix);
+        }
+
+      g_free (filename);
+    }
+
+  g_dir_close (dir);
+}
+
+/**
+ * _shell_desktop_file_cache_scan:
+ * @dirs: (out): return location for the scanned directories
+ *
+ * Collects the desktop files of all installed applications, without
+ * loading them.
+ *
+ * Returns: (transfer full): a table mapping desktop IDs to
+ *   #ShellDesktopFile structures
+ */
+GHashTable *
+_shell_desktop_file_cache_scan (GPtrArray **dirs)
+{
+  GHashTable *files;
+  GPtrArray *paths;
+  guint i;
+
+  files = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                 g_free, (GDestroyNotify) _shell_desktop_file_free);
+  *dirs = g_ptr_array_new_with_free_func ((GDestroyNotify) desktop_file_dir_free);
+
+  paths = get_data_dirs ();
+  for (i = 0; i < paths->len; i++)
+    scan_desktop_file_dir (files, *dirs, g_ptr_array_index (paths, i), "");
+  g_ptr_array_unref (paths);
+
+  return files;
+}
+
+static char *
+get_cache_path (void)
+{
+  return g_build_filename (g_get_user_cache_dir (), "gnome-shell",
+                           CACHE_FILENAME, NULL);
+}
+
+static gboolean
+read_desktop_file (ShellBinaryReader  *reader,
+                   char              **id,
+                   ShellDesktopFile  **file)
+{
+  ShellDesktopFile *result = g_new0 (ShellDesktopFile, 1);
+  gint64 inode, size;
+  guint32 flags;
+
+  *id = NULL;
+
+  if (!_shell_binary_read_string (reader, id) || *id == NULL ||
+      !_shell_binary_read_string (reader, &result->filename) || result->filename == NULL ||
+      !_shell_binary_read_int64 (reader, &result->mtime) ||
+      !_shell_binary_read_int64 (reader, &inode) ||
+      !_shell_binary_read_int64 (reader, &size) ||
+      !_shell_binary_read_uint32 (reader, &flags) ||
+      !_shell_binary_read_string (reader, &result->startup_wm_class) ||
+      !_shell_binary_read_string (reader, &result->search_data))
+    {
+      g_clear_pointer (id, g_free);
+      _shell_desktop_file_free (result);
+      return FALSE;
+    }
+
+  result->inode = inode;
+  result->size = size;
+  result->has_metadata = TRUE;
+  result->hidden = (flags & FLAG_HIDDEN) != 0;
+  result->should_show = (flags & FLAG_SHOULD_SHOW) != 0;
+
+  *file = result;
+  return TRUE;
+}
+
+static GHashTable *
+read_cache (ShellBinaryReader  *reader,
+            GPtrArray         **dirs)
+{
+  const guint8 *magic;
+  GHashTable *files = NULL;
+  char *key = NULL, *expected_key;
+  guint32 version, n_dirs, n_files, i;
+  gint64 written;
+
+  if (!_shell_binary_read_bytes (reader, strlen (CACHE_MAGIC), &magic) ||
+      memcmp (magic, CACHE_MAGIC, strlen (CACHE_MAGIC)) != 0 ||
+      !_shell_binary_read_uint32 (reader, &version) || version != CACHE_VERSION ||
+      !_shell_binary_read_int64 (reader, &written) ||
+      !_shell_binary_read_string (reader, &key))
+    return NULL;
+
+  expected_key = get_cache_key ();
+  if (g_strcmp0 (key, expected_key) != 0)
+    goto out;
+
+  if (!_shell_binary_read_uint32 (reader, &n_dirs))
+    goto out;
+
+  *dirs = g_ptr_array_new_with_free_func ((GDestroyNotify) desktop_file_dir_free);
+
+  for (i = 0; i < n_dirs; i++)
+    {
+      char *path;
+      gint64 mtime, inode, current_mtime;
+      guint64 current_inode;
+
+      if (!_shell_binary_read_string (reader, &path) || path == NULL)
+        goto out;
+
+      if (!_shell_binary_read_int64 (reader, &mtime) ||
+          !_shell_binary_read_int64 (reader, &inode))
+        {
+          g_free (path);
+          goto out;
+        }
+
+      add_dir (*dirs, path, mtime, inode);
+      stat_dir (path, &current_mtime, &current_inode);
+
+      /* On file systems that only keep whole seconds, a directory
+       * modified in the same second the cache was written may have been
+       * modified again after that without us noticing */
+      if (mtime != current_mtime || (guint64) inode != current_inode ||
+          mtime / NSEC_PER_SEC >= written)
+        {
+          g_free (path);
+          goto out;
+        }
+
+      g_free (path);
+    }
+
+  if (!_shell_binary_read_uint32 (reader, &n_files))
+    goto out;
+
+  files = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                 g_free, (GDestroyNotify) _shell_desktop_file_free);
+
+  for (i = 0; i < n_files; i++)
+    {
+      ShellDesktopFile *file;
+      char *id;
+
+      if (!read_desktop_file (reader, &id, &file))
+        {
+          g_clear_pointer (&files, g_hash_table_destroy);
+          goto out;
+        }
+
+      g_hash_table_insert (files, id, file);
+    }
+
+out:
+  if (files == NULL)
+    g_clear_pointer (dirs, g_ptr_array_unref);
+
+  g_free (key);
+  g_free (expected_key);
+
+  return files;
+}
+
+/**
+ * _shell_desktop_file_cache_load:
+ * @dirs: (out): return location for the directories the cache was
+ *   created from
+ *
+ * Loads the desktop files from the cache written by
+ * _shell_desktop_file_cache_save(), with their metadata but without
+ * loading their #GDesktopAppInfo.
+ *
+ * Returns: (transfer full) (nullable): a table mapping desktop IDs to
+ *   #ShellDesktopFile structures, or %NULL if there is no valid cache
+ */
+GHashTable *
+_shell_desktop_file_cache_load (GPtrArray **dirs)
+{
+  ShellBinaryReader reader = { 0, };
+  GMappedFile *mapped_file;
+  GHashTable *files = NULL;
+  guint32 checksum;
+  char *path;
+
+  *dirs = NULL;
+
+  path = get_cache_path ();
+  mapped_file = g_mapped_file_new (path, FALSE, NULL);
+  g_free (path);
+
+  if (mapped_file == NULL)
+    return NULL;
+
+  reader.data = (const guint8 *) g_mapped_file_get_contents (mapped_file);
+  reader.length = g_mapped_file_get_length (mapped_file);
+
+  if (reader.length < sizeof (checksum))
+    goto out;
+
+  reader.length -= sizeof (checksum);
+  memcpy (&checksum, reader.data + reader.length, sizeof (checksum));
+
+  if (GUINT32_FROM_LE (checksum) != _shell_binary_checksum (reader.data, reader.length))
+    goto out;
+
+  files = read_cache (&reader, dirs);
+
+out:
+  g_mapped_file_unref (mapped_file);
+
+  return files;
+}
+
+/**
+ * _shell_desktop_file_cache_save:
+ * @files: a table mapping desktop IDs to #ShellDesktopFile structures,
+ *   all of which have their metadata loaded
+ * @dirs: the directories @files were scanned from
+ *
+ * Writes @files to the cache.
+ */
+void
+_shell_desktop_file_cache_save (GHashTable *files,
+                                GPtrArray  *dirs)
+{
+  GHashTableIter iter;
+  GByteArray *buffer;
+  GError *error = NULL;
+  gpointer key, value;
+  char *cache_key, *path, *dirname;
+  guint i;
+
+  buffer = g_byte_array_new ();
+  g_byte_array_append (buffer, (guint8 *) CACHE_MAGIC, strlen (CACHE_MAGIC));
+  _shell_binary_append_uint32 (buffer, CACHE_VERSION);
+  _shell_binary_append_int64 (buffer, g_get_real_time () / G_USEC_PER_SEC);
+
+  cache_key = get_cache_key ();
+  _shell_binary_append_string (buffer, cache_key);
+  g_free (cache_key);
+
+  _shell_binary_append_uint32 (buffer, dirs->len);
+  for (i = 0; i < dirs->len; i++)
+    {
+      ShellDesktopFileDir *dir = g_ptr_array_index (dirs, i);
+
+      _shell_binary_append_string (buffer, dir->path);
+      _shell_binary_append_int64 (buffer, dir->mtime);
+      _shell_binary_append_int64 (buffer, dir->inode);
+    }
+
+  _shell_binary_append_uint32 (buffer, g_hash_table_size (files));
+  g_hash_table_iter_init (&iter, files);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      ShellDesktopFile *file = value;
+      guint32 flags = 0;
+
+      g_warn_if_fail (file->has_metadata);
+
+      if (file->hidden)
+        flags |= FLAG_HIDDEN;
+      if (file->should_show)
+        flags |= FLAG_SHOULD_SHOW;
+
+      _shell_binary_append_string (buffer, key);
+      _shell_binary_append_string (buffer, file->filename);
+      _shell_binary_append_int64 (buffer, file->mtime);
+      _shell_binary_append_int64 (buffer, file->inode);
+      _shell_binary_append_int64 (buffer, file->size);
+      _shell_binary_append_uint32 (buffer, flags);
+      _shell_binary_append_string (buffer, file->startup_wm_class);
+      _shell_binary_append_string (buffer, file->search_data);
+    }
+
+  _shell_binary_append_uint32 (buffer, _shell_binary_checksum (buffer->data, buffer->len));
+
+  path = get_cache_path ();
+  dirname = g_path_get_dirname (path);
+  g_mkdir_with_parents (dirname, 0700);
+
+  if (!g_file_set_contents (path, (const char *) buffer->data, buffer->len, &error))
+    {
+      g_debug ("Could not save desktop file cache: %s", error->message);
+      g_error_free (error);
+    }
+
+  g_free (dirname);
+  g_free (path);
+  g_byte_array_unref (buffer);
+}
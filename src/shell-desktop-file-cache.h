@@ -0,0 +1,47 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+#ifndef __SHELL_DESKTOP_FILE_CACHE_H__
+#define __SHELL_DESKTOP_FILE_CACHE_H__
+
+#include <gio/gio.h>
+#include <gio/gdesktopappinfo.h>
+
+G_BEGIN_DECLS
+
+typedef struct {
+  char *path;
+  gint64 mtime; /* in nanoseconds, -1 if the directory doesn't exist */
+  guint64 inode;
+} ShellDesktopFileDir;
+
+typedef struct {
+  char *filename;
+  gint64 mtime; /* in nanoseconds */
+  guint64 inode;
+  goffset size;
+
+  /* What the shell needs to know about every app, from the cache or
+   * the desktop file; only valid if has_metadata is set */
+  gboolean has_metadata;
+  gboolean hidden; /* hidden or failed to load */
+  gboolean should_show;
+  char *startup_wm_class;
+  char *search_data;
+
+  /* Loaded on demand, see _shell_desktop_file_get_info() */
+  GDesktopAppInfo *info;
+} ShellDesktopFile;
+
+void             _shell_desktop_file_free       (ShellDesktopFile *file);
+void             _shell_desktop_file_load       (ShellDesktopFile *file,
+                                                 const char       *id);
+GDesktopAppInfo *_shell_desktop_file_get_info   (ShellDesktopFile *file,
+                                                 const char       *id);
+
+GHashTable      *_shell_desktop_file_cache_scan (GPtrArray       **dirs);
+GHashTable      *_shell_desktop_file_cache_load (GPtrArray       **dirs);
+void             _shell_desktop_file_cache_save (GHashTable       *files,
+                                                 GPtrArray        *dirs);
+
+G_END_DECLS
+
+#endif /* __SHELL_DESKTOP_FILE_CACHE_H__ */
@@ -81,6 +81,53 @@ struct _ShellGlobal {
   gboolean has_modal;
   gboolean frame_timestamps;
   gboolean frame_finish_timestamp;
+
+  guint st_perf_counters_last_frame[ST_PERF_COUNTER_LAST];
+
+  GSource *main_loop_watchdog;
+  guint main_loop_watchdog_threshold;
+  guint slow_dispatches;
+  gint64 max_dispatch_time;
+  gint64 paint_start; /* When the stage update in progress started */
+  gint64 dispatch_paint_time; /* Time spent updating the stage, this iteration */
+
+  guint gc_count;
+  gint64 gc_time;
+};
+
+/* A source that is never dispatched, but whose prepare() and check()
+ * functions bracket the poll of every main loop iteration, so that the
+ * time from check() to the following prepare() is the time spent
+ * dispatching sources. The time the master clock spends updating and
+ * painting the stage, which has its own clutter.stagePaint* events, is
+ * subtracted, so what remains is mostly running JS callbacks.
+ */
+typedef struct {
+  GSource source;
+  ShellGlobal *global;
+  gint64 dispatch_start;
+} MainLoopWatchdogSource;
+
+/* Performance log names for the St counters, in StPerfCounter order.
+ * Each counter is exposed as a statistic with the running total and,
+ * when frame timestamps are enabled, as a per-frame event with the
+ * increase since the previous frame.
+ */
+static const struct {
+  const char *statistic;
+  const char *frame_event;
+  const char *description;
+} st_perf_counter_names[ST_PERF_COUNTER_LAST] = {
+  { "st.restyles", "st.frameRestyles",
+    "Number of widget restyles" },
+  { "st.themeNodesCreated", "st.frameThemeNodesCreated",
+    "Number of theme nodes created" },
+  { "st.themeNodeInternHits", "st.frameThemeNodeInternHits",
+    "Number of created theme nodes replaced by an interned node" },
+  { "st.sizeRequests", "st.frameSizeRequests",
+    "Number of size requests on St widgets" },
+  { "st.allocations", "st.frameAllocations",
+    "Number of allocations of St widgets" },
 };
 
 enum {
@@ -102,6 +149,7 @@ enum {
   PROP_FOCUS_MANAGER,
   PROP_FRAME_TIMESTAMPS,
   PROP_FRAME_FINISH_TIMESTAMP,
+  PROP_MAIN_LOOP_WATCHDOG_THRESHOLD,
 };
 
 /* Signals */
@@ -136,6 +184,9 @@ shell_global_set_property(GObject         *object,
     case PROP_FRAME_FINISH_TIMESTAMP:
       global->frame_finish_timestamp = g_value_get_boolean (value);
       break;
+    case PROP_MAIN_LOOP_WATCHDOG_THRESHOLD:
+      global->main_loop_watchdog_threshold = g_value_get_uint (value);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -210,6 +261,9 @@ shell_global_get_property(GObject         *object,
     case PROP_FRAME_FINISH_TIMESTAMP:
       g_value_set_boolean (value, global->frame_finish_timestamp);
       break;
+    case PROP_MAIN_LOOP_WATCHDOG_THRESHOLD:
+      g_value_set_uint (value, global->main_loop_watchdog_threshold);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -316,6 +370,12 @@ shell_global_finalize (GObject *object)
 {
   ShellGlobal *global = SHELL_GLOBAL (object);
 
+  if (global->main_loop_watchdog)
+    {
+      g_source_destroy (global->main_loop_watchdog);
+      g_source_unref (global->main_loop_watchdog);
+    }
+
   g_clear_object (&global->js_context);
   g_object_unref (global->settings);
 
@@ -477,6 +537,13 @@ shell_global_class_init (ShellGlobalClass *klass)
                                                          "Whether at the end of a frame to call glFinish and log paintCompletedTimestamp",
                                                          FALSE,
                                                          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class,
+                                   PROP_MAIN_LOOP_WATCHDOG_THRESHOLD,
+                                   g_param_spec_uint ("main-loop-watchdog-threshold",
+                                                      "Main loop watchdog threshold",
+                                                      "Main loop dispatches taking longer than this many milliseconds are logged in the performance log; 0 to disable",
+                                                      0, G_MAXUINT, 0,
+                                                      G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 }
 
 /*
@@ -734,6 +801,9 @@ global_stage_before_paint (gpointer data)
 {
   ShellGlobal *global = SHELL_GLOBAL (data);
 
+  if (global->main_loop_watchdog_threshold > 0)
+    global->paint_start = g_get_monotonic_time ();
+
   if (global->frame_timestamps)
     shell_perf_log_event (shell_perf_log_get_default (),
                           "clutter.stagePaintStart");
@@ -788,6 +858,26 @@ global_stage_after_paint (ClutterStage *stage,
     }
 }
 
+static void
+record_st_perf_counters (ShellGlobal *global)
+{
+  ShellPerfLog *perf_log = shell_perf_log_get_default ();
+  int i;
+
+  for (i = 0; i < ST_PERF_COUNTER_LAST; i++)
+    {
+      guint value = st_perf_counters_get (i);
+      guint delta = value - global->st_perf_counters_last_frame[i];
+
+      if (delta > 0)
+        shell_perf_log_event_i (perf_log,
+                                st_perf_counter_names[i].frame_event,
+                                delta);
+
+      global->st_perf_counters_last_frame[i] = value;
+    }
+}
+
 static gboolean
 global_stage_after_swap (gpointer data)
 {
@@ -795,13 +885,194 @@ global_stage_after_swap (gpointer data)
 
   ShellGlobal *global = SHELL_GLOBAL (data);
 
+  if (global->paint_start != 0)
+    {
+      global->dispatch_paint_time += g_get_monotonic_time () - global->paint_start;
+      global->paint_start = 0;
+    }
+
   if (global->frame_timestamps)
-    shell_perf_log_event (shell_perf_log_get_default (),
-                          "clutter.stagePaintDone");
+    {
+      if (st_perf_counters_get_enabled ())
+        record_st_perf_counters (global);
+
+      shell_perf_log_event (shell_perf_log_get_default (),
+                            "clutter.stagePaintDone");
+    }
 
   return TRUE;
 }
 
+static void
+st_perf_counters_statistics_callback (ShellPerfLog *perf_log,
+                                      gpointer      data)
+{
+  int i;
+
+  for (i = 0; i < ST_PERF_COUNTER_LAST; i++)
+    shell_perf_log_update_statistic_i (perf_log,
+                                       st_perf_counter_names[i].statistic,
+                                       st_perf_counters_get (i));
+}
+
+static void
+main_loop_dispatch_done (ShellGlobal *global,
+                         gint64       duration)
+{
+  if (duration < (gint64) global->main_loop_watchdog_threshold * 1000)
+    return;
+
+  global->slow_dispatches++;
+  global->max_dispatch_time = MAX (global->max_dispatch_time, duration);
+
+  shell_perf_log_event_x (shell_perf_log_get_default (),
+                          "mainloop.slowDispatch",
+                          duration);
+}
+
+static gboolean
+main_loop_watchdog_prepare (GSource *source,
+                            gint    *timeout)
+{
+  MainLoopWatchdogSource *watchdog = (MainLoopWatchdogSource *) source;
+
+  *timeout = -1;
+
+  if (watchdog->dispatch_start != 0)
+    {
+      gint64 duration = g_get_monotonic_time () - watchdog->dispatch_start;
+
+      /* Slow paints are logged as such, not as slow dispatches */
+      duration -= watchdog->global->dispatch_paint_time;
+      watchdog->global->dispatch_paint_time = 0;
+      watchdog->dispatch_start = 0;
+
+      if (watchdog->global->main_loop_watchdog_threshold > 0)
+        main_loop_dispatch_done (watchdog->global, duration);
+    }
+
+  return FALSE;
+}
+
+static gboolean
+main_loop_watchdog_check (GSource *source)
+{
+  MainLoopWatchdogSource *watchdog = (MainLoopWatchdogSource *) source;
+
+  watchdog->dispatch_start = g_get_monotonic_time ();
+  watchdog->global->dispatch_paint_time = 0;
+
+  return FALSE;
+}
+
+static GSourceFuncs main_loop_watchdog_funcs = {
+  main_loop_watchdog_prepare,
+  main_loop_watchdog_check,
+  NULL,
+  NULL
+};
+
+static void
+js_statistics_callback (ShellPerfLog *perf_log,
+                        gpointer      data)
+{
+  ShellGlobal *global = data;
+
+  shell_perf_log_update_statistic_i (perf_log,
+                                     "mainloop.slowDispatches",
+                                     global->slow_dispatches);
+  shell_perf_log_update_statistic_x (perf_log,
+                                     "mainloop.maxDispatchTime",
+                                     global->max_dispatch_time);
+  shell_perf_log_update_statistic_i (perf_log,
+                                     "gjs.gcCount",
+                                     global->gc_count);
+  shell_perf_log_update_statistic_x (perf_log,
+                                     "gjs.gcTime",
+                                     global->gc_time);
+
+  /* Report the longest dispatch per collection interval */
+  global->max_dispatch_time = 0;
+}
+
+static void
+define_js_perf_events (ShellGlobal *global)
+{
+  ShellPerfLog *perf_log = shell_perf_log_get_default ();
+  MainLoopWatchdogSource *watchdog;
+
+  shell_perf_log_define_event (perf_log,
+                               "mainloop.slowDispatch",
+                               "Main loop dispatch exceeding the watchdog threshold, not counting stage paints, in microseconds",
+                               "x");
+  shell_perf_log_define_event (perf_log,
+                               "gjs.gcStart",
+                               "Start of a JS garbage collection requested through shell_global_gc()",
+                               "");
+  shell_perf_log_define_event (perf_log,
+                               "gjs.gcDone",
+                               "End of a JS garbage collection requested through shell_global_gc(), with the resident size in bytes",
+                               "x");
+
+  shell_perf_log_define_statistic (perf_log,
+                                   "mainloop.slowDispatches",
+                                   "Number of main loop dispatches exceeding the watchdog threshold",
+                                   "i");
+  shell_perf_log_define_statistic (perf_log,
+                                   "mainloop.maxDispatchTime",
+                                   "Longest main loop dispatch exceeding the watchdog threshold since the last collection, in microseconds",
+                                   "x");
+  shell_perf_log_define_statistic (perf_log,
+                                   "gjs.gcCount",
+                                   "Number of JS garbage collections run through shell_global_gc()",
+                                   "i");
+  shell_perf_log_define_statistic (perf_log,
+                                   "gjs.gcTime",
+                                   "Total time spent in JS garbage collections run through shell_global_gc(), in microseconds",
+                                   "x");
+
+  shell_perf_log_add_statistics_callback (perf_log,
+                                          js_statistics_callback,
+                                          global, NULL);
+
+  global->main_loop_watchdog = g_source_new (&main_loop_watchdog_funcs,
+                                             sizeof (MainLoopWatchdogSource));
+  watchdog = (MainLoopWatchdogSource *) global->main_loop_watchdog;
+  watchdog->global = global;
+
+  /* Run before any other source so that prepare() and check() are
+   * called on every iteration, whichever sources are ready. */
+  g_source_set_priority (global->main_loop_watchdog, G_MININT);
+  g_source_set_name (global->main_loop_watchdog, "[gnome-shell] main loop watchdog");
+  g_source_attach (global->main_loop_watchdog, NULL);
+}
+
+static void
+define_st_perf_counters (ShellGlobal *global)
+{
+  ShellPerfLog *perf_log = shell_perf_log_get_default ();
+  int i;
+
+  if (!st_perf_counters_get_enabled ())
+    return;
+
+  for (i = 0; i < ST_PERF_COUNTER_LAST; i++)
+    {
+      shell_perf_log_define_statistic (perf_log,
+                                       st_perf_counter_names[i].statistic,
+                                       st_perf_counter_names[i].description,
+                                       "i");
+      shell_perf_log_define_event (perf_log,
+                                   st_perf_counter_names[i].frame_event,
+                                   st_perf_counter_names[i].description,
+                                   "i");
+    }
+
+  shell_perf_log_add_statistics_callback (perf_log,
+                                          st_perf_counters_statistics_callback,
+                                          global, NULL);
+}
+
 static void
 update_scaling_factor (ShellGlobal  *global,
                        MetaSettings *settings)
@@ -896,6 +1167,8 @@ _shell_global_set_plugin (ShellGlobal *global,
                                "clutter.stagePaintDone",
                                "End of frame, possibly including swap time",
                                "");
+  define_st_perf_counters (global);
+  define_js_perf_events (global);
 
   g_signal_connect (global->stage, "notify::key-focus",
                     G_CALLBACK (focus_actor_changed), global);
@@ -922,6 +1195,57 @@ _shell_global_get_gjs_context (ShellGlobal *global)
   return global->js_context;
 }
 
+static gint64
+get_resident_size (void)
+{
+  gint64 resident = 0;
+  char *contents;
+
+  /* The second field of statm is the resident set size, in pages */
+  if (g_file_get_contents ("/proc/self/statm", &contents, NULL, NULL))
+    {
+      char *p = strchr (contents, ' ');
+
+      if (p != NULL)
+        resident = g_ascii_strtoll (p + 1, NULL, 10) * sysconf (_SC_PAGESIZE);
+
+      g_free (contents);
+    }
+
+  return resident;
+}
+
+/**
+ * shell_global_gc:
+ * @global: A #ShellGlobal
+ *
+ * Runs a full JS garbage collection, like System.gc(), recording
+ * gjs.gcStart and gjs.gcDone events and the time it took in the
+ * performance log.
+ *
+ * Only collections requested through this function are recorded; GJS
+ * doesn't let us observe the collections SpiderMonkey runs on its own,
+ * which don't show up in the gjs.gc* events and statistics.
+ */
+void
+shell_global_gc (ShellGlobal *global)
+{
+  ShellPerfLog *perf_log = shell_perf_log_get_default ();
+  gint64 start;
+
+  g_return_if_fail (SHELL_IS_GLOBAL (global));
+
+  shell_perf_log_event (perf_log, "gjs.gcStart");
+  start = g_get_monotonic_time ();
+
+  gjs_context_gc (global->js_context);
+
+  global->gc_time += g_get_monotonic_time () - start;
+  global->gc_count++;
+
+  shell_perf_log_event_x (perf_log, "gjs.gcDone", get_resident_size ());
+}
+
 /**
  * shell_global_begin_modal:
  * @global: a #ShellGlobal
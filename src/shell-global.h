@@ -66,6 +66,8 @@ void shell_global_run_at_leisure (ShellGlobal          *global,
 /* Misc utilities / Shell API */
 void     shell_global_sync_pointer              (ShellGlobal  *global);
 
+void     shell_global_gc                        (ShellGlobal  *global);
+
 GAppLaunchContext *
          shell_global_create_app_launch_context (ShellGlobal  *global,
                                                  guint32       timestamp,
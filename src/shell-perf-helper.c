@@ -5,6 +5,12 @@
  * Running performance tests with whatever windows a user has open results
  * in unreliable results, so instead we hide all other windows and talk
  * to this program over D-Bus to create just the windows we want.
+ *
+ * Besides plain windows, the helper can generate controlled load: windows
+ * damaging a region of a given size at a fixed rate, rapid title and icon
+ * changes, bursts of notifications and bursts of window maps and unmaps.
+ * None of this needs anything but a display server and a session bus, so
+ * it works under Xvfb or in a nested session.
  */
 
 #include "config.h"
@@ -31,6 +37,28 @@ static const gchar introspection_xml[] =
 	  "      <arg type='b' name='maximized' direction='in'/>"
 	  "      <arg type='b' name='redraws' direction='in'/>"
 	  "    </method>"
+	  "    <method name='CreateDamageWindow'>"
+	  "      <arg type='i' name='width' direction='in'/>"
+	  "      <arg type='i' name='height' direction='in'/>"
+	  "      <arg type='u' name='rate' direction='in'/>"
+	  "      <arg type='i' name='damage_width' direction='in'/>"
+	  "      <arg type='i' name='damage_height' direction='in'/>"
+	  "    </method>"
+	  "    <method name='SetTitleChangeRate'>"
+	  "      <arg type='u' name='rate' direction='in'/>"
+	  "      <arg type='b' name='icons' direction='in'/>"
+	  "    </method>"
+	  "    <method name='SendNotifications'>"
+	  "      <arg type='u' name='count' direction='in'/>"
+	  "      <arg type='u' name='interval' direction='in'/>"
+	  "    </method>"
+	  "    <method name='MapUnmapWindows'>"
+	  "      <arg type='i' name='count' direction='in'/>"
+	  "      <arg type='i' name='width' direction='in'/>"
+	  "      <arg type='i' name='height' direction='in'/>"
+	  "      <arg type='u' name='cycles' direction='in'/>"
+	  "      <arg type='u' name='interval' direction='in'/>"
+	  "    </method>"
 	  "    <method name='WaitWindows'/>"
 	  "    <method name='DestroyWindows'/>"
 	  "  </interface>"
@@ -50,8 +78,29 @@ typedef struct {
 
   gint64 start_time;
   gint64 time;
+
+  /* For damage windows, the size of the area redrawn on each frame */
+  int damage_width;
+  int damage_height;
+  guint damage_frame;
+  guint damage_timeout_id;
 } WindowInfo;
 
+typedef struct {
+  GDBusMethodInvocation *invocation;
+  guint count;
+  guint remaining;
+  guint to_send;
+  guint timeout_id;
+} NotificationBurst;
+
+typedef struct {
+  GDBusMethodInvocation *invocation;
+  GList *windows;
+  guint remaining_toggles;
+  guint timeout_id;
+} MapUnmapBurst;
+
 static int opt_idle_timeout = 30;
 
 static GOptionEntry opt_entries[] =
@@ -70,6 +119,13 @@ static guint timeout_id;
 static GList *our_windows;
 static GList *wait_windows_invocations;
 
+static guint title_change_timeout_id;
+static gboolean title_change_icons;
+static guint title_change_count;
+static GdkPixbuf *title_change_pixbufs[2];
+
+static MapUnmapBurst *map_unmap_burst;
+
 static gboolean
 on_timeout (gpointer data)
 {
@@ -91,14 +147,38 @@ establish_timeout (void)
   g_source_set_name_by_id (timeout_id, "[gnome-shell] on_timeout");
 }
 
+static void
+finish_map_unmap_burst (void)
+{
+  MapUnmapBurst *burst = map_unmap_burst;
+
+  if (burst == NULL)
+    return;
+
+  map_unmap_burst = NULL;
+
+  if (burst->timeout_id != 0)
+    g_source_remove (burst->timeout_id);
+
+  g_dbus_method_invocation_return_value (burst->invocation, NULL);
+  g_list_free (burst->windows);
+  g_free (burst);
+}
+
 static void
 destroy_windows (void)
 {
   GList *l;
 
+  finish_map_unmap_burst ();
+
   for (l = our_windows; l; l = l->next)
     {
       WindowInfo *info = l->data;
+
+      if (info->damage_timeout_id != 0)
+        g_source_remove (info->damage_timeout_id);
+
       gtk_widget_destroy (info->window);
       g_free (info);
     }
@@ -156,6 +236,22 @@ on_window_draw (GtkWidget  *window,
       x_offset = y_offset = 0;
     }
 
+  if (info->damage_width > 0 && info->damage_height > 0)
+    {
+      /* Alternate the color of the damaged area so every frame
+       * actually changes its contents */
+      if (info->damage_frame % 2)
+        cairo_set_source_rgb (cr, 0, 0, 1);
+      else
+        cairo_set_source_rgb (cr, 0, 1, 0);
+
+      cairo_rectangle (cr,
+                       (allocation.width - info->damage_width) / 2,
+                       (allocation.height - info->damage_height) / 2,
+                       info->damage_width, info->damage_height);
+      cairo_fill (cr);
+    }
+
   cairo_set_source_rgb (cr, 1, 0, 0);
   cairo_set_line_width (cr, 10);
   cairo_move_to (cr, 0, 40 + y_offset);
@@ -196,7 +292,23 @@ tick_callback (GtkWidget     *widget,
   return TRUE;
 }
 
-static void
+static gboolean
+damage_timeout (gpointer data)
+{
+  WindowInfo *info = data;
+  int width = gtk_widget_get_allocated_width (info->window);
+  int height = gtk_widget_get_allocated_height (info->window);
+
+  info->damage_frame++;
+  gtk_widget_queue_draw_area (info->window,
+                              (width - info->damage_width) / 2,
+                              (height - info->damage_height) / 2,
+                              info->damage_width, info->damage_height);
+
+  return G_SOURCE_CONTINUE;
+}
+
+static WindowInfo *
 create_window (int      width,
 	       int      height,
                gboolean alpha,
@@ -230,6 +342,260 @@ create_window (int      width,
                                   info, NULL);
 
   our_windows = g_list_prepend (our_windows, info);
+
+  return info;
+}
+
+static void
+create_damage_window (int   width,
+                      int   height,
+                      guint rate,
+                      int   damage_width,
+                      int   damage_height)
+{
+  WindowInfo *info = create_window (width, height, FALSE, FALSE, FALSE);
+
+  info->damage_width = CLAMP (damage_width, 0, width);
+  info->damage_height = CLAMP (damage_height, 0, height);
+
+  if (rate > 0 && info->damage_width > 0 && info->damage_height > 0)
+    {
+      info->damage_timeout_id = g_timeout_add (MAX (1000 / rate, 1),
+                                               damage_timeout, info);
+      g_source_set_name_by_id (info->damage_timeout_id,
+                               "[gnome-shell] damage_timeout");
+    }
+}
+
+static GdkPixbuf *
+create_icon_pixbuf (guint32 color)
+{
+  GdkPixbuf *pixbuf = gdk_pixbuf_new (GDK_COLORSPACE_RGB, TRUE, 8, 48, 48);
+
+  gdk_pixbuf_fill (pixbuf, color);
+
+  return pixbuf;
+}
+
+static gboolean
+title_change_timeout (gpointer data)
+{
+  GList *l;
+
+  title_change_count++;
+
+  for (l = our_windows; l; l = l->next)
+    {
+      WindowInfo *info = l->data;
+      char *title = g_strdup_printf ("Performance test window %u",
+                                     title_change_count);
+
+      gtk_window_set_title (GTK_WINDOW (info->window), title);
+      g_free (title);
+
+      if (title_change_icons)
+        gtk_window_set_icon (GTK_WINDOW (info->window),
+                             title_change_pixbufs[title_change_count % 2]);
+    }
+
+  return G_SOURCE_CONTINUE;
+}
+
+static void
+set_title_change_rate (guint    rate,
+                       gboolean icons)
+{
+  if (title_change_timeout_id != 0)
+    {
+      g_source_remove (title_change_timeout_id);
+      title_change_timeout_id = 0;
+    }
+
+  title_change_icons = icons;
+
+  if (icons && title_change_pixbufs[0] == NULL)
+    {
+      title_change_pixbufs[0] = create_icon_pixbuf (0xff0000ff);
+      title_change_pixbufs[1] = create_icon_pixbuf (0x0000ffff);
+    }
+
+  if (rate == 0)
+    return;
+
+  title_change_timeout_id = g_timeout_add (MAX (1000 / rate, 1),
+                                           title_change_timeout, NULL);
+  g_source_set_name_by_id (title_change_timeout_id,
+                           "[gnome-shell] title_change_timeout");
+}
+
+static gboolean send_next_notification (gpointer data);
+
+static void
+on_notify_done (GObject      *source,
+                GAsyncResult *result,
+                gpointer      user_data)
+{
+  NotificationBurst *burst = user_data;
+  GError *error = NULL;
+  GVariant *ret;
+
+  ret = g_dbus_connection_call_finish (G_DBUS_CONNECTION (source), result, &error);
+  if (ret)
+    g_variant_unref (ret);
+  else
+    {
+      g_warning ("Sending notification failed: %s", error->message);
+      g_error_free (error);
+    }
+
+  if (--burst->remaining == 0)
+    {
+      g_dbus_method_invocation_return_value (burst->invocation, NULL);
+      g_free (burst);
+    }
+}
+
+static gboolean
+send_next_notification (gpointer data)
+{
+  NotificationBurst *burst = data;
+  GDBusConnection *connection;
+  guint index;
+
+  connection = g_dbus_method_invocation_get_connection (burst->invocation);
+
+  do
+    {
+      char *summary;
+
+      index = burst->count - burst->to_send;
+      summary = g_strdup_printf ("Performance test notification %u", index);
+
+      g_dbus_connection_call (connection,
+                              "org.freedesktop.Notifications",
+                              "/org/freedesktop/Notifications",
+                              "org.freedesktop.Notifications",
+                              "Notify",
+                              g_variant_new ("(susssasa{sv}i)",
+                                             "gnome-shell-perf-helper", 0, "",
+                                             summary,
+                                             "Body text of a performance test notification",
+                                             NULL, NULL, -1),
+                              G_VARIANT_TYPE ("(u)"),
+                              G_DBUS_CALL_FLAGS_NONE,
+                              -1, NULL,
+                              on_notify_done, burst);
+      g_free (summary);
+
+      burst->to_send--;
+    }
+  while (burst->to_send > 0 && burst->timeout_id == 0);
+
+  if (burst->to_send == 0)
+    {
+      burst->timeout_id = 0;
+      return G_SOURCE_REMOVE;
+    }
+
+  return G_SOURCE_CONTINUE;
+}
+
+static void
+send_notifications (GDBusMethodInvocation *invocation,
+                    guint                  count,
+                    guint                  interval)
+{
+  NotificationBurst *burst;
+
+  if (count == 0)
+    {
+      g_dbus_method_invocation_return_value (invocation, NULL);
+      return;
+    }
+
+  burst = g_new0 (NotificationBurst, 1);
+  burst->invocation = invocation;
+  burst->count = burst->remaining = burst->to_send = count;
+
+  /* With no interval, all notifications are sent at once */
+  if (interval == 0)
+    {
+      send_next_notification (burst);
+      return;
+    }
+
+  burst->timeout_id = g_timeout_add (interval, send_next_notification, burst);
+  g_source_set_name_by_id (burst->timeout_id, "[gnome-shell] send_next_notification");
+}
+
+static gboolean
+map_unmap_timeout (gpointer data)
+{
+  MapUnmapBurst *burst = data;
+  GList *l;
+
+  for (l = burst->windows; l; l = l->next)
+    {
+      WindowInfo *info = l->data;
+
+      gtk_widget_set_visible (info->window,
+                              !gtk_widget_get_visible (info->window));
+    }
+
+  if (--burst->remaining_toggles == 0)
+    {
+      burst->timeout_id = 0;
+      finish_map_unmap_burst ();
+      return G_SOURCE_REMOVE;
+    }
+
+  return G_SOURCE_CONTINUE;
+}
+
+static void
+map_unmap_windows (GDBusMethodInvocation *invocation,
+                   int                    count,
+                   int                    width,
+                   int                    height,
+                   guint                  cycles,
+                   guint                  interval)
+{
+  MapUnmapBurst *burst;
+  int i;
+
+  if (map_unmap_burst != NULL)
+    {
+      g_dbus_method_invocation_return_error (invocation,
+                                             G_IO_ERROR, G_IO_ERROR_BUSY,
+                                             "A map and unmap burst is already running");
+      return;
+    }
+
+  burst = g_new0 (MapUnmapBurst, 1);
+  burst->invocation = invocation;
+
+  for (i = 0; i < count; i++)
+    {
+      WindowInfo *info = create_window (width, height, FALSE, FALSE, FALSE);
+
+      /* These windows are mapped and unmapped repeatedly, so don't make
+       * WaitWindows wait for them */
+      info->pending = FALSE;
+      burst->windows = g_list_prepend (burst->windows, info);
+    }
+
+  map_unmap_burst = burst;
+
+  /* The windows start out mapped; each cycle unmaps and maps them again */
+  burst->remaining_toggles = 2 * cycles;
+  if (burst->remaining_toggles == 0 || burst->windows == NULL)
+    {
+      finish_map_unmap_burst ();
+      return;
+    }
+
+  burst->timeout_id = g_timeout_add (interval, map_unmap_timeout, burst);
+  g_source_set_name_by_id (burst->timeout_id, "[gnome-shell] map_unmap_timeout");
 }
 
 static void
@@ -293,6 +659,45 @@ handle_method_call (GDBusConnection       *connection,
       create_window (width, height, alpha, maximized, redraws);
       g_dbus_method_invocation_return_value (invocation, NULL);
     }
+  else if (g_strcmp0 (method_name, "CreateDamageWindow") == 0)
+    {
+      int width, height, damage_width, damage_height;
+      guint rate;
+
+      g_variant_get (parameters, "(iiuii)", &width, &height, &rate,
+                     &damage_width, &damage_height);
+
+      create_damage_window (width, height, rate, damage_width, damage_height);
+      g_dbus_method_invocation_return_value (invocation, NULL);
+    }
+  else if (g_strcmp0 (method_name, "SetTitleChangeRate") == 0)
+    {
+      guint rate;
+      gboolean icons;
+
+      g_variant_get (parameters, "(ub)", &rate, &icons);
+
+      set_title_change_rate (rate, icons);
+      g_dbus_method_invocation_return_value (invocation, NULL);
+    }
+  else if (g_strcmp0 (method_name, "SendNotifications") == 0)
+    {
+      guint count, interval;
+
+      g_variant_get (parameters, "(uu)", &count, &interval);
+
+      send_notifications (invocation, count, interval);
+    }
+  else if (g_strcmp0 (method_name, "MapUnmapWindows") == 0)
+    {
+      int count, width, height;
+      guint cycles, interval;
+
+      g_variant_get (parameters, "(iiiuu)", &count, &width, &height,
+                     &cycles, &interval);
+
+      map_unmap_windows (invocation, count, width, height, cycles, interval);
+    }
   else if (g_strcmp0 (method_name, "WaitWindows") == 0)
     {
       wait_windows_invocations = g_list_prepend (wait_windows_invocations, invocation);
@@ -300,6 +705,7 @@ handle_method_call (GDBusConnection       *connection,
     }
   else if (g_strcmp0 (method_name, "DestroyWindows") == 0)
     {
+      set_title_change_rate (0, FALSE);
       destroy_windows ();
       g_dbus_method_invocation_return_value (invocation, NULL);
     }
@@ -367,11 +773,16 @@ main (int argc, char **argv)
   display = gdk_display_get_default ();
   screen = gdk_screen_get_default ();
 
-  xdisplay = gdk_x11_display_get_xdisplay (display);
-  xroot = gdk_x11_window_get_xid (gdk_screen_get_root_window (screen));
-  atom_wm_state = gdk_x11_get_xatom_by_name_for_display (display, "WM_STATE");
-  atom__net_wm_name = gdk_x11_get_xatom_by_name_for_display (display, "_NET_WM_NAME");
-  atom_utf8_string = gdk_x11_get_xatom_by_name_for_display (display, "UTF8_STRING");
+  /* When running in a nested or headless Wayland session, we don't have
+   * an X display, but everything else works just the same */
+  if (GDK_IS_X11_DISPLAY (display))
+    {
+      xdisplay = gdk_x11_display_get_xdisplay (display);
+      xroot = gdk_x11_window_get_xid (gdk_screen_get_root_window (screen));
+      atom_wm_state = gdk_x11_get_xatom_by_name_for_display (display, "WM_STATE");
+      atom__net_wm_name = gdk_x11_get_xatom_by_name_for_display (display, "_NET_WM_NAME");
+      atom_utf8_string = gdk_x11_get_xatom_by_name_for_display (display, "UTF8_STRING");
+    }
 
   g_bus_own_name (G_BUS_TYPE_SESSION,
                   BUS_NAME,
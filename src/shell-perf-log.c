@@ -104,6 +104,34 @@ struct _ShellPerfBlock
   guchar buffer[BLOCK_SIZE];
 };
 
+/* Header of the binary log format written by shell_perf_log_dump_binary_async().
+ * The format mirrors the in-memory layout so that writing it is mostly
+ * a matter of copying the blocks out:
+ *
+ *  magic:       8 bytes, "GSPERFLG"
+ *  version:     guint32, BINARY_LOG_VERSION
+ *  n_events:    guint32
+ *  start_time:  gint64
+ *  n_events times:
+ *    id:          guint16
+ *    flags:       guint8, BINARY_EVENT_STATISTIC for statistics
+ *    name, description, signature: nul-terminated strings
+ *  until the end of the file:
+ *    bytes:       guint32
+ *    buffer:      bytes of recorded events, as in ShellPerfBlock
+ *
+ * Integers are in host byte order; readers can detect the byte order
+ * from the version field. The whole file may be gzip compressed.
+ */
+#define BINARY_LOG_MAGIC "GSPERFLG"
+#define BINARY_LOG_VERSION 1
+#define BINARY_EVENT_STATISTIC (1 << 0)
+
+/* Number of bytes of JSON to accumulate before writing it out in
+ * shell_perf_log_dump_log()
+ */
+#define JSON_FLUSH_SIZE 65536
+
 /* Number of milliseconds between periodic statistics collection when
  * events are enabled. Statistics collection can also be explicitly
  * triggered.
@@ -851,10 +879,27 @@ shell_perf_log_dump_events (ShellPerfLog   *perf_log,
 
 typedef struct {
   GOutputStream *out;
+  GString *buffer;
   GError *error;
   gboolean first;
 } ReplayToJsonClosure;
 
+static gboolean
+flush_json_buffer (ReplayToJsonClosure *closure)
+{
+  if (closure->buffer->len == 0)
+    return TRUE;
+
+  if (!g_output_stream_write_all (closure->out,
+                                  closure->buffer->str, closure->buffer->len,
+                                  NULL, NULL,
+                                  &closure->error))
+    return FALSE;
+
+  g_string_truncate (closure->buffer, 0);
+  return TRUE;
+}
+
 static void
 replay_to_json (gint64      time,
                 const char *name,
@@ -863,46 +908,43 @@ replay_to_json (gint64      time,
                 gpointer    user_data)
 {
   ReplayToJsonClosure *closure = user_data;
-  char *event_str;
+  GString *buffer = closure->buffer;
 
   if (closure->error != NULL)
     return;
 
   if (!closure->first)
-    {
-      if (!write_string (closure->out, ",\n  ", &closure->error))
-        return;
-    }
+    g_string_append (buffer, ",\n  ");
 
   closure->first = FALSE;
 
   if (strcmp (signature, "") == 0)
     {
-      event_str = g_strdup_printf ("[%" G_GINT64_FORMAT ", \"%s\"]", time, name);
+      g_string_append_printf (buffer, "[%" G_GINT64_FORMAT ", \"%s\"]", time, name);
     }
   else if (strcmp (signature, "i") == 0)
     {
-      event_str = g_strdup_printf ("[%" G_GINT64_FORMAT ", \"%s\", %i]",
-                                   time,
-                                   name,
-                                   g_value_get_int (arg));
+      g_string_append_printf (buffer, "[%" G_GINT64_FORMAT ", \"%s\", %i]",
+                              time,
+                              name,
+                              g_value_get_int (arg));
     }
   else if (strcmp (signature, "x") == 0)
     {
-      event_str = g_strdup_printf ("[%" G_GINT64_FORMAT ", \"%s\", %"G_GINT64_FORMAT "]",
-                                   time,
-                                   name,
-                                   g_value_get_int64 (arg));
+      g_string_append_printf (buffer, "[%" G_GINT64_FORMAT ", \"%s\", %"G_GINT64_FORMAT "]",
+                              time,
+                              name,
+                              g_value_get_int64 (arg));
     }
   else if (strcmp (signature, "s") == 0)
     {
       const char *arg_str = g_value_get_string (arg);
       char *escaped = escape_quotes (arg_str);
 
-      event_str = g_strdup_printf ("[%" G_GINT64_FORMAT ", \"%s\", \"%s\"]",
-                                   time,
-                                   name,
-                                   g_value_get_string (arg));
+      g_string_append_printf (buffer, "[%" G_GINT64_FORMAT ", \"%s\", \"%s\"]",
+                              time,
+                              name,
+                              escaped);
 
       if (escaped != arg_str)
         g_free (escaped);
@@ -912,8 +954,8 @@ replay_to_json (gint64      time,
       g_assert_not_reached ();
     }
 
-  if (!write_string (closure->out, event_str, &closure->error))
-      return;
+  if (buffer->len >= JSON_FLUSH_SIZE)
+    flush_json_buffer (closure);
 }
 
 /**
@@ -923,12 +965,13 @@ replay_to_json (gint64      time,
  * @error: location to store #GError, or %NULL
  *
  * Writes the performance event log, formatted as JSON, to the specified
- * output stream. For performance reasons, the output stream passed
- * in should generally be a buffered (or memory) output stream, since
- * it will be written to in small pieces. The JSON output is an array
- * with the elements of the array also being arrays, of the form
+ * output stream. The JSON output is an array with the elements of the
+ * array also being arrays, of the form
  * '[' <time>, <event name> [, <event_arg>... ] ']'.
  *
+ * This formats the whole log on the calling thread; for long logs
+ * consider shell_perf_log_dump_binary_async() instead.
+ *
  * Return value: %TRUE if the dump succeeded. %FALSE if an IO error occurred
  */
 gboolean
@@ -939,22 +982,220 @@ shell_perf_log_dump_log (ShellPerfLog   *perf_log,
   ReplayToJsonClosure closure;
 
   closure.out = out;
+  closure.buffer = g_string_sized_new (JSON_FLUSH_SIZE);
   closure.error = NULL;
   closure.first = TRUE;
 
-  if (!write_string (out, "[ ", &closure.error))
-    return FALSE;
+  g_string_append (closure.buffer, "[ ");
 
   shell_perf_log_replay (perf_log, replay_to_json, &closure);
 
+  if (closure.error == NULL)
+    {
+      g_string_append (closure.buffer, " ]");
+      flush_json_buffer (&closure);
+    }
+
+  g_string_free (closure.buffer, TRUE);
+
   if (closure.error != NULL)
     {
       g_propagate_error (error, closure.error);
       return FALSE;
     }
 
-  if (!write_string (out, " ]", &closure.error))
-    return FALSE;
-
   return TRUE;
 }
+
+typedef struct {
+  GBytes *header;
+  GPtrArray *blocks;
+  guint32 last_block_bytes;
+  GOutputStream *out;
+  gboolean compress;
+} DumpBinaryData;
+
+static void
+dump_binary_data_free (DumpBinaryData *data)
+{
+  g_bytes_unref (data->header);
+  g_ptr_array_unref (data->blocks);
+  g_object_unref (data->out);
+  g_free (data);
+}
+
+static GBytes *
+serialize_binary_header (ShellPerfLog *perf_log)
+{
+  GByteArray *header = g_byte_array_new ();
+  guint32 version = BINARY_LOG_VERSION;
+  guint32 n_events = perf_log->events->len;
+  guint i;
+
+  g_byte_array_append (header, (const guint8 *)BINARY_LOG_MAGIC, 8);
+  g_byte_array_append (header, (const guint8 *)&version, sizeof (guint32));
+  g_byte_array_append (header, (const guint8 *)&n_events, sizeof (guint32));
+  g_byte_array_append (header, (const guint8 *)&perf_log->start_time, sizeof (gint64));
+
+  for (i = 0; i < perf_log->events->len; i++)
+    {
+      ShellPerfEvent *event = g_ptr_array_index (perf_log->events, i);
+      guint8 flags = 0;
+
+      if (g_hash_table_lookup (perf_log->statistics_by_name, event->name) != NULL)
+        flags |= BINARY_EVENT_STATISTIC;
+
+      g_byte_array_append (header, (const guint8 *)&event->id, sizeof (guint16));
+      g_byte_array_append (header, &flags, sizeof (guint8));
+      g_byte_array_append (header, (const guint8 *)event->name,
+                           strlen (event->name) + 1);
+      g_byte_array_append (header, (const guint8 *)event->description,
+                           strlen (event->description) + 1);
+      g_byte_array_append (header, (const guint8 *)event->signature,
+                           strlen (event->signature) + 1);
+    }
+
+  return g_byte_array_free_to_bytes (header);
+}
+
+static void
+dump_binary_thread (GTask        *task,
+                    gpointer      object,
+                    gpointer      task_data,
+                    GCancellable *cancellable)
+{
+  DumpBinaryData *data = task_data;
+  GOutputStream *out;
+  GError *error = NULL;
+  guint i;
+
+  if (data->compress)
+    {
+      GZlibCompressor *compressor;
+
+      compressor = g_zlib_compressor_new (G_ZLIB_COMPRESSOR_FORMAT_GZIP, -1);
+      out = g_converter_output_stream_new (data->out, G_CONVERTER (compressor));
+      g_filter_output_stream_set_close_base_stream (G_FILTER_OUTPUT_STREAM (out),
+                                                    FALSE);
+      g_object_unref (compressor);
+    }
+  else
+    {
+      out = g_object_ref (data->out);
+    }
+
+  if (!g_output_stream_write_all (out,
+                                  g_bytes_get_data (data->header, NULL),
+                                  g_bytes_get_size (data->header),
+                                  NULL, cancellable, &error))
+    goto out;
+
+  for (i = 0; i < data->blocks->len; i++)
+    {
+      ShellPerfBlock *block = g_ptr_array_index (data->blocks, i);
+      guint32 bytes;
+
+      /* The last block may still be appended to by the main thread;
+       * only write what was there when the dump was started.
+       */
+      if (i == data->blocks->len - 1)
+        bytes = data->last_block_bytes;
+      else
+        bytes = block->bytes;
+
+      if (!g_output_stream_write_all (out, &bytes, sizeof (guint32),
+                                      NULL, cancellable, &error) ||
+          !g_output_stream_write_all (out, block->buffer, bytes,
+                                      NULL, cancellable, &error))
+        goto out;
+    }
+
+  if (data->compress)
+    g_output_stream_close (out, cancellable, &error);
+  else
+    g_output_stream_flush (out, cancellable, &error);
+
+ out:
+  g_object_unref (out);
+
+  if (error != NULL)
+    g_task_return_error (task, error);
+  else
+    g_task_return_boolean (task, TRUE);
+}
+
+/**
+ * shell_perf_log_dump_binary_async:
+ * @perf_log: a #ShellPerfLog
+ * @out: output stream into which to write the log
+ * @compress: whether to gzip compress the output
+ * @cancellable: (nullable): a #GCancellable
+ * @callback: (scope async): function to call when the dump is complete
+ * @user_data: data to pass to @callback
+ *
+ * Writes the event definitions and the event log in a compact binary
+ * format that mirrors the in-memory representation of the log. Only a
+ * snapshot of the log is taken on the calling thread; formatting,
+ * compression and writing happen in a worker thread. Events recorded
+ * after this call are not included in the dump.
+ *
+ * The result can be converted to the JSON format of
+ * shell_perf_log_dump_events() and shell_perf_log_dump_log() with
+ * the gnome-shell-perf-log-to-json tool.
+ */
+void
+shell_perf_log_dump_binary_async (ShellPerfLog        *perf_log,
+                                  GOutputStream       *out,
+                                  gboolean             compress,
+                                  GCancellable        *cancellable,
+                                  GAsyncReadyCallback  callback,
+                                  gpointer             user_data)
+{
+  DumpBinaryData *data;
+  GTask *task;
+  GList *iter;
+
+  g_return_if_fail (SHELL_IS_PERF_LOG (perf_log));
+  g_return_if_fail (G_IS_OUTPUT_STREAM (out));
+
+  data = g_new0 (DumpBinaryData, 1);
+  data->header = serialize_binary_header (perf_log);
+  data->out = g_object_ref (out);
+  data->compress = compress != FALSE;
+
+  /* Blocks are never freed and are only ever appended to, so it is
+   * enough to remember them and the fill level of the last one.
+   */
+  data->blocks = g_ptr_array_sized_new (g_queue_get_length (perf_log->blocks));
+  for (iter = perf_log->blocks->head; iter; iter = iter->next)
+    g_ptr_array_add (data->blocks, iter->data);
+
+  if (perf_log->blocks->tail != NULL)
+    data->last_block_bytes = ((ShellPerfBlock *)perf_log->blocks->tail->data)->bytes;
+
+  task = g_task_new (perf_log, cancellable, callback, user_data);
+  g_task_set_source_tag (task, shell_perf_log_dump_binary_async);
+  g_task_set_task_data (task, data, (GDestroyNotify) dump_binary_data_free);
+  g_task_run_in_thread (task, dump_binary_thread);
+  g_object_unref (task);
+}
+
+/**
+ * shell_perf_log_dump_binary_finish:
+ * @perf_log: a #ShellPerfLog
+ * @result: the #GAsyncResult passed to the callback
+ * @error: location to store #GError, or %NULL
+ *
+ * Finishes a dump started with shell_perf_log_dump_binary_async().
+ *
+ * Return value: %TRUE if the dump succeeded. %FALSE if an IO error occurred
+ */
+gboolean
+shell_perf_log_dump_binary_finish (ShellPerfLog  *perf_log,
+                                   GAsyncResult  *result,
+                                   GError       **error)
+{
+  g_return_val_if_fail (g_task_is_valid (result, perf_log), FALSE);
+
+  return g_task_propagate_boolean (G_TASK (result), error);
+}
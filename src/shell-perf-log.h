@@ -70,6 +70,16 @@ gboolean shell_perf_log_dump_log    (ShellPerfLog   *perf_log,
                                      GOutputStream  *out,
                                      GError        **error);
 
+void     shell_perf_log_dump_binary_async  (ShellPerfLog        *perf_log,
+                                            GOutputStream       *out,
+                                            gboolean             compress,
+                                            GCancellable        *cancellable,
+                                            GAsyncReadyCallback  callback,
+                                            gpointer             user_data);
+gboolean shell_perf_log_dump_binary_finish (ShellPerfLog        *perf_log,
+                                            GAsyncResult        *result,
+                                            GError             **error);
+
 G_END_DECLS
 
 #endif /* __SHELL_PERF_LOG_H__ */
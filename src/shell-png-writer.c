@@ -0,0 +1,495 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "shell-png-writer.h"
+
+/*
+ * A PNG encoder that works directly on cairo image surfaces, without
+ * first converting all of the image to a #GdkPixbuf. Rows are
+ * unpremultiplied and filtered in bands, with the rows of a band split
+ * over several threads, and each band is compressed before the next
+ * one is converted, so only a band of converted rows is kept in memory.
+ *
+ * The image is always written as 8-bit RGBA.
+ */
+
+/* Rows converted by one thread at a time */
+#define ROWS_PER_TASK 32
+
+/* Size of the compressed data in each IDAT chunk */
+#define IDAT_SIZE (64 * 1024)
+
+enum {
+  FILTER_NONE = 0,
+  FILTER_SUB = 1,
+  FILTER_UP = 2
+};
+
+typedef struct {
+  GOutputStream *stream;
+  GCancellable *cancellable;
+  GConverter *compressor;
+
+  guint8 idat[IDAT_SIZE];
+  gsize idat_len;
+} PngWriter;
+
+typedef struct _FilterBand FilterBand;
+
+typedef struct {
+  FilterBand *band;
+  int first_row;
+  int n_rows;
+  guint8 *out;
+} FilterTask;
+
+struct _FilterBand {
+  cairo_surface_t *image;
+
+  GMutex mutex;
+  GCond cond;
+  int n_pending;
+};
+
+static guint32 crc_table[256];
+
+static void
+init_crc_table (void)
+{
+  static gsize initialized = 0;
+
+  if (g_once_init_enter (&initialized))
+    {
+      guint32 n, k, c;
+
+      for (n = 0; n < 256; n++)
+        {
+          c = n;
+          for (k = 0; k < 8; k++)
+            c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+          crc_table[n] = c;
+        }
+
+      g_once_init_leave (&initialized, 1);
+    }
+}
+
+static guint32
+update_crc (guint32       crc,
+            const guint8 *data,
+            gsize         len)
+{
+  gsize i;
+
+  for (i = 0; i < len; i++)
+    crc = crc_table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+
+  return crc;
+}
+
+static gboolean
+write_chunk (PngWriter     *writer,
+             const char    *type,
+             const guint8  *data,
+             gsize          len,
+             GError       **error)
+{
+  guint32 length_be = GUINT32_TO_BE (len);
+  guint32 crc, crc_be;
+
+  crc = update_crc (0xffffffff, (const guint8 *) type, 4);
+  crc = update_crc (crc, data, len);
+  crc_be = GUINT32_TO_BE (crc ^ 0xffffffff);
+
+  return (g_output_stream_write_all (writer->stream, &length_be, 4, NULL,
+                                     writer->cancellable, error) &&
+          g_output_stream_write_all (writer->stream, type, 4, NULL,
+                                     writer->cancellable, error) &&
+          (len == 0 ||
+           g_output_stream_write_all (writer->stream, data, len, NULL,
+                                      writer->cancellable, error)) &&
+          g_output_stream_write_all (writer->stream, &crc_be, 4, NULL,
+                                     writer->cancellable, error));
+}
+
+static gboolean
+write_header (PngWriter  *writer,
+              int         width,
+              int         height,
+              GError    **error)
+{
+  static const guint8 signature[8] = { 137, 'P', 'N', 'G', '\r', '\n', 26, '\n' };
+  guint8 ihdr[13];
+  guint32 value;
+
+  if (!g_output_stream_write_all (writer->stream, signature, sizeof (signature),
+                                  NULL, writer->cancellable, error))
+    return FALSE;
+
+  value = GUINT32_TO_BE (width);
+  memcpy (ihdr, &value, 4);
+  value = GUINT32_TO_BE (height);
+  memcpy (ihdr + 4, &value, 4);
+  ihdr[8] = 8; /* bit depth */
+  ihdr[9] = 6; /* color type: RGBA */
+  ihdr[10] = 0; /* compression method */
+  ihdr[11] = 0; /* filter method */
+  ihdr[12] = 0; /* interlace method */
+
+  return write_chunk (writer, "IHDR", ihdr, sizeof (ihdr), error);
+}
+
+/* tEXt chunks can only hold Latin-1, anything else goes into
+ * an uncompressed iTXt chunk */
+static gboolean
+write_text (PngWriter   *writer,
+            const char  *key,
+            const char  *value,
+            GError     **error)
+{
+  GByteArray *chunk;
+  const char *type;
+  char *latin1;
+  gboolean success;
+
+  chunk = g_byte_array_new ();
+  g_byte_array_append (chunk, (const guint8 *) key, strlen (key) + 1);
+
+  latin1 = g_convert (value, -1, "ISO-8859-1", "UTF-8", NULL, NULL, NULL);
+  if (latin1 != NULL)
+    {
+      type = "tEXt";
+      g_byte_array_append (chunk, (const guint8 *) latin1, strlen (latin1));
+    }
+  else
+    {
+      /* No compression, no language tag and no translated keyword */
+      static const guint8 itxt_header[4] = { 0, 0, 0, 0 };
+
+      type = "iTXt";
+      g_byte_array_append (chunk, itxt_header, sizeof (itxt_header));
+      g_byte_array_append (chunk, (const guint8 *) value, strlen (value));
+    }
+
+  success = write_chunk (writer, type, chunk->data, chunk->len, error);
+
+  g_free (latin1);
+  g_byte_array_unref (chunk);
+
+  return success;
+}
+
+/* Feeds @len bytes of filtered rows to the compressor, writing IDAT
+ * chunks whenever there is enough compressed data. If @last is %TRUE,
+ * the compressed stream is finished and the remaining data written.
+ */
+static gboolean
+compress_rows (PngWriter     *writer,
+               const guint8  *data,
+               gsize          len,
+               gboolean       last,
+               GError       **error)
+{
+  GConverterResult result = G_CONVERTER_CONVERTED;
+
+  while (len > 0 || (last && result != G_CONVERTER_FINISHED))
+    {
+      gsize bytes_read, bytes_written;
+
+      result = g_converter_convert (writer->compressor,
+                                    data, len,
+                                    writer->idat + writer->idat_len,
+                                    IDAT_SIZE - writer->idat_len,
+                                    last ? G_CONVERTER_INPUT_AT_END : G_CONVERTER_NO_FLAGS,
+                                    &bytes_read, &bytes_written,
+                                    error);
+      if (result == G_CONVERTER_ERROR)
+        return FALSE;
+
+      data += bytes_read;
+      len -= bytes_read;
+      writer->idat_len += bytes_written;
+
+      if (writer->idat_len == IDAT_SIZE ||
+          (result == G_CONVERTER_FINISHED && writer->idat_len > 0))
+        {
+          if (!write_chunk (writer, "IDAT", writer->idat, writer->idat_len, error))
+            return FALSE;
+
+          writer->idat_len = 0;
+        }
+    }
+
+  return TRUE;
+}
+
+static inline guint8
+unpremultiply (guint32 value,
+               guint32 alpha)
+{
+  return MIN ((value * 255 + alpha / 2) / alpha, 255);
+}
+
+static void
+convert_row (cairo_surface_t *image,
+             int              row,
+             guint8          *out)
+{
+  cairo_format_t format = cairo_image_surface_get_format (image);
+  int width = cairo_image_surface_get_width (image);
+  const guint32 *pixels;
+  int i;
+
+  pixels = (const guint32 *) (cairo_image_surface_get_data (image) +
+                              row * cairo_image_surface_get_stride (image));
+
+  for (i = 0; i < width; i++)
+    {
+      guint32 pixel = pixels[i];
+      guint32 alpha = format == CAIRO_FORMAT_ARGB32 ? pixel >> 24 : 0xff;
+      guint8 *rgba = out + i * 4;
+
+      if (alpha == 0)
+        {
+          rgba[0] = rgba[1] = rgba[2] = rgba[3] = 0;
+        }
+      else if (alpha == 0xff)
+        {
+          rgba[0] = (pixel >> 16) & 0xff;
+          rgba[1] = (pixel >> 8) & 0xff;
+          rgba[2] = pixel & 0xff;
+          rgba[3] = 0xff;
+        }
+      else
+        {
+          rgba[0] = unpremultiply ((pixel >> 16) & 0xff, alpha);
+          rgba[1] = unpremultiply ((pixel >> 8) & 0xff, alpha);
+          rgba[2] = unpremultiply (pixel & 0xff, alpha);
+          rgba[3] = alpha;
+        }
+    }
+}
+
+/* Filters @row with the Sub and Up filters and writes the one likely
+ * to compress better, by the usual minimum sum of absolute
+ * differences heuristic, to @out. */
+static void
+filter_row (const guint8 *row,
+            const guint8 *prev_row,
+            gsize         len,
+            guint8       *sub,
+            guint8       *out)
+{
+  guint32 sum_sub = 0, sum_up = 0;
+  gsize i;
+
+  for (i = 0; i < len; i++)
+    {
+      guint8 left = i >= 4 ? row[i - 4] : 0;
+      guint8 up = prev_row ? prev_row[i] : 0;
+
+      sub[i] = row[i] - left;
+      out[i + 1] = row[i] - up;
+
+      sum_sub += abs ((gint8) sub[i]);
+      sum_up += abs ((gint8) out[i + 1]);
+    }
+
+  if (prev_row == NULL || sum_sub < sum_up)
+    {
+      out[0] = FILTER_SUB;
+      memcpy (out + 1, sub, len);
+    }
+  else
+    {
+      out[0] = FILTER_UP;
+    }
+}
+
+static void
+filter_rows (FilterBand *band,
+             int         first_row,
+             int         n_rows,
+             guint8     *out)
+{
+  int width = cairo_image_surface_get_width (band->image);
+  gsize len = width * 4;
+  guint8 *row, *prev_row, *sub;
+  int i;
+
+  row = g_malloc (len);
+  prev_row = g_malloc (len);
+  sub = g_malloc (len);
+
+  if (first_row > 0)
+    convert_row (band->image, first_row - 1, prev_row);
+
+  for (i = 0; i < n_rows; i++)
+    {
+      guint8 *tmp;
+
+      convert_row (band->image, first_row + i, row);
+      filter_row (row,
+                  first_row + i > 0 ? prev_row : NULL,
+                  len, sub,
+                  out + i * (len + 1));
+
+      tmp = prev_row;
+      prev_row = row;
+      row = tmp;
+    }
+
+  g_free (row);
+  g_free (prev_row);
+  g_free (sub);
+}
+
+static void
+filter_task_run (gpointer data,
+                 gpointer user_data)
+{
+  FilterTask *task = data;
+  FilterBand *band = task->band;
+
+  filter_rows (band, task->first_row, task->n_rows, task->out);
+
+  g_mutex_lock (&band->mutex);
+  if (--band->n_pending == 0)
+    g_cond_signal (&band->cond);
+  g_mutex_unlock (&band->mutex);
+
+  g_free (task);
+}
+
+/*
+ * _shell_png_writer_write:
+ * @image: the image to write
+ * @stream: where to write the image to
+ * @compression_level: the zlib compression level, from 0 to 9, or -1
+ *   for the default
+ * @text: (nullable): %NULL-terminated key/value pairs to store as text
+ *   metadata
+ * @cancellable: (nullable): a #GCancellable
+ * @error: return location for a #GError
+ *
+ * Writes @image, which must be an %CAIRO_FORMAT_ARGB32 or
+ * %CAIRO_FORMAT_RGB24 image surface, to @stream as PNG.
+ *
+ * Returns: whether the image was written
+ */
+gboolean
+_shell_png_writer_write (cairo_surface_t     *image,
+                         GOutputStream       *stream,
+                         int                  compression_level,
+                         const char * const  *text,
+                         GCancellable        *cancellable,
+                         GError             **error)
+{
+  PngWriter *writer;
+  FilterBand band;
+  GThreadPool *pool = NULL;
+  guint8 *rows;
+  gsize row_len;
+  int width, height;
+  int n_threads, band_rows;
+  int row;
+  gboolean success = FALSE;
+
+  g_return_val_if_fail (cairo_image_surface_get_format (image) == CAIRO_FORMAT_ARGB32 ||
+                        cairo_image_surface_get_format (image) == CAIRO_FORMAT_RGB24,
+                        FALSE);
+
+  init_crc_table ();
+
+  width = cairo_image_surface_get_width (image);
+  height = cairo_image_surface_get_height (image);
+  row_len = 1 + width * 4;
+
+  cairo_surface_flush (image);
+
+  writer = g_new0 (PngWriter, 1);
+  writer->stream = stream;
+  writer->cancellable = cancellable;
+  writer->compressor = G_CONVERTER (g_zlib_compressor_new (G_ZLIB_COMPRESSOR_FORMAT_ZLIB,
+                                                           CLAMP (compression_level, -1, 9)));
+
+  band.image = image;
+  g_mutex_init (&band.mutex);
+  g_cond_init (&band.cond);
+
+  n_threads = MAX (1, MIN (g_get_num_processors (),
+                           (height + ROWS_PER_TASK - 1) / ROWS_PER_TASK));
+  band_rows = n_threads * ROWS_PER_TASK;
+  rows = g_malloc (band_rows * row_len);
+
+  if (n_threads > 1)
+    pool = g_thread_pool_new (filter_task_run, NULL, n_threads, FALSE, NULL);
+
+  if (!write_header (writer, width, height, error))
+    goto out;
+
+  for (; text != NULL && text[0] != NULL && text[1] != NULL; text += 2)
+    {
+      if (!write_text (writer, text[0], text[1], error))
+        goto out;
+    }
+
+  for (row = 0; row < height; row += band_rows)
+    {
+      int n_rows = MIN (band_rows, height - row);
+
+      if (pool != NULL)
+        {
+          int i;
+
+          band.n_pending = (n_rows + ROWS_PER_TASK - 1) / ROWS_PER_TASK;
+
+          for (i = 0; i < n_rows; i += ROWS_PER_TASK)
+            {
+              FilterTask *task = g_new0 (FilterTask, 1);
+
+              task->band = &band;
+              task->first_row = row + i;
+              task->n_rows = MIN (ROWS_PER_TASK, n_rows - i);
+              task->out = rows + i * row_len;
+
+              g_thread_pool_push (pool, task, NULL);
+            }
+
+          g_mutex_lock (&band.mutex);
+          while (band.n_pending > 0)
+            g_cond_wait (&band.cond, &band.mutex);
+          g_mutex_unlock (&band.mutex);
+        }
+      else
+        {
+          filter_rows (&band, row, n_rows, rows);
+        }
+
+      if (!compress_rows (writer, rows, n_rows * row_len,
+                          row + n_rows == height, error))
+        goto out;
+    }
+
+  if (height == 0 && !compress_rows (writer, NULL, 0, TRUE, error))
+    goto out;
+
+  success = write_chunk (writer, "IEND", NULL, 0, error);
+
+ out:
+  if (pool != NULL)
+    g_thread_pool_free (pool, FALSE, TRUE);
+
+  g_mutex_clear (&band.mutex);
+  g_cond_clear (&band.cond);
+
+  g_free (rows);
+  g_object_unref (writer->compressor);
+  g_free (writer);
+
+  return success;
+}
@@ -0,0 +1,19 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+#ifndef __SHELL_PNG_WRITER_H__
+#define __SHELL_PNG_WRITER_H__
+
+#include <gio/gio.h>
+#include <cairo.h>
+
+G_BEGIN_DECLS
+
+gboolean _shell_png_writer_write (cairo_surface_t     *image,
+                                  GOutputStream       *stream,
+                                  int                  compression_level,
+                                  const char * const  *text,
+                                  GCancellable        *cancellable,
+                                  GError             **error);
+
+G_END_DECLS
+
+#endif /* __SHELL_PNG_WRITER_H__ */
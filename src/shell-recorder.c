@@ -7,6 +7,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/stat.h>
 
 #define GST_USE_UNSTABLE_API
 #include <gst/gst.h>
@@ -19,10 +20,13 @@
 #include <meta/compositor-mutter.h>
 #include <st/st.h>
 
+#include "shell-cursor-cache.h"
 #include "shell-global.h"
+#include "shell-perf-log.h"
 #include "shell-recorder-src.h"
 #include "shell-recorder.h"
-#include "shell-util.h"
+#include "shell-stage-readback.h"
+#include "shell-util-private.h"
 
 typedef enum {
   RECORDER_STATE_CLOSED,
@@ -30,6 +34,7 @@ typedef enum {
 } RecorderState;
 
 typedef struct _RecorderPipeline RecorderPipeline;
+typedef struct _RecorderJob RecorderJob;
 
 struct _ShellRecorder {
   GObject parent;
@@ -58,10 +63,6 @@ struct _ShellRecorder {
 
   gboolean draw_cursor;
   MetaCursorTracker *cursor_tracker;
-  cairo_surface_t *cursor_image;
-  guint8 *cursor_memory;
-  int cursor_hot_x;
-  int cursor_hot_y;
 
   int framerate;
   char *pipeline_description;
@@ -73,14 +74,48 @@ struct _ShellRecorder {
   RecorderPipeline *current_pipeline; /* current pipeline */
   GSList *pipelines; /* all pipelines */
 
+  /* When the current pipeline has recorded this long or written this
+   * much, the recording continues in a new pipeline and file, while the
+   * old one finishes in the background. 0 means no limit.
+   */
+  guint segment_duration; /* In seconds */
+  guint64 segment_size; /* In bytes */
+  guint segment; /* The number of the current segment, from 0 */
+
   GstClockTime last_frame_time; /* Timestamp for the last frame */
 
+  /* The contents of the recording area without the cursor, as of the
+   * last stage paint. Only the parts the stage redraws are captured
+   * again, and frames are only pushed when something changed.
+   *
+   * Assembling the frame from the captures and copying it into buffers
+   * for the pipeline is done by frame_worker, so all the compositor
+   * thread does is reading back what the stage redrew. Only the worker
+   * touches frame; have_frame is whether it will have one once it is
+   * done with the jobs queued so far.
+   */
+  GThreadPool *frame_worker;
+  cairo_surface_t *frame;
+  gboolean have_frame;
+  gboolean frame_dirty; /* Frame or cursor changed since the last push */
+
+  /* Where possible, what the stage redrew is read back asynchronously,
+   * and only mapped once the GPU is done with it: when its fence
+   * signals, when the stage is painted again, or, if neither happens,
+   * after READBACK_TIMEOUT. readback_job is the job to queue with the
+   * captured pixels.
+   */
+  ShellStageReadback *readback;
+  RecorderJob *readback_job;
+
   /* GSource IDs for different timeouts and idles */
-  guint redraw_timeout;
-  guint redraw_idle;
+  guint pause_timeout;
+  guint push_frame_timeout;
+  guint frame_idle;
+  guint readback_timeout;
   guint update_memory_used_timeout;
   guint update_pointer_timeout;
-  guint repaint_hook_id;
+  guint update_encoder_timeout;
 };
 
 struct _RecorderPipeline
@@ -88,8 +123,69 @@ struct _RecorderPipeline
   ShellRecorder *recorder;
   GstElement *pipeline;
   GstElement *src;
+  GstBufferPool *pool;
   int outfile;
   char *filename;
+
+  /* The element after the source, normally the encoder */
+  GstElement *encoder;
+
+  /* Statistics of the recording. frames_captured and frames_dropped
+   * are only touched by the main thread; frames_encoded and latency
+   * are updated from the streaming thread of the encoder, under
+   * stats_lock.
+   */
+  GMutex stats_lock;
+  guint frames_captured;
+  guint frames_dropped;
+  guint frames_encoded;
+  GstClockTime latency; /* Smoothed time from pushing to encoding a frame */
+
+  /* If the encoder settings are ours, the index into encoder_presets
+   * we're using, see recorder_update_encoder() */
+  gboolean adaptive;
+  gboolean is_fallback; /* Created from FALLBACK_PIPELINE */
+  guint encoder_preset;
+  guint last_frames_dropped;
+  guint n_good_checks;
+
+  /* Whether the frame waiting to be pushed was already counted in
+   * frames_dropped */
+  gboolean frame_delayed;
+};
+
+typedef enum {
+  RECORDER_JOB_CAPTURE,
+  RECORDER_JOB_PUSH,
+  RECORDER_JOB_CLOSE
+} RecorderJobType;
+
+/* Work queued for the frame worker of a recorder */
+struct _RecorderJob
+{
+  RecorderJobType type;
+
+  /* The geometry of the frame when the job was queued */
+  cairo_rectangle_int_t area;
+  int width;
+  int height;
+  float scale;
+
+  /* RECORDER_JOB_CAPTURE: what to paint into the frame */
+  gboolean new_frame;
+  ClutterCapture *captures;
+  int n_captures;
+
+  /* RECORDER_JOB_PUSH: the buffer to copy the frame into and where to
+   * push it, and the cursor to draw on top, if any, at the scale of the
+   * frame and its position in pixels.
+   * RECORDER_JOB_CLOSE: the source to end once the buffers pushed
+   * before were queued */
+  GstElement *src;
+  GstBuffer *buffer;
+  cairo_surface_t *cursor_image;
+  int cursor_x;
+  int cursor_y;
 };
 
 static void recorder_set_stage    (ShellRecorder *recorder,
@@ -106,7 +202,10 @@ static void recorder_set_draw_cursor (ShellRecorder *recorder,
 static void recorder_pipeline_set_caps (RecorderPipeline *pipeline);
 static void recorder_pipeline_closed   (RecorderPipeline *pipeline);
 
-static void recorder_remove_redraw_timeout (ShellRecorder *recorder);
+static void recorder_remove_pause_timeout (ShellRecorder *recorder);
+static void recorder_push_frame (ShellRecorder *recorder,
+                                 gboolean       force);
+static void recorder_start_segment (ShellRecorder *recorder);
 
 enum {
   PROP_0,
@@ -137,17 +236,76 @@ G_DEFINE_TYPE(ShellRecorder, shell_recorder, G_TYPE_OBJECT);
  */
 #define UPDATE_MEMORY_USED_DELAY 500
 
+/* The time we wait (in milliseconds) for the GPU to say it's done with
+ * a readback, or for the next paint, before mapping the pixels anyway.
+ * Long enough that the GPU has finished the frame, short enough that
+ * the last change before the screen goes idle isn't recorded late.
+ */
+#define READBACK_TIMEOUT 100
+
 /* Maximum time between frames, in milliseconds. If we don't send data
  * for a long period of time, then when we send the next frame, a lot
- * of work can be created for the encoder to do, so we want to force a
- * periodic redraw when nothing happen.
+ * of work can be created for the encoder to do, so we want to repeat
+ * the last frame periodically when nothing happens.
  */
 #define MAXIMUM_PAUSE_TIME 1000
 
+/* Frames are copied into a fixed set of buffers that are reused once
+ * the pipeline is done with them. We keep enough of them for this many
+ * seconds of frames at the target frame rate, but at least
+ * MIN_POOL_BUFFERS and at most what fits in 13/16 of the memory target.
+ */
+#define POOL_SECONDS 2
+#define MIN_POOL_BUFFERS 3
+
 /* The default pipeline.
  */
 #define DEFAULT_PIPELINE "vp9enc min_quantizer=13 max_quantizer=13 cpu-used=5 deadline=1000000 threads=%T ! queue ! webmmux"
 
+/* The pipeline used instead of the default one once the default encoder
+ * couldn't keep up even with its fastest preset. vp8enc needs less CPU
+ * time per frame for a similar quality.
+ */
+#define FALLBACK_PIPELINE "vp8enc min_quantizer=13 max_quantizer=13 cpu-used=5 deadline=1000000 threads=%T ! queue ! webmmux"
+
+/* The settings we switch between for the encoder of the default pipeline
+ * when it can't keep up, from the best quality to the fastest; the first
+ * one is what the pipeline starts with. A deadline of 1 is the real-time
+ * mode of libvpx.
+ */
+static const struct {
+  int cpu_used;
+  gint64 deadline;
+} encoder_presets[] = {
+  { 5, 1000000 },
+  { 7, 1000000 },
+  { 8, 1 },
+};
+
+/* The time (in milliseconds) between checks of how the encoder keeps up
+ * with the frames we push.
+ */
+#define UPDATE_ENCODER_TIME 2000
+
+/* We switch to a faster encoder preset if frames were dropped since the
+ * last check or the latency is above MAX_ENCODER_LATENCY, and back to a
+ * slower one after ENCODER_GOOD_CHECKS checks in a row where the latency
+ * stayed below MIN_ENCODER_LATENCY (in milliseconds).
+ */
+#define MAX_ENCODER_LATENCY 1000
+#define MIN_ENCODER_LATENCY 200
+#define ENCODER_GOOD_CHECKS 5
+
+/* Whether the encoder of the default pipeline couldn't keep up with its
+ * fastest preset. This outlives the recorder, the screencast service
+ * creates a new one for each recording, and lasts for the rest of the
+ * session; only if the recording with the default pipeline that set it
+ * recovers and keeps up with its slowest preset again is it reset, so
+ * a short spike of load doesn't decide the codec. A fallback pipeline
+ * keeping up says nothing about the default one.
+ */
+static gboolean use_fallback_pipeline = FALSE;
+
 /* If we can find the amount of memory on the machine, we use half
  * of that for memory_target, otherwise, we use this value, in kB.
  */
@@ -185,19 +343,18 @@ get_memory_target (void)
 }
 
 /*
- * Used to force full stage redraws during recording to avoid artifacts
- *
- * Note: That this will cause the stage to be repainted on
- * every animation frame even if the frame wouldn't normally cause any new
- * drawing
+ * The number of threads to use for encoding and format conversion,
+ * the maximum possible value is 64 (limit of what vp9enc supports)
  */
-static gboolean
-recorder_repaint_hook (gpointer data)
+static int
+get_thread_count (void)
 {
-  ClutterActor *stage = data;
-  clutter_actor_queue_redraw (stage);
-
-  return TRUE;
+#ifdef _SC_NPROCESSORS_ONLN
+  int n_processors = sysconf (_SC_NPROCESSORS_ONLN); /* includes hyper-threading */
+  return MIN (MAX (1, n_processors - 1), 64);
+#else
+  return 3;
+#endif
 }
 
 static void
@@ -223,16 +380,15 @@ shell_recorder_finalize (GObject  *object)
   if (recorder->update_memory_used_timeout)
     g_source_remove (recorder->update_memory_used_timeout);
 
-  if (recorder->cursor_image)
-    cairo_surface_destroy (recorder->cursor_image);
-  if (recorder->cursor_memory)
-    g_free (recorder->cursor_memory);
+  g_clear_pointer (&recorder->frame, cairo_surface_destroy);
 
   recorder_set_stage (recorder, NULL);
   recorder_set_pipeline (recorder, NULL);
   recorder_set_file_template (recorder, NULL);
 
-  recorder_remove_redraw_timeout (recorder);
+  recorder_remove_pause_timeout (recorder);
+  g_clear_handle_id (&recorder->push_frame_timeout, g_source_remove);
+  g_clear_handle_id (&recorder->update_encoder_timeout, g_source_remove);
 
   G_OBJECT_CLASS (shell_recorder_parent_class)->finalize (object);
 }
@@ -270,83 +426,80 @@ recorder_update_memory_used (ShellRecorder *recorder,
     recorder->memory_used = memory_used;
 }
 
-/* Timeout used to avoid not drawing for more than MAXIMUM_PAUSE_TIME
+/* Timeout used to avoid not sending a frame for more than MAXIMUM_PAUSE_TIME;
+ * the stage doesn't need to be redrawn to repeat the last frame.
  */
 static gboolean
-recorder_redraw_timeout (gpointer data)
+recorder_pause_timeout (gpointer data)
 {
   ShellRecorder *recorder = data;
 
-  recorder->redraw_timeout = 0;
-  clutter_actor_queue_redraw (CLUTTER_ACTOR (recorder->stage));
+  recorder->pause_timeout = 0;
+  recorder->frame_dirty = TRUE;
+  recorder_push_frame (recorder, FALSE);
 
   return FALSE;
 }
 
 static void
-recorder_add_redraw_timeout (ShellRecorder *recorder)
+recorder_add_pause_timeout (ShellRecorder *recorder)
 {
-  if (recorder->redraw_timeout == 0)
+  if (recorder->pause_timeout == 0)
     {
-      recorder->redraw_timeout = g_timeout_add (MAXIMUM_PAUSE_TIME,
-                                                recorder_redraw_timeout,
-                                                recorder);
-      g_source_set_name_by_id (recorder->redraw_timeout, "[gnome-shell] recorder_redraw_timeout");
+      recorder->pause_timeout = g_timeout_add (MAXIMUM_PAUSE_TIME,
+                                               recorder_pause_timeout,
+                                               recorder);
+      g_source_set_name_by_id (recorder->pause_timeout, "[gnome-shell] recorder_pause_timeout");
     }
 }
 
 static void
-recorder_remove_redraw_timeout (ShellRecorder *recorder)
+recorder_remove_pause_timeout (ShellRecorder *recorder)
 {
-  if (recorder->redraw_timeout != 0)
+  if (recorder->pause_timeout != 0)
     {
-      g_source_remove (recorder->redraw_timeout);
-      recorder->redraw_timeout = 0;
+      g_source_remove (recorder->pause_timeout);
+      recorder->pause_timeout = 0;
     }
 }
 
-static void
-recorder_fetch_cursor_image (ShellRecorder *recorder)
-{
-  CoglTexture *texture;
-  int width, height;
-  int stride;
-  guint8 *data;
-
-  texture = meta_cursor_tracker_get_sprite (recorder->cursor_tracker);
-  if (!texture)
-    return;
-
-  meta_cursor_tracker_get_hot (recorder->cursor_tracker,
-                               &recorder->cursor_hot_x, &recorder->cursor_hot_y);
-
-  width = cogl_texture_get_width (texture);
-  height = cogl_texture_get_height (texture);
-  stride = 4 * width;
-  data = g_new (guint8, stride * height);
-  cogl_texture_get_data (texture, CLUTTER_CAIRO_FORMAT_ARGB32, stride, data);
-
-  /* FIXME: cairo-gl? */
-  recorder->cursor_image = cairo_image_surface_create_for_data (data,
-                                                                CAIRO_FORMAT_ARGB32,
-                                                                width, height,
-                                                                stride);
-  recorder->cursor_memory = data;
-}
-
 /* Overlay the cursor image on the frame. We draw the cursor image
  * into the host-memory buffer after  we've captured the frame. An
  * alternate approach would be to turn off the cursor while recording
  * and draw the cursor ourselves with GL, but then we'd need to figure
  * out what the cursor looks like, or hard-code a non-system cursor.
+ *
+ * Called in the frame worker.
  */
 static void
-recorder_draw_cursor (ShellRecorder *recorder,
-                      GstBuffer     *buffer)
+recorder_draw_cursor (RecorderJob *job)
 {
   GstMapInfo info;
   cairo_surface_t *surface;
-  cairo_t *cr;
+
+  gst_buffer_map (job->buffer, &info, GST_MAP_WRITE);
+  surface = cairo_image_surface_create_for_data (info.data,
+                                                 CAIRO_FORMAT_ARGB32,
+                                                 job->width,
+                                                 job->height,
+                                                 job->width * 4);
+
+  /* The cursor image is already at the scale of the frame */
+  _shell_util_blend_image (surface, job->cursor_image,
+                           job->cursor_x, job->cursor_y);
+
+  cairo_surface_destroy (surface);
+  gst_buffer_unmap (job->buffer, &info);
+}
+
+/* Sets up @job to draw the cursor on top of the frame, if it's
+ * in the recording area.
+ */
+static void
+recorder_add_cursor (ShellRecorder *recorder,
+                     RecorderJob   *job)
+{
+  int hot_x, hot_y;
 
   /* We don't show a cursor unless the hot spot is in the frame; this
    * means that sometimes we aren't going to draw a cursor even when
@@ -357,107 +510,504 @@ recorder_draw_cursor (ShellRecorder *recorder,
       recorder->pointer_y >= recorder->area.y + recorder->area.height)
     return;
 
-  if (!recorder->cursor_image)
-    recorder_fetch_cursor_image (recorder);
+  job->cursor_image = _shell_cursor_cache_get_image (recorder->cursor_tracker,
+                                                     recorder->scale,
+                                                     &hot_x, &hot_y);
+  if (!job->cursor_image)
+    return;
+
+  job->cursor_x = round ((recorder->pointer_x - hot_x - recorder->area.x) * recorder->scale);
+  job->cursor_y = round ((recorder->pointer_y - hot_y - recorder->area.y) * recorder->scale);
+}
+
+static RecorderJob *
+recorder_job_new (ShellRecorder   *recorder,
+                  RecorderJobType  type)
+{
+  RecorderJob *job = g_new0 (RecorderJob, 1);
+
+  job->type = type;
+  job->area = recorder->area;
+  job->width = recorder->capture_width;
+  job->height = recorder->capture_height;
+  job->scale = recorder->scale;
+
+  return job;
+}
+
+static void
+recorder_job_free (RecorderJob *job)
+{
+  int i;
+
+  for (i = 0; i < job->n_captures; i++)
+    cairo_surface_destroy (job->captures[i].image);
+  g_free (job->captures);
+
+  g_clear_pointer (&job->buffer, gst_buffer_unref);
+  if (job->src)
+    gst_object_unref (job->src);
+  g_clear_pointer (&job->cursor_image, cairo_surface_destroy);
+
+  g_free (job);
+}
+
+/* Paints the captures of @job into recorder->frame; captures that
+ * don't need to be scaled are just copied. Called in the frame worker.
+ */
+static void
+recorder_composite_frame (ShellRecorder *recorder,
+                          RecorderJob   *job)
+{
+  cairo_t *cr = NULL;
+  int i;
+
+  if (job->new_frame)
+    g_clear_pointer (&recorder->frame, cairo_surface_destroy);
+
+  if (recorder->frame == NULL)
+    {
+      recorder->frame = cairo_image_surface_create (CAIRO_FORMAT_ARGB32,
+                                                    job->width,
+                                                    job->height);
+      cairo_surface_set_device_scale (recorder->frame, job->scale, job->scale);
+    }
+
+  for (i = 0; i < job->n_captures; i++)
+    {
+      ClutterCapture *capture = &job->captures[i];
+
+      if (_shell_util_copy_capture_image (recorder->frame, capture,
+                                          job->area.x, job->area.y))
+        continue;
+
+      if (cr == NULL)
+        {
+          cr = cairo_create (recorder->frame);
+          cairo_set_operator (cr, CAIRO_OPERATOR_SOURCE);
+        }
+
+      cairo_save (cr);
+      cairo_translate (cr,
+                       capture->rect.x - job->area.x,
+                       capture->rect.y - job->area.y);
+      cairo_rectangle (cr, 0, 0, capture->rect.width, capture->rect.height);
+      cairo_clip (cr);
+      cairo_set_source_surface (cr, capture->image, 0, 0);
+      cairo_paint (cr);
+      cairo_restore (cr);
+    }
+
+  if (cr != NULL)
+    cairo_destroy (cr);
+}
+
+/* Copies recorder->frame into the buffer of @job, draws the cursor on
+ * top and hands the buffer to the pipeline. Called in the frame worker.
+ */
+static void
+recorder_fill_buffer (ShellRecorder *recorder,
+                      RecorderJob   *job)
+{
+  gsize size;
 
-  if (!recorder->cursor_image)
+  if (recorder->frame == NULL)
     return;
 
-  gst_buffer_map (buffer, &info, GST_MAP_WRITE);
-  surface = cairo_image_surface_create_for_data (info.data,
-                                                 CAIRO_FORMAT_ARGB32,
-                                                 recorder->area.width,
-                                                 recorder->area.height,
-                                                 recorder->area.width * 4);
-
-  cr = cairo_create (surface);
-  cairo_set_source_surface (cr,
-                            recorder->cursor_image,
-                            recorder->pointer_x - recorder->cursor_hot_x - recorder->area.x,
-                            recorder->pointer_y - recorder->cursor_hot_y - recorder->area.y);
-  cairo_paint (cr);
-
-  cairo_destroy (cr);
-  cairo_surface_destroy (surface);
-  gst_buffer_unmap (buffer, &info);
+  size = (cairo_image_surface_get_height (recorder->frame) *
+          cairo_image_surface_get_stride (recorder->frame));
+
+  /* The frame was resized after the buffer was allocated */
+  if (gst_buffer_get_size (job->buffer) != size)
+    return;
+
+  cairo_surface_flush (recorder->frame);
+  gst_buffer_fill (job->buffer, 0, cairo_image_surface_get_data (recorder->frame), size);
+
+  if (job->cursor_image)
+    recorder_draw_cursor (job);
+
+  shell_recorder_src_add_buffer (SHELL_RECORDER_SRC (job->src), job->buffer);
+}
+
+static void
+recorder_run_job (gpointer data,
+                  gpointer user_data)
+{
+  ShellRecorder *recorder = user_data;
+  RecorderJob *job = data;
+
+  switch (job->type)
+    {
+    case RECORDER_JOB_CAPTURE:
+      recorder_composite_frame (recorder, job);
+      break;
+    case RECORDER_JOB_PUSH:
+      recorder_fill_buffer (recorder, job);
+      break;
+    case RECORDER_JOB_CLOSE:
+      shell_recorder_src_close (SHELL_RECORDER_SRC (job->src));
+      break;
+    }
+
+  recorder_job_free (job);
 }
 
-/* Retrieve a frame and feed it into the pipeline
+/* Waits for the frame worker to finish the queued jobs, then stops it.
  */
 static void
-recorder_record_frame (ShellRecorder *recorder,
-                       gboolean       paint)
+recorder_stop_frame_worker (ShellRecorder *recorder)
 {
-  GstBuffer *buffer;
-  ClutterCapture *captures;
-  int n_captures;
-  cairo_surface_t *image;
+  if (recorder->frame_worker == NULL)
+    return;
+
+  g_thread_pool_free (recorder->frame_worker, FALSE, TRUE);
+  recorder->frame_worker = NULL;
+
+  g_clear_pointer (&recorder->frame, cairo_surface_destroy);
+}
+
+static void
+recorder_cancel_readback (ShellRecorder *recorder)
+{
+  g_clear_handle_id (&recorder->readback_timeout, g_source_remove);
+  g_clear_pointer (&recorder->readback, _shell_stage_readback_free);
+  g_clear_pointer (&recorder->readback_job, recorder_job_free);
+}
+
+/* Forget the captured contents of the recording area; the next paint
+ * of the whole stage captures all of it again into a new frame.
+ */
+static void
+recorder_reset_frame (ShellRecorder *recorder)
+{
+  recorder_cancel_readback (recorder);
+
+  recorder->have_frame = FALSE;
+  recorder->frame_dirty = FALSE;
+}
+
+/* Maps the pixels read back during the last paint, if that wasn't done
+ * yet, and queues painting them into the frame.
+ */
+static void
+recorder_finish_readback (ShellRecorder *recorder)
+{
+  ShellStageReadback *readback = recorder->readback;
+  RecorderJob *job = recorder->readback_job;
+  gboolean success;
+  gint64 start;
+
+  if (readback == NULL)
+    return;
+
+  g_clear_handle_id (&recorder->readback_timeout, g_source_remove);
+  recorder->readback = NULL;
+  recorder->readback_job = NULL;
+
+  start = g_get_monotonic_time ();
+  success = _shell_stage_readback_finish (readback, &job->captures, &job->n_captures);
+  shell_perf_log_event_x (shell_perf_log_get_default (),
+                          "recorder.readbackFinish",
+                          g_get_monotonic_time () - start);
+
+  if (!success)
+    {
+      /* The frame is missing what the stage redrew, so start over */
+      recorder_job_free (job);
+      recorder_reset_frame (recorder);
+      clutter_actor_queue_redraw (CLUTTER_ACTOR (recorder->stage));
+      return;
+    }
+
+  g_thread_pool_push (recorder->frame_worker, job, NULL);
+  recorder->frame_dirty = TRUE;
+}
+
+static void
+recorder_readback_ready (gpointer data)
+{
+  ShellRecorder *recorder = data;
+
+  recorder_finish_readback (recorder);
+  recorder_push_frame (recorder, FALSE);
+}
+
+static gboolean
+recorder_readback_timeout (gpointer data)
+{
+  ShellRecorder *recorder = data;
+
+  recorder->readback_timeout = 0;
+  recorder_readback_ready (recorder);
+
+  return G_SOURCE_REMOVE;
+}
+
+/* Reads back the part of the recording area the stage just redrew and
+ * queues painting it into recorder->frame. If @paint is %TRUE, the
+ * stage is painted for the capture, and the whole area is captured.
+ * Returns %FALSE if nothing in the recording area changed, or if the
+ * readback is asynchronous and the frame only changes once it is
+ * finished.
+ */
+static gboolean
+recorder_capture_frame (ShellRecorder *recorder,
+                        gboolean       paint)
+{
+  ShellPerfLog *perf_log = shell_perf_log_get_default ();
+  cairo_rectangle_int_t clip;
+  cairo_region_t *damage;
+  RecorderJob *job;
+  gboolean success;
+  gint64 start;
+
+  if (paint)
+    clip = recorder->area;
+  else
+    clutter_stage_get_redraw_clip_bounds (recorder->stage, &clip);
+
+  damage = cairo_region_create_rectangle (&recorder->area);
+  cairo_region_intersect_rectangle (damage, &clip);
+  cairo_region_get_extents (damage, &clip);
+
+  if (cairo_region_is_empty (damage))
+    {
+      cairo_region_destroy (damage);
+      return FALSE;
+    }
+
+  /* Outside of the redraw clip the contents of the framebuffer are
+   * undefined, so we need one full redraw to start from */
+  if (!recorder->have_frame &&
+      cairo_region_contains_rectangle (damage, &recorder->area) != CAIRO_REGION_OVERLAP_IN)
+    {
+      cairo_region_destroy (damage);
+      clutter_actor_queue_redraw (CLUTTER_ACTOR (recorder->stage));
+      return FALSE;
+    }
+
+  cairo_region_destroy (damage);
+
+  job = recorder_job_new (recorder, RECORDER_JOB_CAPTURE);
+
+  if (!paint)
+    {
+      start = g_get_monotonic_time ();
+      recorder->readback = _shell_stage_readback_start (recorder->stage, &clip,
+                                                        recorder_readback_ready,
+                                                        recorder);
+      if (recorder->readback != NULL)
+        shell_perf_log_event_x (perf_log, "recorder.readbackStart",
+                                g_get_monotonic_time () - start);
+    }
+
+  if (recorder->readback != NULL)
+    {
+      job->new_frame = !recorder->have_frame;
+      recorder->have_frame = TRUE;
+      recorder->readback_job = job;
+
+      /* Mapping right after the paint would wait for the GPU just as
+       * much as reading back synchronously, so this is only for when
+       * there's no fence and nothing gets painted for a while */
+      recorder->readback_timeout = g_timeout_add (READBACK_TIMEOUT,
+                                                  recorder_readback_timeout,
+                                                  recorder);
+      g_source_set_name_by_id (recorder->readback_timeout, "[gnome-shell] recorder_readback_timeout");
+
+      return FALSE;
+    }
+
+  start = g_get_monotonic_time ();
+  success = clutter_stage_capture (recorder->stage, paint, &clip,
+                                   &job->captures, &job->n_captures);
+
+  /* With @paint, this includes painting the stage */
+  if (!paint)
+    shell_perf_log_event_x (perf_log, "recorder.captureSync",
+                            g_get_monotonic_time () - start);
+
+  if (!success)
+    {
+      recorder_job_free (job);
+      return FALSE;
+    }
+
+  job->new_frame = !recorder->have_frame;
+  recorder->have_frame = TRUE;
+
+  g_thread_pool_push (recorder->frame_worker, job, NULL);
+
+  return TRUE;
+}
+
+/* Whether the current segment of the recording reached its limits at
+ * running time @now. The size is what was written to the file so far,
+ * so segments end up a bit larger than the limit.
+ */
+static gboolean
+recorder_pipeline_segment_full (RecorderPipeline *pipeline,
+                                GstClockTime      now)
+{
+  ShellRecorder *recorder = pipeline->recorder;
+  struct stat buf;
+
+  /* Pipelines that take care of their own output are never split */
+  if (pipeline->outfile == -1)
+    return FALSE;
+
+  if (recorder->segment_duration > 0 &&
+      now >= recorder->segment_duration * GST_SECOND)
+    return TRUE;
+
+  if (recorder->segment_size > 0 &&
+      fstat (pipeline->outfile, &buf) == 0 &&
+      (guint64) buf.st_size >= recorder->segment_size)
+    return TRUE;
+
+  return FALSE;
+}
+
+static gboolean
+recorder_push_frame_timeout (gpointer data)
+{
+  ShellRecorder *recorder = data;
+
+  recorder->push_frame_timeout = 0;
+  recorder_push_frame (recorder, FALSE);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+recorder_queue_push_frame (ShellRecorder *recorder,
+                           guint          delay)
+{
+  if (recorder->push_frame_timeout != 0)
+    return;
+
+  recorder->push_frame_timeout = g_timeout_add (delay,
+                                                recorder_push_frame_timeout,
+                                                recorder);
+  g_source_set_name_by_id (recorder->push_frame_timeout, "[gnome-shell] recorder_push_frame_timeout");
+}
+
+/* Counts the frame waiting to be pushed as dropped, once; it's retried
+ * until there is room for it, and new captures replace it meanwhile.
+ */
+static void
+recorder_pipeline_drop_frame (RecorderPipeline *pipeline)
+{
+  if (pipeline->frame_delayed)
+    return;
+
+  pipeline->frames_dropped++;
+  pipeline->frame_delayed = TRUE;
+}
+
+/* Feed the current frame into the pipeline, if anything changed since
+ * the last one. Unless @force is %TRUE, frames are delayed to get down
+ * to the target frame rate.
+ */
+static void
+recorder_push_frame (ShellRecorder *recorder,
+                     gboolean       force)
+{
+  RecorderPipeline *pipeline = recorder->current_pipeline;
+  GstBufferPoolAcquireParams params = { 0, };
+  GstBuffer *buffer = NULL;
+  RecorderJob *job;
   guint size;
-  uint8_t *data;
-  GstMemory *memory;
-  int i;
   GstClock *clock;
-  GstClockTime now, base_time;
+  GstClockTime now, base_time, interval;
 
   g_return_if_fail (recorder->current_pipeline != NULL);
 
-  /* If we get into the red zone, stop buffering new frames; 13/16 is
-  * a bit more than the 3/4 threshold for a red indicator to keep the
-  * indicator from flashing between red and yellow. */
-  if (recorder->memory_used > (recorder->memory_target * 13) / 16)
+  if (!recorder->frame_dirty || !recorder->have_frame)
     return;
 
-  /* Drop frames to get down to something like the target frame rate; since frames
-   * are generated with VBlank sync, we don't have full control anyways, so we just
-   * drop frames if the interval since the last frame is less than 75% of the
-   * desired inter-frame interval.
-   */
   clock = gst_element_get_clock (recorder->current_pipeline->src);
 
   /* If we have no clock yet, the pipeline is not yet in PLAYING */
   if (!clock)
-    return;
+    {
+      recorder_queue_push_frame (recorder, 1000 / recorder->framerate);
+      return;
+    }
 
   base_time = gst_element_get_base_time (recorder->current_pipeline->src);
   now = gst_clock_get_time (clock) - base_time;
   gst_object_unref (clock);
 
-  if (GST_CLOCK_TIME_IS_VALID (recorder->last_frame_time) &&
-      now - recorder->last_frame_time < gst_util_uint64_scale_int (GST_SECOND, 3, 4 * recorder->framerate))
-    return;
-  recorder->last_frame_time = now;
+  /* Delay frames to get down to something like the target frame rate;
+   * since frames are generated with VBlank sync, we don't have full
+   * control anyways, so we just wait if the interval since the last
+   * frame is less than 75% of the desired inter-frame interval.
+   */
+  interval = gst_util_uint64_scale_int (GST_SECOND, 3, 4 * recorder->framerate);
+  if (!force &&
+      GST_CLOCK_TIME_IS_VALID (recorder->last_frame_time) &&
+      now - recorder->last_frame_time < interval)
+    {
+      recorder_queue_push_frame (recorder,
+                                 GST_TIME_AS_MSECONDS (recorder->last_frame_time + interval - now) + 1);
+      return;
+    }
 
-  if (!clutter_stage_capture (recorder->stage, paint, &recorder->area,
-                              &captures, &n_captures))
-    return;
+  /* Continue in a new file once the segment is full; the new pipeline
+   * has no clock yet, so the frame goes there a bit later */
+  if (!force && recorder_pipeline_segment_full (pipeline, now))
+    {
+      recorder_start_segment (recorder);
+      recorder_queue_push_frame (recorder, 1000 / recorder->framerate);
+      return;
+    }
 
-  if (n_captures == 1)
-    image = cairo_surface_reference (captures[0].image);
-  else
-    image = shell_util_composite_capture_images (captures,
-                                                 n_captures,
-                                                 recorder->area.x,
-                                                 recorder->area.y,
-                                                 recorder->capture_width,
-                                                 recorder->capture_height,
-                                                 recorder->scale);
-
-  data = cairo_image_surface_get_data (image);
-  size = (cairo_image_surface_get_height (image) *
-          cairo_image_surface_get_stride (image));
-
-  for (i = 0; i < n_captures; i++)
-    cairo_surface_destroy (captures[i].image);
-  g_free (captures);
-
-  buffer = gst_buffer_new();
-  memory = gst_memory_new_wrapped (0, data, size, 0, size,
-                                   image,
-                                   (GDestroyNotify) cairo_surface_destroy);
-  gst_buffer_insert_memory (buffer, -1, memory);
+  size = (recorder->capture_height *
+          cairo_format_stride_for_width (CAIRO_FORMAT_ARGB32, recorder->capture_width));
+
+  /* Without a pool nothing bounds the memory used by queued frames;
+   * if we get into the red zone, stop buffering new frames. 13/16 is
+   * a bit more than the 3/4 threshold for a red indicator to keep the
+   * indicator from flashing between red and yellow. */
+  if (pipeline->pool == NULL && !force &&
+      recorder->memory_used > (recorder->memory_target * 13) / 16)
+    {
+      recorder_pipeline_drop_frame (pipeline);
+      return;
+    }
+
+  /* If all buffers are still queued in the pipeline, the encoder can't
+   * keep up; try again later, which lowers the frame rate instead of
+   * using more memory. */
+  params.flags = GST_BUFFER_POOL_ACQUIRE_FLAG_DONTWAIT;
+  if (pipeline->pool != NULL &&
+      gst_buffer_pool_acquire_buffer (pipeline->pool, &buffer, &params) != GST_FLOW_OK &&
+      !force)
+    {
+      recorder_pipeline_drop_frame (pipeline);
+      recorder_queue_push_frame (recorder, 1000 / recorder->framerate);
+      return;
+    }
+
+  if (buffer != NULL && gst_buffer_get_size (buffer) != size)
+    g_clear_pointer (&buffer, gst_buffer_unref);
+
+  if (buffer == NULL)
+    buffer = gst_buffer_new_allocate (NULL, size, NULL);
+
+  recorder->last_frame_time = now;
+
+  g_clear_handle_id (&recorder->push_frame_timeout, g_source_remove);
 
   GST_BUFFER_PTS(buffer) = now;
 
+  job = recorder_job_new (recorder, RECORDER_JOB_PUSH);
+  job->src = gst_object_ref (pipeline->src);
+  job->buffer = buffer;
+  pipeline->frame_delayed = FALSE;
+
   if (recorder->draw_cursor)
     {
       StSettings *settings = st_settings_get ();
@@ -466,26 +1016,36 @@ recorder_record_frame (ShellRecorder *recorder,
       g_object_get (settings, "magnifier-active", &magnifier_active, NULL);
 
       if (!magnifier_active)
-        recorder_draw_cursor (recorder, buffer);
+        recorder_add_cursor (recorder, job);
     }
 
-  shell_recorder_src_add_buffer (SHELL_RECORDER_SRC (recorder->current_pipeline->src), buffer);
-  gst_buffer_unref (buffer);
+  g_thread_pool_push (recorder->frame_worker, job, NULL);
+
+  pipeline->frames_captured++;
+  recorder->frame_dirty = FALSE;
 
   /* Reset the timeout that we used to avoid an overlong pause in the stream */
-  recorder_remove_redraw_timeout (recorder);
-  recorder_add_redraw_timeout (recorder);
+  recorder_remove_pause_timeout (recorder);
+  recorder_add_pause_timeout (recorder);
 }
 
-/* We hook in by recording each frame right after the stage is painted
+/* We hook in by capturing what changed right after the stage is painted
  * by clutter before glSwapBuffers() makes it visible to the user.
  */
 static void
 recorder_on_stage_paint (ClutterActor  *actor,
                          ShellRecorder *recorder)
 {
-  if (recorder->state == RECORDER_STATE_RECORDING)
-    recorder_record_frame (recorder, FALSE);
+  if (recorder->state != RECORDER_STATE_RECORDING)
+    return;
+
+  /* The GPU is done with the last frame by now, so this doesn't wait */
+  recorder_finish_readback (recorder);
+
+  if (recorder_capture_frame (recorder, FALSE))
+    recorder->frame_dirty = TRUE;
+
+  recorder_push_frame (recorder, FALSE);
 }
 
 static void
@@ -509,6 +1069,8 @@ recorder_update_size (ShellRecorder *recorder)
                                             &recorder->capture_height,
                                             &recorder->scale);
     }
+
+  recorder_reset_frame (recorder);
 }
 
 static void
@@ -527,28 +1089,36 @@ recorder_on_stage_notify_size (GObject          *object,
 }
 
 static gboolean
-recorder_idle_redraw (gpointer data)
+recorder_idle_frame (gpointer data)
 {
   ShellRecorder *recorder = data;
 
-  recorder->redraw_idle = 0;
-  clutter_actor_queue_redraw (CLUTTER_ACTOR (recorder->stage));
+  recorder->frame_idle = 0;
+  recorder_push_frame (recorder, FALSE);
 
   return FALSE;
 }
 
+/* The cursor is drawn on top of the captured frame, so cursor changes
+ * don't need a stage redraw, just a new frame.
+ */
 static void
-recorder_queue_redraw (ShellRecorder *recorder)
+recorder_queue_cursor_frame (ShellRecorder *recorder)
 {
-  /* If we just queue a redraw on every mouse motion (for example), we
-   * starve Clutter, which operates at a very low priority. So
-   * we need to queue a "low priority redraw" after timeline updates
+  if (recorder->state != RECORDER_STATE_RECORDING)
+    return;
+
+  recorder->frame_dirty = TRUE;
+
+  /* If we just pushed a frame on every mouse motion (for example), we
+   * would starve Clutter, which operates at a very low priority. So
+   * we push the frame at a priority lower than redraws
    */
-  if (recorder->state == RECORDER_STATE_RECORDING && recorder->redraw_idle == 0)
+  if (recorder->frame_idle == 0)
     {
-      recorder->redraw_idle = g_idle_add_full (CLUTTER_PRIORITY_REDRAW + 1,
-                                               recorder_idle_redraw, recorder, NULL);
-      g_source_set_name_by_id (recorder->redraw_idle, "[gnome-shell] recorder_idle_redraw");
+      recorder->frame_idle = g_idle_add_full (CLUTTER_PRIORITY_REDRAW + 1,
+                                              recorder_idle_frame, recorder, NULL);
+      g_source_set_name_by_id (recorder->frame_idle, "[gnome-shell] recorder_idle_frame");
     }
 }
 
@@ -556,18 +1126,7 @@ static void
 on_cursor_changed (MetaCursorTracker *tracker,
                    ShellRecorder     *recorder)
 {
-  if (recorder->cursor_image)
-    {
-      cairo_surface_destroy (recorder->cursor_image);
-      recorder->cursor_image = NULL;
-    }
-  if (recorder->cursor_memory)
-    {
-      g_free (recorder->cursor_memory);
-      recorder->cursor_memory = NULL;
-    }
-
-  recorder_queue_redraw (recorder);
+  recorder_queue_cursor_frame (recorder);
 }
 
 static void
@@ -581,7 +1140,7 @@ recorder_update_pointer (ShellRecorder *recorder)
     {
       recorder->pointer_x = pointer_x;
       recorder->pointer_y = pointer_y;
-      recorder_queue_redraw (recorder);
+      recorder_queue_cursor_frame (recorder);
     }
 }
 
@@ -648,10 +1207,10 @@ recorder_disconnect_stage_callbacks (ShellRecorder *recorder)
    * us the events is close to free in any case.
    */
 
-  if (recorder->redraw_idle)
+  if (recorder->frame_idle)
     {
-      g_source_remove (recorder->redraw_idle);
-      recorder->redraw_idle = 0;
+      g_source_remove (recorder->frame_idle);
+      recorder->frame_idle = 0;
     }
 }
 
@@ -829,6 +1388,21 @@ shell_recorder_class_init (ShellRecorderClass *klass)
   gobject_class->get_property = shell_recorder_get_property;
   gobject_class->set_property = shell_recorder_set_property;
 
+  /* All of these happen in the paint, except readbackFinish, which
+   * happens in the paint only if nothing finished the readback before */
+  shell_perf_log_define_event (shell_perf_log_get_default (),
+                               "recorder.readbackStart",
+                               "Time spent starting an asynchronous readback of what the stage redrew, in microseconds",
+                               "x");
+  shell_perf_log_define_event (shell_perf_log_get_default (),
+                               "recorder.readbackFinish",
+                               "Time spent mapping an asynchronous readback, including waiting for the GPU, in microseconds",
+                               "x");
+  shell_perf_log_define_event (shell_perf_log_get_default (),
+                               "recorder.captureSync",
+                               "Time spent reading back what the stage redrew synchronously, in microseconds",
+                               "x");
+
   g_object_class_install_property (gobject_class,
                                    PROP_DISPLAY,
                                    g_param_spec_object ("display",
@@ -880,6 +1454,54 @@ shell_recorder_class_init (ShellRecorderClass *klass)
                                                          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 }
 
+static void
+recorder_pipeline_clear_pool (RecorderPipeline *pipeline)
+{
+  if (pipeline->pool == NULL)
+    return;
+
+  /* Buffers still in the pipeline keep the pool alive; they are freed
+   * instead of being returned once it's inactive */
+  gst_buffer_pool_set_active (pipeline->pool, FALSE);
+  gst_object_unref (pipeline->pool);
+  pipeline->pool = NULL;
+}
+
+static void
+recorder_pipeline_update_pool (RecorderPipeline *pipeline,
+                               GstCaps          *caps)
+{
+  ShellRecorder *recorder = pipeline->recorder;
+  GstStructure *config;
+  guint64 max_by_memory;
+  guint size, max_buffers;
+
+  recorder_pipeline_clear_pool (pipeline);
+
+  size = (cairo_format_stride_for_width (CAIRO_FORMAT_ARGB32, recorder->capture_width) *
+          recorder->capture_height);
+  if (size == 0)
+    return;
+
+  max_by_memory = (guint64) recorder->memory_target * 1024 * 13 / 16 / size;
+  max_buffers = MAX (MIN_POOL_BUFFERS,
+                     MIN (recorder->framerate * POOL_SECONDS, max_by_memory));
+
+  pipeline->pool = gst_buffer_pool_new ();
+
+  config = gst_buffer_pool_get_config (pipeline->pool);
+  gst_buffer_pool_config_set_params (config, caps, size,
+                                     MIN_POOL_BUFFERS, max_buffers);
+
+  if (!gst_buffer_pool_set_config (pipeline->pool, config) ||
+      !gst_buffer_pool_set_active (pipeline->pool, TRUE))
+    {
+      g_warning ("ShellRecorder: can't set up frame buffer pool");
+      gst_object_unref (pipeline->pool);
+      pipeline->pool = NULL;
+    }
+}
+
 /* Sets the GstCaps (video format, in this case) on the stream
  */
 static void
@@ -903,6 +1525,7 @@ recorder_pipeline_set_caps (RecorderPipeline *pipeline)
                               "height", G_TYPE_INT, recorder->capture_height,
                               NULL);
   g_object_set (pipeline->src, "caps", caps, NULL);
+  recorder_pipeline_update_pool (pipeline, caps);
   gst_caps_unref (caps);
 }
 
@@ -945,6 +1568,12 @@ recorder_pipeline_add_source (RecorderPipeline *pipeline)
     }
   gst_bin_add (GST_BIN (pipeline->pipeline), videoconvert);
 
+  /* Converting to the format of the encoder happens in the streaming
+   * thread of the source; newer versions of videoconvert can split it
+   * over several threads */
+  if (g_object_class_find_property (G_OBJECT_GET_CLASS (videoconvert), "n-threads"))
+    g_object_set (videoconvert, "n-threads", get_thread_count (), NULL);
+
   gst_element_link_many (pipeline->src, videoconvert, NULL);
   src_pad = gst_element_get_static_pad (videoconvert, "src");
 
@@ -960,6 +1589,8 @@ recorder_pipeline_add_source (RecorderPipeline *pipeline)
       goto out;
     }
 
+  pipeline->encoder = gst_pad_get_parent_element (sink_pad);
+
   result = TRUE;
 
  out:
@@ -1010,6 +1641,7 @@ recorder_open_outfile (ShellRecorder  *recorder,
   while (TRUE)
     {
       GString *filename = g_string_new (NULL);
+      gboolean has_segment = FALSE;
       const char *p;
       char *path;
 
@@ -1055,6 +1687,11 @@ recorder_open_outfile (ShellRecorder  *recorder,
                     g_date_time_unref (datetime);
                   }
                   break;
+                case 'n':
+                  /* Appends the number of the segment */
+                  g_string_append_printf (filename, "%u", recorder->segment);
+                  has_segment = TRUE;
+                  break;
                 default:
                   g_warning ("Unknown escape %%%c in filename", *(p + 1));
                   goto out;
@@ -1066,6 +1703,25 @@ recorder_open_outfile (ShellRecorder  *recorder,
             g_string_append_c (filename, *p);
         }
 
+      /* Without %n, later segments get their number appended to the
+       * name, before the extension, so they don't overwrite the first */
+      if (recorder->segment > 0 && !has_segment)
+        {
+          const char *name = strrchr (filename->str, G_DIR_SEPARATOR);
+          const char *extension;
+          char *number = g_strdup_printf ("-%u", recorder->segment);
+
+          name = name ? name + 1 : filename->str;
+          extension = strrchr (name, '.');
+
+          if (extension != NULL && extension != name)
+            g_string_insert (filename, extension - filename->str, number);
+          else
+            g_string_append (filename, number);
+
+          g_free (number);
+        }
+
       /* If a filename is explicitly specified without %u then we assume the user
        * is fine with over-writing the old contents; putting %u in the default
        * should avoid problems with malicious symlinks.
@@ -1197,6 +1853,12 @@ recorder_pipeline_free (RecorderPipeline *pipeline)
   if (pipeline->pipeline != NULL)
     gst_object_unref (pipeline->pipeline);
 
+  recorder_pipeline_clear_pool (pipeline);
+
+  if (pipeline->encoder != NULL)
+    gst_object_unref (pipeline->encoder);
+  g_mutex_clear (&pipeline->stats_lock);
+
   if (pipeline->outfile != -1)
     close (pipeline->outfile);
 
@@ -1246,7 +1908,11 @@ recorder_pipeline_closed (RecorderPipeline *pipeline)
                                         (gpointer) recorder_pipeline_on_memory_used_changed,
                                         pipeline);
 
-  recorder_disconnect_stage_callbacks (pipeline->recorder);
+  /* Earlier segments finish while we're still recording into the
+   * current pipeline */
+  if (pipeline->recorder->current_pipeline == NULL ||
+      pipeline == pipeline->recorder->current_pipeline)
+    recorder_disconnect_stage_callbacks (pipeline->recorder);
 
   gst_element_set_state (pipeline->pipeline, GST_STATE_NULL);
 
@@ -1279,9 +1945,177 @@ recorder_pipeline_closed (RecorderPipeline *pipeline)
   recorder_pipeline_free (pipeline);
 }
 
+/* Counts the frames coming out of the encoder and how long it took
+ * since they were pushed. Called in the streaming thread of the encoder.
+ */
+static GstPadProbeReturn
+recorder_pipeline_encoder_probe (GstPad          *pad,
+                                 GstPadProbeInfo *info,
+                                 gpointer         data)
+{
+  RecorderPipeline *pipeline = data;
+  GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+  GstClock *clock;
+  GstClockTime now, latency = GST_CLOCK_TIME_NONE;
+
+  clock = gst_element_get_clock (pipeline->src);
+  if (clock != NULL && GST_BUFFER_PTS_IS_VALID (buffer))
+    {
+      now = gst_clock_get_time (clock) - gst_element_get_base_time (pipeline->src);
+      if (now > GST_BUFFER_PTS (buffer))
+        latency = now - GST_BUFFER_PTS (buffer);
+    }
+  g_clear_object (&clock);
+
+  g_mutex_lock (&pipeline->stats_lock);
+
+  /* Encoders can output buffers that aren't frames, like headers */
+  if (!GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_HEADER))
+    pipeline->frames_encoded++;
+
+  if (GST_CLOCK_TIME_IS_VALID (latency))
+    {
+      if (GST_CLOCK_TIME_IS_VALID (pipeline->latency))
+        pipeline->latency = (7 * pipeline->latency + latency) / 8;
+      else
+        pipeline->latency = latency;
+    }
+
+  g_mutex_unlock (&pipeline->stats_lock);
+
+  return GST_PAD_PROBE_OK;
+}
+
+static void
+recorder_pipeline_watch_encoder (RecorderPipeline *pipeline)
+{
+  GstPad *pad;
+
+  pipeline->latency = GST_CLOCK_TIME_NONE;
+
+  if (pipeline->encoder == NULL)
+    return;
+
+  pad = gst_element_get_static_pad (pipeline->encoder, "src");
+  if (pad == NULL)
+    return;
+
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER,
+                     recorder_pipeline_encoder_probe, pipeline, NULL);
+  gst_object_unref (pad);
+}
+
+/* We only change the settings of the encoders we put into the default
+ * pipelines; both are libvpx encoders that apply new settings to the
+ * next frame.
+ */
+static gboolean
+recorder_pipeline_is_adaptive (RecorderPipeline *pipeline)
+{
+  GstElementFactory *factory;
+  const char *name;
+
+  if (pipeline->recorder->pipeline_description != NULL ||
+      pipeline->encoder == NULL)
+    return FALSE;
+
+  factory = gst_element_get_factory (pipeline->encoder);
+  if (factory == NULL)
+    return FALSE;
+
+  name = gst_plugin_feature_get_name (GST_PLUGIN_FEATURE (factory));
+
+  return g_strcmp0 (name, "vp9enc") == 0 || g_strcmp0 (name, "vp8enc") == 0;
+}
+
+static void
+recorder_pipeline_set_encoder_preset (RecorderPipeline *pipeline,
+                                      guint             preset)
+{
+  pipeline->encoder_preset = preset;
+  pipeline->n_good_checks = 0;
+
+  g_object_set (pipeline->encoder,
+                "cpu-used", encoder_presets[preset].cpu_used,
+                "deadline", encoder_presets[preset].deadline,
+                NULL);
+}
+
+/* Switches the encoder of the current pipeline to a faster preset when
+ * it falls behind, and back to a slower one when it has been keeping
+ * up for a while.
+ */
+static void
+recorder_update_encoder (ShellRecorder *recorder)
+{
+  RecorderPipeline *pipeline = recorder->current_pipeline;
+  GstClockTime latency;
+  gboolean dropped;
+
+  if (pipeline == NULL || !pipeline->adaptive)
+    return;
+
+  g_mutex_lock (&pipeline->stats_lock);
+  latency = pipeline->latency;
+  g_mutex_unlock (&pipeline->stats_lock);
+
+  dropped = pipeline->frames_dropped != pipeline->last_frames_dropped;
+  pipeline->last_frames_dropped = pipeline->frames_dropped;
+
+  if (dropped ||
+      (GST_CLOCK_TIME_IS_VALID (latency) &&
+       latency > MAX_ENCODER_LATENCY * GST_MSECOND))
+    {
+      if (pipeline->encoder_preset + 1 < G_N_ELEMENTS (encoder_presets))
+        recorder_pipeline_set_encoder_preset (pipeline, pipeline->encoder_preset + 1);
+      else
+        use_fallback_pipeline = TRUE;
+
+      pipeline->n_good_checks = 0;
+    }
+  else if (GST_CLOCK_TIME_IS_VALID (latency) &&
+           latency < MIN_ENCODER_LATENCY * GST_MSECOND)
+    {
+      pipeline->n_good_checks++;
+
+      if (pipeline->n_good_checks >= ENCODER_GOOD_CHECKS)
+        {
+          if (pipeline->encoder_preset > 0)
+            recorder_pipeline_set_encoder_preset (pipeline, pipeline->encoder_preset - 1);
+          else if (!pipeline->is_fallback)
+            use_fallback_pipeline = FALSE;
+        }
+    }
+  else
+    {
+      pipeline->n_good_checks = 0;
+    }
+}
+
+static gboolean
+recorder_update_encoder_timeout (gpointer data)
+{
+  ShellRecorder *recorder = data;
+
+  recorder_update_encoder (recorder);
+
+  return G_SOURCE_CONTINUE;
+}
+
+static void
+recorder_add_update_encoder_timeout (ShellRecorder *recorder)
+{
+  if (recorder->update_encoder_timeout == 0)
+    {
+      recorder->update_encoder_timeout = g_timeout_add (UPDATE_ENCODER_TIME,
+                                                        recorder_update_encoder_timeout,
+                                                        recorder);
+      g_source_set_name_by_id (recorder->update_encoder_timeout, "[gnome-shell] recorder_update_encoder_timeout");
+    }
+}
+
 /*
- * Replaces '%T' in the passed pipeline with the thread count,
- * the maximum possible value is 64 (limit of what vp9enc supports)
+ * Replaces '%T' in the passed pipeline with the thread count.
  *
  * It is assumes that %T occurs only once.
  */
@@ -1297,14 +2131,7 @@ substitute_thread_count (const char *pipeline)
   if (!tmp)
     return g_strdup (pipeline);
 
-#ifdef _SC_NPROCESSORS_ONLN
-  {
-    int n_processors = sysconf (_SC_NPROCESSORS_ONLN); /* includes hyper-threading */
-    n_threads = MIN (MAX (1, n_processors - 1), 64);
-  }
-#else
-  n_threads = 3;
-#endif
+  n_threads = get_thread_count ();
 
   result = g_string_new (NULL);
   g_string_append_len (result, pipeline, tmp - pipeline);
@@ -1326,10 +2153,14 @@ recorder_open_pipeline (ShellRecorder *recorder)
   pipeline = g_new0 (RecorderPipeline, 1);
   pipeline->recorder = g_object_ref (recorder);
   pipeline->outfile = - 1;
+  g_mutex_init (&pipeline->stats_lock);
 
   pipeline_description = recorder->pipeline_description;
   if (!pipeline_description)
-    pipeline_description = DEFAULT_PIPELINE;
+    {
+      pipeline->is_fallback = use_fallback_pipeline;
+      pipeline_description = use_fallback_pipeline ? FALLBACK_PIPELINE : DEFAULT_PIPELINE;
+    }
 
   parsed_pipeline = substitute_thread_count (pipeline_description);
 
@@ -1351,6 +2182,9 @@ recorder_open_pipeline (ShellRecorder *recorder)
   if (!recorder_pipeline_add_sink (pipeline))
     goto error;
 
+  recorder_pipeline_watch_encoder (pipeline);
+  pipeline->adaptive = recorder_pipeline_is_adaptive (pipeline);
+
   gst_element_set_state (pipeline->pipeline, GST_STATE_PLAYING);
 
   bus = gst_pipeline_get_bus (GST_PIPELINE (pipeline->pipeline));
@@ -1386,6 +2220,41 @@ recorder_close_pipeline (ShellRecorder *recorder)
     }
 }
 
+/* Continues the recording in a new pipeline, writing to a new file. The
+ * encoder of the new pipeline starts with a keyframe, and the frames
+ * already pushed into the old pipeline are still encoded before it
+ * finishes in the background.
+ */
+static void
+recorder_start_segment (ShellRecorder *recorder)
+{
+  RecorderPipeline *old_pipeline = recorder->current_pipeline;
+  RecorderJob *job;
+
+  recorder->segment++;
+
+  if (!recorder_open_pipeline (recorder))
+    {
+      /* Don't try again for every frame */
+      g_warning ("ShellRecorder: can't start a new segment, continuing in %s",
+                 old_pipeline->filename);
+      recorder->segment_duration = 0;
+      recorder->segment_size = 0;
+      return;
+    }
+
+  if (old_pipeline->adaptive && recorder->current_pipeline->adaptive)
+    recorder_pipeline_set_encoder_preset (recorder->current_pipeline,
+                                          old_pipeline->encoder_preset);
+
+  /* The old source ends after the frames queued for it */
+  job = recorder_job_new (recorder, RECORDER_JOB_CLOSE);
+  job->src = gst_object_ref (old_pipeline->src);
+  g_thread_pool_push (recorder->frame_worker, job, NULL);
+
+  recorder->last_frame_time = GST_CLOCK_TIME_NONE;
+}
+
 /**
  * shell_recorder_new:
  * @stage: The #ClutterStage
@@ -1440,6 +2309,7 @@ shell_recorder_set_framerate (ShellRecorder *recorder,
  * the following escapes:
  *
  * %d: The current date as YYYYYMMDD
+ * %n: The number of the segment, see shell_recorder_set_segment_limits()
  * %%: A literal percent
  *
  * The default value is 'shell-%d%u-%c.ogg'.
@@ -1463,6 +2333,37 @@ shell_recorder_set_draw_cursor (ShellRecorder *recorder,
   recorder_set_draw_cursor (recorder, draw_cursor);
 }
 
+/**
+ * shell_recorder_set_segment_limits:
+ * @recorder: the #ShellRecorder
+ * @max_duration: the maximum length of a file in seconds, or 0
+ * @max_size: the size in bytes after which to start a new file, or 0
+ *
+ * Splits recordings into several files, each of them a complete video
+ * that starts with a keyframe. Once a file was recorded into for
+ * @max_duration seconds or reached @max_size bytes, recording continues
+ * in a new file without losing frames, while the previous one is
+ * finished in the background. Files are only split if they are written
+ * by the recorder, see shell_recorder_set_file_template().
+ *
+ * The name of each file is made from the file template, where %n is
+ * replaced by the number of the segment, starting from 0. If the
+ * template doesn't contain %n, the number is added to the names of
+ * all but the first file.
+ *
+ * The default is not to split recordings.
+ */
+void
+shell_recorder_set_segment_limits (ShellRecorder *recorder,
+                                   guint          max_duration,
+                                   guint64        max_size)
+{
+  g_return_if_fail (SHELL_IS_RECORDER (recorder));
+
+  recorder->segment_duration = max_duration;
+  recorder->segment_size = max_size;
+}
+
 /**
  * shell_recorder_set_pipeline:
  * @recorder: the #ShellRecorder
@@ -1480,6 +2381,11 @@ shell_recorder_set_draw_cursor (ShellRecorder *recorder,
  * via shout2send or similar.
  *
  * The default value is 'vp9enc min_quantizer=13 max_quantizer=13 cpu-used=5 deadline=1000000 threads=%T ! queue ! webmmux'
+ *
+ * With the default pipeline, the encoder switches to faster settings
+ * while recording when it can't keep up; if even the fastest ones are
+ * too slow, later recordings use vp8enc instead. Pipelines set with
+ * this function are used as they are.
  */
 void
 shell_recorder_set_pipeline (ShellRecorder *recorder,
@@ -1511,6 +2417,7 @@ shell_recorder_set_area (ShellRecorder *recorder,
                                         &recorder->capture_width,
                                         &recorder->capture_height,
                                         &recorder->scale);
+  recorder_reset_frame (recorder);
 
   /* This breaks the recording but tweaking the GStreamer pipeline a bit
    * might make it work, at least if the codec can handle a stream where
@@ -1547,6 +2454,8 @@ shell_recorder_record (ShellRecorder  *recorder,
   g_return_val_if_fail (recorder->stage != NULL, FALSE);
   g_return_val_if_fail (recorder->state != RECORDER_STATE_RECORDING, FALSE);
 
+  recorder->segment = 0;
+
   if (!recorder_open_pipeline (recorder))
     return FALSE;
 
@@ -1555,18 +2464,19 @@ shell_recorder_record (ShellRecorder  *recorder,
 
   recorder_connect_stage_callbacks (recorder);
 
+  recorder->frame_worker = g_thread_pool_new (recorder_run_job, recorder,
+                                              1, FALSE, NULL);
   recorder->last_frame_time = GST_CLOCK_TIME_NONE;
+  recorder_reset_frame (recorder);
 
   recorder->state = RECORDER_STATE_RECORDING;
   recorder_update_pointer (recorder);
   recorder_add_update_pointer_timeout (recorder);
+  recorder_add_update_encoder_timeout (recorder);
 
   /* Disable unredirection while we are recoring */
   meta_disable_unredirect_for_display (shell_global_get_display (shell_global_get ()));
 
-  /* Set up repaint hook */
-  recorder->repaint_hook_id = clutter_threads_add_repaint_func(recorder_repaint_hook, recorder->stage, NULL);
-
   /* Record an initial frame and also redraw with the indicator */
   clutter_actor_queue_redraw (CLUTTER_ACTOR (recorder->stage));
 
@@ -1596,20 +2506,25 @@ shell_recorder_close (ShellRecorder *recorder)
   /* We want to record one more frame since some time may have
    * elapsed since the last frame
    */
-  recorder_record_frame (recorder, TRUE);
+  recorder_finish_readback (recorder);
+  if (recorder_capture_frame (recorder, TRUE))
+    recorder->frame_dirty = TRUE;
+  recorder_push_frame (recorder, TRUE);
+
+  recorder_remove_pause_timeout (recorder);
+  g_clear_handle_id (&recorder->push_frame_timeout, g_source_remove);
+  g_clear_handle_id (&recorder->frame_idle, g_source_remove);
+
+  /* The last frames need to be in the pipeline before it's closed */
+  recorder_stop_frame_worker (recorder);
 
   recorder_remove_update_pointer_timeout (recorder);
+  g_clear_handle_id (&recorder->update_encoder_timeout, g_source_remove);
   recorder_close_pipeline (recorder);
 
   /* Queue a redraw to remove the recording indicator */
   clutter_actor_queue_redraw (CLUTTER_ACTOR (recorder->stage));
 
-  if (recorder->repaint_hook_id != 0)
-    {
-      clutter_threads_remove_repaint_func (recorder->repaint_hook_id);
-      recorder->repaint_hook_id = 0;
-    }
-
   recorder->state = RECORDER_STATE_CLOSED;
 
   /* Reenable after the recording */
@@ -1619,6 +2534,56 @@ shell_recorder_close (ShellRecorder *recorder)
   g_object_unref (recorder);
 }
 
+/**
+ * shell_recorder_get_stats:
+ * @recorder: the #ShellRecorder
+ * @frames_captured: (out) (optional): the number of frames pushed into
+ *                   the pipeline
+ * @frames_dropped: (out) (optional): the number of frames that were
+ *                  skipped because the pipeline couldn't keep up
+ * @frames_encoded: (out) (optional): the number of frames that came out
+ *                  of the encoder
+ * @latency: (out) (optional): the average time in milliseconds from
+ *           pushing a frame until it comes out of the encoder
+ *
+ * Gets statistics about the current recording, or zeros if the recorder
+ * is not recording. When recordings are split, this is about the file
+ * currently being recorded into. The difference between @frames_captured and
+ * @frames_encoded is the number of frames waiting for the encoder.
+ */
+void
+shell_recorder_get_stats (ShellRecorder *recorder,
+                          guint         *frames_captured,
+                          guint         *frames_dropped,
+                          guint         *frames_encoded,
+                          guint         *latency)
+{
+  RecorderPipeline *pipeline;
+  guint encoded = 0;
+  GstClockTime pipeline_latency = GST_CLOCK_TIME_NONE;
+
+  g_return_if_fail (SHELL_IS_RECORDER (recorder));
+
+  pipeline = recorder->current_pipeline;
+
+  if (pipeline != NULL)
+    {
+      g_mutex_lock (&pipeline->stats_lock);
+      encoded = pipeline->frames_encoded;
+      pipeline_latency = pipeline->latency;
+      g_mutex_unlock (&pipeline->stats_lock);
+    }
+
+  if (frames_captured)
+    *frames_captured = pipeline ? pipeline->frames_captured : 0;
+  if (frames_dropped)
+    *frames_dropped = pipeline ? pipeline->frames_dropped : 0;
+  if (frames_encoded)
+    *frames_encoded = encoded;
+  if (latency)
+    *latency = GST_CLOCK_TIME_IS_VALID (pipeline_latency) ? GST_TIME_AS_MSECONDS (pipeline_latency) : 0;
+}
+
 /**
  * shell_recorder_is_recording:
  *
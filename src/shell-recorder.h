@@ -29,6 +29,9 @@ void               shell_recorder_set_pipeline (ShellRecorder *recorder,
 						const char    *pipeline);
 void               shell_recorder_set_draw_cursor (ShellRecorder *recorder,
                                                    gboolean       draw_cursor);
+void               shell_recorder_set_segment_limits (ShellRecorder *recorder,
+                                                      guint          max_duration,
+                                                      guint64        max_size);
 void               shell_recorder_set_area     (ShellRecorder *recorder,
                                                 int            x,
                                                 int            y,
@@ -39,6 +42,11 @@ gboolean           shell_recorder_record       (ShellRecorder  *recorder,
 void               shell_recorder_close        (ShellRecorder *recorder);
 void               shell_recorder_pause        (ShellRecorder *recorder);
 gboolean           shell_recorder_is_recording (ShellRecorder *recorder);
+void               shell_recorder_get_stats    (ShellRecorder *recorder,
+                                                guint         *frames_captured,
+                                                guint         *frames_dropped,
+                                                guint         *frames_encoded,
+                                                guint         *latency);
 
 G_END_DECLS
 
@@ -1,5 +1,15 @@
 /* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
 
+#define _GNU_SOURCE /* for memfd_create() */
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
 #include <clutter/clutter.h>
 #include <cogl/cogl.h>
 #include <meta/display.h>
@@ -8,9 +18,11 @@
 #include <meta/meta-cursor-tracker.h>
 #include <st/st.h>
 
+#include "shell-cursor-cache.h"
 #include "shell-global.h"
+#include "shell-png-writer.h"
 #include "shell-screenshot.h"
-#include "shell-util.h"
+#include "shell-util-private.h"
 
 typedef struct _ShellScreenshotPrivate  ShellScreenshotPrivate;
 
@@ -35,6 +47,13 @@ struct _ShellScreenshotPrivate
 
   gboolean include_cursor;
   gboolean include_frame;
+
+  /* Whether the screenshot is returned as pixels in fd rather than
+   * written to a file */
+  gboolean to_fd;
+  int fd;
+
+  int compression_level;
 };
 
 typedef enum
@@ -44,12 +63,78 @@ typedef enum
   SHELL_SCREENSHOT_AREA,
 } ShellScreenshotMode;
 
+enum {
+  PROP_0,
+  PROP_COMPRESSION_LEVEL
+};
+
+/* The zlib default, which is what gdk-pixbuf used to write screenshots
+ * with; callers that prefer speed over size can lower it */
+#define DEFAULT_COMPRESSION_LEVEL -1
+
 G_DEFINE_TYPE_WITH_PRIVATE (ShellScreenshot, shell_screenshot, G_TYPE_OBJECT);
 
+static void
+shell_screenshot_set_property (GObject      *object,
+                               guint         prop_id,
+                               const GValue *value,
+                               GParamSpec   *pspec)
+{
+  ShellScreenshot *screenshot = SHELL_SCREENSHOT (object);
+
+  switch (prop_id)
+    {
+    case PROP_COMPRESSION_LEVEL:
+      screenshot->priv->compression_level = g_value_get_int (value);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+    }
+}
+
+static void
+shell_screenshot_get_property (GObject    *object,
+                               guint       prop_id,
+                               GValue     *value,
+                               GParamSpec *pspec)
+{
+  ShellScreenshot *screenshot = SHELL_SCREENSHOT (object);
+
+  switch (prop_id)
+    {
+    case PROP_COMPRESSION_LEVEL:
+      g_value_set_int (value, screenshot->priv->compression_level);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+    }
+}
+
 static void
 shell_screenshot_class_init (ShellScreenshotClass *screenshot_class)
 {
-  (void) screenshot_class;
+  GObjectClass *gobject_class = G_OBJECT_CLASS (screenshot_class);
+
+  gobject_class->set_property = shell_screenshot_set_property;
+  gobject_class->get_property = shell_screenshot_get_property;
+
+  /**
+   * ShellScreenshot:compression-level:
+   *
+   * The zlib compression level of the written PNG files, from 0 for
+   * no compression, which is fastest, to 9 for the smallest files,
+   * or -1 for the zlib default, which is also the default value.
+   */
+  g_object_class_install_property (gobject_class,
+                                   PROP_COMPRESSION_LEVEL,
+                                   g_param_spec_int ("compression-level",
+                                                     "Compression level",
+                                                     "The compression level of written PNG files",
+                                                     -1, 9,
+                                                     DEFAULT_COMPRESSION_LEVEL,
+                                                     G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 }
 
 static void
@@ -57,6 +142,8 @@ shell_screenshot_init (ShellScreenshot *screenshot)
 {
   screenshot->priv = shell_screenshot_get_instance_private (screenshot);
   screenshot->priv->global = shell_global_get ();
+  screenshot->priv->compression_level = DEFAULT_COMPRESSION_LEVEL;
+  screenshot->priv->fd = -1;
 }
 
 static void
@@ -67,11 +154,19 @@ on_screenshot_written (GObject      *source,
   ShellScreenshot *screenshot = SHELL_SCREENSHOT (source);
   ShellScreenshotPrivate *priv = screenshot->priv;
   GTask *result = user_data;
+  GError *error = NULL;
 
-  g_task_return_boolean (result, g_task_propagate_boolean (G_TASK (task), NULL));
+  if (g_task_propagate_boolean (G_TASK (task), &error))
+    g_task_return_boolean (result, TRUE);
+  else if (error != NULL)
+    g_task_return_error (result, error);
+  else
+    g_task_return_boolean (result, FALSE);
   g_object_unref (result);
 
-  g_clear_pointer (&priv->image, cairo_surface_destroy);
+  /* The image describes the pixels in the fd until it's taken */
+  if (!priv->to_fd)
+    g_clear_pointer (&priv->image, cairo_surface_destroy);
   g_clear_pointer (&priv->filename, g_free);
   g_clear_pointer (&priv->filename_used, g_free);
   g_clear_pointer (&priv->datetime, g_date_time_unref);
@@ -191,26 +286,27 @@ write_screenshot_thread (GTask        *result,
     status = CAIRO_STATUS_FILE_NOT_FOUND;
   else
     {
-      GdkPixbuf *pixbuf;
+      const char *text[5];
 
-      pixbuf = gdk_pixbuf_get_from_surface (priv->image,
-                                            0, 0,
-                                            cairo_image_surface_get_width (priv->image),
-                                            cairo_image_surface_get_height (priv->image));
       creation_time = g_date_time_format (priv->datetime, "%c");
 
       if (!creation_time)
         creation_time = g_date_time_format (priv->datetime, "%FT%T%z");
 
-      if (gdk_pixbuf_save_to_stream (pixbuf, stream, "png", NULL, NULL,
-                                     "tEXt::Software", "gnome-screenshot",
-                                     "tEXt::Creation Time", creation_time,
-                                     NULL))
+      text[0] = "Software";
+      text[1] = "gnome-screenshot";
+      text[2] = "Creation Time";
+      text[3] = creation_time;
+      text[4] = NULL;
+
+      /* Written straight from the image, see shell-png-writer.c */
+      if (_shell_png_writer_write (priv->image, stream,
+                                   priv->compression_level,
+                                   text, cancellable, NULL))
         status = CAIRO_STATUS_SUCCESS;
       else
         status = CAIRO_STATUS_WRITE_ERROR;
 
-      g_object_unref (pixbuf);
       g_free (creation_time);
     }
 
@@ -220,47 +316,338 @@ write_screenshot_thread (GTask        *result,
   g_clear_object (&stream);
 }
 
+#ifdef HAVE_MEMFD_CREATE
+static int
+create_memfd (GError **error)
+{
+  int fd;
+
+  fd = memfd_create ("gnome-shell-screenshot", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if (fd < 0)
+    {
+      int saved_errno = errno;
+
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (saved_errno),
+                   "Failed to create memfd: %s", g_strerror (saved_errno));
+    }
+
+  return fd;
+}
+
+static gboolean
+write_image_to_fd (int               fd,
+                   cairo_surface_t  *image,
+                   GError          **error)
+{
+  const guint8 *data;
+  gsize size, written = 0;
+
+  cairo_surface_flush (image);
+  data = cairo_image_surface_get_data (image);
+  size = (cairo_image_surface_get_height (image) *
+          cairo_image_surface_get_stride (image));
+
+  while (written < size)
+    {
+      ssize_t res = write (fd, data + written, size - written);
+
+      if (res < 0 && errno == EINTR)
+        continue;
+
+      if (res < 0)
+        {
+          int saved_errno = errno;
+
+          g_set_error (error, G_IO_ERROR, g_io_error_from_errno (saved_errno),
+                       "Failed to write screenshot: %s", g_strerror (saved_errno));
+          return FALSE;
+        }
+
+      written += res;
+    }
+
+  return TRUE;
+}
+
+/* The receiver can rely on the contents never changing */
+static gboolean
+seal_memfd (int      fd,
+            GError **error)
+{
+  if (fcntl (fd, F_ADD_SEALS,
+             F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) < 0 ||
+      lseek (fd, 0, SEEK_SET) < 0)
+    {
+      int saved_errno = errno;
+
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (saved_errno),
+                   "Failed to seal memfd: %s", g_strerror (saved_errno));
+      return FALSE;
+    }
+
+  return TRUE;
+}
+#endif
+
+/* Copies the pixels of the image into a sealed memfd, without
+ * touching the filesystem. Called in an I/O thread. */
 static void
-do_grab_screenshot (ShellScreenshot *screenshot,
-                    ClutterStage    *stage,
-                    int               x,
-                    int               y,
-                    int               width,
-                    int               height)
+write_fd_thread (GTask        *result,
+                 gpointer      object,
+                 gpointer      task_data,
+                 GCancellable *cancellable)
 {
+#ifdef HAVE_MEMFD_CREATE
+  ShellScreenshot *screenshot = SHELL_SCREENSHOT (object);
   ShellScreenshotPrivate *priv = screenshot->priv;
-  cairo_rectangle_int_t screenshot_rect = { x, y, width, height };
+  GError *error = NULL;
+  int fd;
+
+  if (priv->image == NULL)
+    {
+      g_task_return_new_error (result, G_IO_ERROR, G_IO_ERROR_FAILED,
+                               "Failed to capture the screen");
+      return;
+    }
+
+  fd = create_memfd (&error);
+  if (fd < 0)
+    {
+      g_task_return_error (result, error);
+      return;
+    }
+
+  if (!write_image_to_fd (fd, priv->image, &error) ||
+      !seal_memfd (fd, &error))
+    {
+      close (fd);
+      g_task_return_error (result, error);
+      return;
+    }
+
+  priv->fd = fd;
+  g_task_return_boolean (result, TRUE);
+#else
+  g_task_return_new_error (result, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                           "Screenshots to memory are not supported");
+#endif
+}
+
+/* Returns @image scaled down to fit into @max_width x @max_height
+ * pixels, keeping its aspect ratio; a size of 0 means no limit. */
+static cairo_surface_t *
+scale_image_to_fit (cairo_surface_t *image,
+                    int              max_width,
+                    int              max_height)
+{
+  cairo_surface_t *scaled;
+  cairo_t *cr;
+  int width, height, scaled_width, scaled_height;
+  double x_scale, y_scale;
+  double factor = 1.0;
+
+  width = cairo_image_surface_get_width (image);
+  height = cairo_image_surface_get_height (image);
+
+  if (max_width > 0 && width > max_width)
+    factor = MIN (factor, (double) max_width / width);
+  if (max_height > 0 && height > max_height)
+    factor = MIN (factor, (double) max_height / height);
+
+  if (factor == 1.0)
+    return cairo_surface_reference (image);
+
+  scaled_width = MAX (1, (int) (width * factor + 0.5));
+  scaled_height = MAX (1, (int) (height * factor + 0.5));
+
+  /* Paint in pixels of the source, regardless of its scale */
+  cairo_surface_get_device_scale (image, &x_scale, &y_scale);
+
+  scaled = cairo_image_surface_create (cairo_image_surface_get_format (image),
+                                       scaled_width, scaled_height);
+
+  cr = cairo_create (scaled);
+  cairo_scale (cr,
+               x_scale * scaled_width / width,
+               y_scale * scaled_height / height);
+  cairo_set_source_surface (cr, image, 0, 0);
+  cairo_pattern_set_filter (cairo_get_source (cr), CAIRO_FILTER_GOOD);
+  cairo_set_operator (cr, CAIRO_OPERATOR_SOURCE);
+  cairo_paint (cr);
+  cairo_destroy (cr);
+
+  cairo_surface_set_device_scale (scaled,
+                                  x_scale * scaled_width / width,
+                                  y_scale * scaled_height / height);
+
+  return scaled;
+}
+
+typedef struct {
+  GArray *areas; /* cairo_rectangle_int_t */
+  int max_width;
+  int max_height;
+
+  GPtrArray *images;
+
+  int fd;
+  GVariant *metadata;
+} ScreenshotAreasData;
+
+static void
+screenshot_areas_data_free (ScreenshotAreasData *data)
+{
+  g_array_unref (data->areas);
+  g_clear_pointer (&data->images, g_ptr_array_unref);
+
+  if (data->fd >= 0)
+    close (data->fd);
+  g_clear_pointer (&data->metadata, g_variant_unref);
+
+  g_free (data);
+}
+
+/* Scales the images of the areas down to the requested size and copies
+ * them one after the other into a sealed memfd. Called in an I/O thread. */
+static void
+write_areas_fd_thread (GTask        *result,
+                       gpointer      object,
+                       gpointer      task_data,
+                       GCancellable *cancellable)
+{
+#ifdef HAVE_MEMFD_CREATE
+  ScreenshotAreasData *data = task_data;
+  GVariantBuilder builder;
+  GError *error = NULL;
+  guint64 offset = 0;
+  int fd;
+  guint i;
+
+  fd = create_memfd (&error);
+  if (fd < 0)
+    {
+      g_task_return_error (result, error);
+      return;
+    }
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("aa{sv}"));
+
+  for (i = 0; i < data->images->len; i++)
+    {
+      cairo_rectangle_int_t *area = &g_array_index (data->areas, cairo_rectangle_int_t, i);
+      cairo_surface_t *image = g_ptr_array_index (data->images, i);
+      int width, height, stride;
+      double x_scale, y_scale;
+
+      if (image == NULL)
+        {
+          g_set_error (&error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                       "Failed to capture the screen");
+          break;
+        }
+
+      image = scale_image_to_fit (image, data->max_width, data->max_height);
+
+      if (!write_image_to_fd (fd, image, &error))
+        {
+          cairo_surface_destroy (image);
+          break;
+        }
+
+      width = cairo_image_surface_get_width (image);
+      height = cairo_image_surface_get_height (image);
+      stride = cairo_image_surface_get_stride (image);
+      cairo_surface_get_device_scale (image, &x_scale, &y_scale);
+
+      g_variant_builder_open (&builder, G_VARIANT_TYPE ("a{sv}"));
+      g_variant_builder_add (&builder, "{sv}", "x", g_variant_new_int32 (area->x));
+      g_variant_builder_add (&builder, "{sv}", "y", g_variant_new_int32 (area->y));
+      g_variant_builder_add (&builder, "{sv}", "offset", g_variant_new_uint64 (offset));
+      g_variant_builder_add (&builder, "{sv}", "width", g_variant_new_int32 (width));
+      g_variant_builder_add (&builder, "{sv}", "height", g_variant_new_int32 (height));
+      g_variant_builder_add (&builder, "{sv}", "stride", g_variant_new_int32 (stride));
+      g_variant_builder_add (&builder, "{sv}", "scale", g_variant_new_double (x_scale));
+      g_variant_builder_close (&builder);
+
+      offset += (guint64) height * stride;
+      cairo_surface_destroy (image);
+    }
+
+  if (error == NULL)
+    seal_memfd (fd, &error);
+
+  if (error != NULL)
+    {
+      g_variant_builder_clear (&builder);
+      close (fd);
+      g_task_return_error (result, error);
+      return;
+    }
+
+  data->fd = fd;
+  data->metadata = g_variant_ref_sink (g_variant_builder_end (&builder));
+  g_task_return_boolean (result, TRUE);
+#else
+  g_task_return_new_error (result, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                           "Screenshots to memory are not supported");
+#endif
+}
+
+static cairo_surface_t *
+capture_stage_area (ClutterStage          *stage,
+                    cairo_rectangle_int_t *rect)
+{
   ClutterCapture *captures;
+  cairo_surface_t *image;
   int n_captures;
   int i;
 
   if (!clutter_stage_capture (stage, FALSE,
-                              &screenshot_rect,
+                              rect,
                               &captures,
                               &n_captures))
-    return;
+    return NULL;
 
   if (n_captures == 1)
-    priv->image = cairo_surface_reference (captures[0].image);
+    image = cairo_surface_reference (captures[0].image);
   else
     {
       float target_scale;
+      int width, height;
 
-      clutter_stage_get_capture_final_size (stage, &screenshot_rect,
+      clutter_stage_get_capture_final_size (stage, rect,
                                             &width, &height, &target_scale);
-      priv->image = shell_util_composite_capture_images (captures,
-                                                         n_captures,
-                                                         x, y,
-                                                         width, height,
-                                                         target_scale);
+      image = shell_util_composite_capture_images (captures,
+                                                   n_captures,
+                                                   rect->x, rect->y,
+                                                   width, height,
+                                                   target_scale);
     }
 
-  priv->datetime = g_date_time_new_now_local ();
-
   for (i = 0; i < n_captures; i++)
     cairo_surface_destroy (captures[i].image);
 
   g_free (captures);
+
+  return image;
+}
+
+static void
+do_grab_screenshot (ShellScreenshot *screenshot,
+                    ClutterStage    *stage,
+                    int               x,
+                    int               y,
+                    int               width,
+                    int               height)
+{
+  ShellScreenshotPrivate *priv = screenshot->priv;
+  cairo_rectangle_int_t screenshot_rect = { x, y, width, height };
+
+  priv->image = capture_stage_area (stage, &screenshot_rect);
+  if (priv->image == NULL)
+    return;
+
+  priv->datetime = g_date_time_new_now_local ();
 }
 
 static gboolean
@@ -284,25 +671,17 @@ static void
 draw_cursor_image (cairo_surface_t       *surface,
                    cairo_rectangle_int_t  area)
 {
-  CoglTexture *texture;
-  int width, height;
-  int stride;
-  guint8 *data;
   MetaDisplay *display;
   MetaCursorTracker *tracker;
   cairo_surface_t *cursor_surface;
   cairo_region_t *screenshot_region;
-  cairo_t *cr;
   int x, y;
   int xhot, yhot;
   double xscale, yscale;
+  double cursor_scale = 1.0;
 
   display = shell_global_get_display (shell_global_get ());
   tracker = meta_cursor_tracker_get_for_display (display);
-  texture = meta_cursor_tracker_get_sprite (tracker);
-
-  if (!texture)
-    return;
 
   screenshot_region = cairo_region_create_rectangle (&area);
   meta_cursor_tracker_get_pointer (tracker, &x, &y, NULL);
@@ -313,18 +692,7 @@ draw_cursor_image (cairo_surface_t       *surface,
       return;
     }
 
-  meta_cursor_tracker_get_hot (tracker, &xhot, &yhot);
-  width = cogl_texture_get_width (texture);
-  height = cogl_texture_get_height (texture);
-  stride = 4 * width;
-  data = g_new (guint8, stride * height);
-  cogl_texture_get_data (texture, CLUTTER_CAIRO_FORMAT_ARGB32, stride, data);
-
-  /* FIXME: cairo-gl? */
-  cursor_surface = cairo_image_surface_create_for_data (data,
-                                                        CAIRO_FORMAT_ARGB32,
-                                                        width, height,
-                                                        stride);
+  cairo_region_destroy (screenshot_region);
 
   cairo_surface_get_device_scale (surface, &xscale, &yscale);
 
@@ -333,26 +701,26 @@ draw_cursor_image (cairo_surface_t       *surface,
       int monitor;
       float monitor_scale;
       MetaRectangle cursor_rect = {
-        .x = x, .y = y, .width = width, .height = height
+        .x = x, .y = y, .width = 1, .height = 1
       };
 
       monitor = meta_display_get_monitor_index_for_rect (display, &cursor_rect);
       monitor_scale = meta_display_get_monitor_scale (display, monitor);
 
-      cairo_surface_set_device_scale (cursor_surface, monitor_scale, monitor_scale);
+      /* The sprite is already at the scale of the monitor */
+      cursor_scale = xscale / monitor_scale;
     }
 
-  cr = cairo_create (surface);
-  cairo_set_source_surface (cr,
-                            cursor_surface,
-                            x - xhot - area.x,
-                            y - yhot - area.y);
-  cairo_paint (cr);
+  cursor_surface = _shell_cursor_cache_get_image (tracker, cursor_scale,
+                                                  &xhot, &yhot);
+  if (!cursor_surface)
+    return;
+
+  _shell_util_blend_image (surface, cursor_surface,
+                           round ((x - xhot - area.x) * xscale),
+                           round ((y - yhot - area.y) * yscale));
 
-  cairo_destroy (cr);
   cairo_surface_destroy (cursor_surface);
-  cairo_region_destroy (screenshot_region);
-  g_free (data);
 }
 
 static void
@@ -420,7 +788,7 @@ grab_screenshot (ClutterActor *stage,
   g_signal_handlers_disconnect_by_func (stage, grab_screenshot, result);
 
   task = g_task_new (screenshot, NULL, on_screenshot_written, result);
-  g_task_run_in_thread (task, write_screenshot_thread);
+  g_task_run_in_thread (task, priv->to_fd ? write_fd_thread : write_screenshot_thread);
   g_object_unref (task);
 }
 
@@ -445,6 +813,32 @@ grab_area_screenshot (ClutterActor *stage,
   g_object_unref (task);
 }
 
+static void
+grab_areas_screenshot (ClutterActor *stage,
+                       GTask        *result)
+{
+  ShellScreenshot *screenshot = g_task_get_source_object (result);
+  ScreenshotAreasData *data = g_task_get_task_data (result);
+  GTask *task;
+  guint i;
+
+  /* All areas are read back from the same frame, only what was
+   * asked for */
+  for (i = 0; i < data->areas->len; i++)
+    {
+      cairo_rectangle_int_t *area = &g_array_index (data->areas, cairo_rectangle_int_t, i);
+
+      g_ptr_array_add (data->images,
+                       capture_stage_area (CLUTTER_STAGE (stage), area));
+    }
+
+  g_signal_handlers_disconnect_by_func (stage, grab_areas_screenshot, result);
+  task = g_task_new (screenshot, NULL, on_screenshot_written, result);
+  g_task_set_task_data (task, data, NULL);
+  g_task_run_in_thread (task, write_areas_fd_thread);
+  g_object_unref (task);
+}
+
 static void
 grab_window_screenshot (ClutterActor *stage,
                         GTask        *result)
@@ -559,7 +953,7 @@ shell_screenshot_screenshot (ShellScreenshot     *screenshot,
   const char *paint_signal;
   GTask *result;
 
-  if (priv->filename != NULL) {
+  if (priv->filename != NULL || priv->to_fd) {
     if (callback)
       g_task_report_new_error (screenshot,
                                callback,
@@ -624,6 +1018,297 @@ shell_screenshot_screenshot_finish (ShellScreenshot        *screenshot,
   return finish_screenshot (screenshot, result, area, filename_used, error);
 }
 
+/**
+ * shell_screenshot_screenshot_to_fd:
+ * @screenshot: the #ShellScreenshot
+ * @include_cursor: Whether to include the cursor or not
+ * @callback: (scope async): function to call returning success or failure
+ * of the async grabbing
+ * @user_data: the data to pass to callback function
+ *
+ * Takes a screenshot of the whole screen and returns its pixels in a
+ * sealed memfd instead of writing a file, see
+ * shell_screenshot_screenshot_to_fd_finish().
+ *
+ */
+void
+shell_screenshot_screenshot_to_fd (ShellScreenshot     *screenshot,
+                                   gboolean             include_cursor,
+                                   GAsyncReadyCallback  callback,
+                                   gpointer             user_data)
+{
+  ClutterActor *stage;
+  ShellScreenshotPrivate *priv = screenshot->priv;
+  const char *paint_signal;
+  GTask *result;
+
+  if (priv->filename != NULL || priv->to_fd) {
+    if (callback)
+      g_task_report_new_error (screenshot,
+                               callback,
+                               user_data,
+                               shell_screenshot_screenshot_to_fd,
+                               G_IO_ERROR,
+                               G_IO_ERROR_PENDING,
+                               "Only one screenshot operation at a time "
+                               "is permitted");
+    return;
+  }
+
+  result = g_task_new (screenshot, NULL, callback, user_data);
+  g_task_set_source_tag (result, shell_screenshot_screenshot_to_fd);
+
+  priv->to_fd = TRUE;
+  priv->include_cursor = FALSE;
+
+  stage = CLUTTER_ACTOR (shell_global_get_stage (priv->global));
+  paint_signal = "actors-painted";
+
+  meta_disable_unredirect_for_display (shell_global_get_display (priv->global));
+
+  if (include_cursor)
+    {
+      if (should_draw_cursor_image (SHELL_SCREENSHOT_SCREEN))
+        priv->include_cursor = TRUE;
+      else
+        paint_signal = "paint";
+    }
+
+  g_signal_connect_after (stage, paint_signal, G_CALLBACK (grab_screenshot), result);
+
+  clutter_actor_queue_redraw (stage);
+}
+
+/**
+ * shell_screenshot_screenshot_to_fd_finish:
+ * @screenshot: the #ShellScreenshot
+ * @result: the #GAsyncResult that was provided to the callback
+ * @area: (out) (transfer none): the area that was grabbed in screen coordinates
+ * @fd: (out): return location for the memfd containing the pixels; the
+ * caller is responsible for closing it
+ * @width: (out): the width of the image in pixels
+ * @height: (out): the height of the image in pixels
+ * @stride: (out): the number of bytes per row
+ * @scale: (out): the number of pixels per logical pixel
+ * @error: #GError for error reporting
+ *
+ * Finish the asynchronous operation started by
+ * shell_screenshot_screenshot_to_fd() and obtain its result. The pixels
+ * are in the format of %CAIRO_FORMAT_ARGB32: 32-bit native-endian ARGB
+ * with premultiplied alpha.
+ *
+ * Returns: whether the operation was successful
+ *
+ */
+gboolean
+shell_screenshot_screenshot_to_fd_finish (ShellScreenshot        *screenshot,
+                                          GAsyncResult           *result,
+                                          cairo_rectangle_int_t **area,
+                                          int                    *fd,
+                                          int                    *width,
+                                          int                    *height,
+                                          int                    *stride,
+                                          double                 *scale,
+                                          GError                **error)
+{
+  ShellScreenshotPrivate *priv = screenshot->priv;
+  GError *local_error = NULL;
+  gboolean success;
+  double y_scale;
+
+  g_return_val_if_fail (g_async_result_is_tagged (result,
+                                                  shell_screenshot_screenshot_to_fd),
+                        FALSE);
+
+  success = finish_screenshot (screenshot, result, area, NULL, &local_error);
+
+  /* A call refused because another screenshot is in progress must not
+   * touch the state of that one */
+  if (g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_PENDING))
+    {
+      g_propagate_error (error, local_error);
+      *fd = -1;
+      *width = *height = *stride = 0;
+      *scale = 1.0;
+      return FALSE;
+    }
+
+  if (local_error != NULL)
+    g_propagate_error (error, local_error);
+
+  priv->to_fd = FALSE;
+
+  if (success)
+    {
+      *fd = priv->fd;
+      *width = cairo_image_surface_get_width (priv->image);
+      *height = cairo_image_surface_get_height (priv->image);
+      *stride = cairo_image_surface_get_stride (priv->image);
+      cairo_surface_get_device_scale (priv->image, scale, &y_scale);
+    }
+  else
+    {
+      if (priv->fd >= 0)
+        close (priv->fd);
+
+      *fd = -1;
+      *width = *height = *stride = 0;
+      *scale = 1.0;
+    }
+
+  priv->fd = -1;
+  g_clear_pointer (&priv->image, cairo_surface_destroy);
+
+  return success;
+}
+
+/**
+ * shell_screenshot_screenshot_areas_to_fd:
+ * @screenshot: the #ShellScreenshot
+ * @areas: (array length=n_values): the X and Y coordinates, width and
+ * height of each area to capture
+ * @n_values: four times the number of areas
+ * @max_width: the maximum width of the returned images in pixels, or 0
+ * @max_height: the maximum height of the returned images in pixels, or 0
+ * @callback: (scope async): function to call returning success or failure
+ * of the async grabbing
+ * @user_data: the data to pass to callback function
+ *
+ * Takes screenshots of several areas from the same frame and returns
+ * their pixels in a sealed memfd, see
+ * shell_screenshot_screenshot_areas_to_fd_finish(). Only the requested
+ * areas are read back; images larger than @max_width x @max_height are
+ * scaled down to fit, keeping their aspect ratio, before they are
+ * copied to the memfd.
+ *
+ */
+void
+shell_screenshot_screenshot_areas_to_fd (ShellScreenshot     *screenshot,
+                                         const int           *areas,
+                                         int                  n_values,
+                                         int                  max_width,
+                                         int                  max_height,
+                                         GAsyncReadyCallback  callback,
+                                         gpointer             user_data)
+{
+  ClutterActor *stage;
+  ShellScreenshotPrivate *priv = screenshot->priv;
+  ScreenshotAreasData *data;
+  GTask *result;
+  int i;
+
+  if (priv->filename != NULL || priv->to_fd) {
+    if (callback)
+      g_task_report_new_error (screenshot,
+                               callback,
+                               user_data,
+                               shell_screenshot_screenshot_areas_to_fd,
+                               G_IO_ERROR,
+                               G_IO_ERROR_PENDING,
+                               "Only one screenshot operation at a time "
+                               "is permitted");
+    return;
+  }
+
+  if (n_values == 0 || n_values % 4 != 0) {
+    if (callback)
+      g_task_report_new_error (screenshot,
+                               callback,
+                               user_data,
+                               shell_screenshot_screenshot_areas_to_fd,
+                               G_IO_ERROR,
+                               G_IO_ERROR_INVALID_ARGUMENT,
+                               "Invalid list of areas");
+    return;
+  }
+
+  data = g_new0 (ScreenshotAreasData, 1);
+  data->areas = g_array_sized_new (FALSE, FALSE, sizeof (cairo_rectangle_int_t),
+                                   n_values / 4);
+  data->max_width = max_width;
+  data->max_height = max_height;
+  data->images = g_ptr_array_new_with_free_func ((GDestroyNotify) cairo_surface_destroy);
+  data->fd = -1;
+
+  for (i = 0; i < n_values; i += 4)
+    {
+      cairo_rectangle_int_t area = {
+        areas[i], areas[i + 1], areas[i + 2], areas[i + 3]
+      };
+
+      g_array_append_val (data->areas, area);
+    }
+
+  result = g_task_new (screenshot, NULL, callback, user_data);
+  g_task_set_source_tag (result, shell_screenshot_screenshot_areas_to_fd);
+  g_task_set_task_data (result, data, (GDestroyNotify) screenshot_areas_data_free);
+
+  priv->to_fd = TRUE;
+
+  stage = CLUTTER_ACTOR (shell_global_get_stage (priv->global));
+
+  meta_disable_unredirect_for_display (shell_global_get_display (priv->global));
+
+  g_signal_connect_after (stage, "actors-painted", G_CALLBACK (grab_areas_screenshot), result);
+
+  clutter_actor_queue_redraw (stage);
+}
+
+/**
+ * shell_screenshot_screenshot_areas_to_fd_finish:
+ * @screenshot: the #ShellScreenshot
+ * @result: the #GAsyncResult that was provided to the callback
+ * @fd: (out): return location for the memfd containing the pixels; the
+ * caller is responsible for closing it
+ * @metadata: (out) (transfer full): return location for a description
+ * of the images in @fd
+ * @error: #GError for error reporting
+ *
+ * Finish the asynchronous operation started by
+ * shell_screenshot_screenshot_areas_to_fd() and obtain its result.
+ *
+ * @metadata is an array of vardicts of type `aa{sv}`, one for each area
+ * in the order they were passed in, with the coordinates of the area
+ * (`x`, `y`), where its pixels start in @fd (`offset`), the size of its
+ * image (`width`, `height`, `stride`) and the number of pixels per logical
+ * pixel (`scale`). The pixels are in the format of %CAIRO_FORMAT_ARGB32.
+ *
+ * Returns: whether the operation was successful
+ *
+ */
+gboolean
+shell_screenshot_screenshot_areas_to_fd_finish (ShellScreenshot  *screenshot,
+                                                GAsyncResult     *result,
+                                                int              *fd,
+                                                GVariant        **metadata,
+                                                GError          **error)
+{
+  ShellScreenshotPrivate *priv = screenshot->priv;
+  ScreenshotAreasData *data;
+
+  g_return_val_if_fail (g_async_result_is_tagged (result,
+                                                  shell_screenshot_screenshot_areas_to_fd),
+                        FALSE);
+
+  /* Calls that were refused right away, for example because another
+   * screenshot is in progress, have no data and must not reset that */
+  data = g_task_get_task_data (G_TASK (result));
+  if (data != NULL)
+    priv->to_fd = FALSE;
+
+  *fd = -1;
+  *metadata = NULL;
+
+  if (!g_task_propagate_boolean (G_TASK (result), error))
+    return FALSE;
+
+  *fd = data->fd;
+  *metadata = g_steal_pointer (&data->metadata);
+  data->fd = -1;
+
+  return TRUE;
+}
+
 /**
  * shell_screenshot_screenshot_area:
  * @screenshot: the #ShellScreenshot
@@ -654,7 +1339,7 @@ shell_screenshot_screenshot_area (ShellScreenshot     *screenshot,
   ShellScreenshotPrivate *priv = screenshot->priv;
   GTask *result;
 
-  if (priv->filename != NULL) {
+  if (priv->filename != NULL || priv->to_fd) {
     if (callback)
       g_task_report_new_error (screenshot,
                                callback,
@@ -741,7 +1426,7 @@ shell_screenshot_screenshot_window (ShellScreenshot     *screenshot,
   MetaWindow *window = meta_display_get_focus_window (display);
   GTask *result;
 
-  if (priv->filename != NULL || !window) {
+  if (priv->filename != NULL || priv->to_fd || !window) {
     if (callback)
       g_task_report_new_error (screenshot,
                                callback,
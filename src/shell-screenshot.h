@@ -53,6 +53,33 @@ gboolean shell_screenshot_screenshot_finish   (ShellScreenshot        *screensho
                                                const char            **filename_used,
                                                GError                **error);
 
+void    shell_screenshot_screenshot_to_fd     (ShellScreenshot     *screenshot,
+                                               gboolean             include_cursor,
+                                               GAsyncReadyCallback  callback,
+                                               gpointer             user_data);
+gboolean shell_screenshot_screenshot_to_fd_finish (ShellScreenshot        *screenshot,
+                                                   GAsyncResult           *result,
+                                                   cairo_rectangle_int_t **area,
+                                                   int                    *fd,
+                                                   int                    *width,
+                                                   int                    *height,
+                                                   int                    *stride,
+                                                   double                 *scale,
+                                                   GError                **error);
+
+void    shell_screenshot_screenshot_areas_to_fd (ShellScreenshot     *screenshot,
+                                                 const int           *areas,
+                                                 int                  n_values,
+                                                 int                  max_width,
+                                                 int                  max_height,
+                                                 GAsyncReadyCallback  callback,
+                                                 gpointer             user_data);
+gboolean shell_screenshot_screenshot_areas_to_fd_finish (ShellScreenshot  *screenshot,
+                                                         GAsyncResult     *result,
+                                                         int              *fd,
+                                                         GVariant        **metadata,
+                                                         GError          **error);
+
 void     shell_screenshot_pick_color        (ShellScreenshot      *screenshot,
                                              int                   x,
                                              int                   y,
@@ -0,0 +1,223 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+#include "config.h"
+
+#include <string.h>
+
+#include <cogl/cogl.h>
+
+#include "shell-stage-readback.h"
+#include "shell-util-private.h"
+
+/*
+ * clutter_stage_capture() reads the pixels back with glReadPixels()
+ * right away, which waits for the GPU to finish drawing the frame
+ * inside of the paint. Instead, the pixels can be read into a pixel
+ * buffer object; that copy happens on the GPU, and only mapping the
+ * buffer waits for it. So the buffer should only be mapped once the
+ * GPU is known to be done: when a fence placed after the readback
+ * signals, or at the latest when the next frame is painted.
+ *
+ * This only helps if Cogl can hand the readback to the GPU as is.
+ * Reads from an onscreen framebuffer are upside down, and without
+ * GL_MESA_pack_invert Cogl flips them by mapping the buffer on the
+ * CPU, right away; with GLES, it also converts the pixel format on the
+ * CPU. Either way we would stall in the paint just like
+ * clutter_stage_capture(), only with an extra copy, so in those cases,
+ * as with software rendering, where there is nothing to wait for, and
+ * when stage coordinates aren't framebuffer coordinates, callers are
+ * expected to use clutter_stage_capture() instead.
+ */
+
+struct _ShellStageReadback
+{
+  cairo_rectangle_int_t rect;
+  int stride;
+  CoglPixelBuffer *buffer;
+
+  CoglFramebuffer *framebuffer;
+  CoglFenceClosure *fence;
+  ShellStageReadbackReadyFunc ready_func;
+  gpointer user_data;
+};
+
+/* Whether Cogl reads @framebuffer into a pixel buffer without touching
+ * the pixels on the CPU, see above */
+static gboolean
+readback_stays_on_gpu (CoglContext     *ctx,
+                       CoglFramebuffer *framebuffer)
+{
+  static int has_pack_invert = -1;
+  CoglDriver driver;
+
+  driver = cogl_renderer_get_driver (cogl_context_get_renderer (ctx));
+  if (driver != COGL_DRIVER_GL && driver != COGL_DRIVER_GL3)
+    return FALSE;
+
+  if (!cogl_is_onscreen (framebuffer))
+    return TRUE;
+
+  if (has_pack_invert < 0)
+    has_pack_invert = _shell_util_has_gl_extension ("GL_MESA_pack_invert");
+
+  return has_pack_invert;
+}
+
+static void
+on_fence (CoglFence *fence,
+          void      *user_data)
+{
+  ShellStageReadback *readback = user_data;
+
+  /* Cogl frees the closure after calling us */
+  readback->fence = NULL;
+  readback->ready_func (readback->user_data);
+}
+
+/*
+ * _shell_stage_readback_start:
+ * @stage: the #ClutterStage
+ * @rect: the area to read, in stage coordinates
+ * @ready_func: function to call once the pixels can be mapped without
+ *   waiting
+ * @user_data: data to pass to @ready_func
+ *
+ * Starts reading back @rect from the framebuffer that is being drawn.
+ * Must be called while painting @stage, after the area was painted.
+ *
+ * @ready_func is called from the main loop when the GPU is done with
+ * the readback, but only if the driver supports fences; callers must
+ * be prepared to finish the readback without it, and freeing the
+ * readback cancels it.
+ *
+ * Returns: the pending readback, or %NULL if it can't be done
+ *   asynchronously
+ */
+ShellStageReadback *
+_shell_stage_readback_start (ClutterStage                *stage,
+                             const cairo_rectangle_int_t *rect,
+                             ShellStageReadbackReadyFunc  ready_func,
+                             gpointer                     user_data)
+{
+  ShellStageReadback *readback;
+  CoglContext *ctx;
+  CoglFramebuffer *framebuffer;
+  CoglBitmap *bitmap;
+  float stage_width, stage_height;
+  int stride;
+  gboolean success;
+
+  if (_shell_util_is_software_rendering ())
+    return NULL;
+
+  ctx = clutter_backend_get_cogl_context (clutter_get_default_backend ());
+  if (!cogl_has_feature (ctx, COGL_FEATURE_ID_PBOS))
+    return NULL;
+
+  framebuffer = cogl_get_draw_framebuffer ();
+  if (framebuffer == NULL)
+    return NULL;
+
+  clutter_actor_get_size (CLUTTER_ACTOR (stage), &stage_width, &stage_height);
+  if (cogl_framebuffer_get_width (framebuffer) != (int) stage_width ||
+      cogl_framebuffer_get_height (framebuffer) != (int) stage_height)
+    return NULL;
+
+  if (!readback_stays_on_gpu (ctx, framebuffer))
+    return NULL;
+
+  stride = cairo_format_stride_for_width (CAIRO_FORMAT_ARGB32, rect->width);
+
+  readback = g_new0 (ShellStageReadback, 1);
+  readback->rect = *rect;
+  readback->stride = stride;
+  readback->buffer = cogl_pixel_buffer_new (ctx, stride * rect->height, NULL);
+  readback->framebuffer = cogl_object_ref (framebuffer);
+  readback->ready_func = ready_func;
+  readback->user_data = user_data;
+
+  bitmap = cogl_bitmap_new_from_buffer (COGL_BUFFER (readback->buffer),
+                                        CLUTTER_CAIRO_FORMAT_ARGB32,
+                                        rect->width, rect->height,
+                                        stride, 0);
+  success = cogl_framebuffer_read_pixels_into_bitmap (framebuffer,
+                                                      rect->x, rect->y,
+                                                      COGL_READ_PIXELS_COLOR_BUFFER,
+                                                      bitmap);
+  cogl_object_unref (bitmap);
+
+  if (!success)
+    {
+      _shell_stage_readback_free (readback);
+      return NULL;
+    }
+
+  if (cogl_has_feature (ctx, COGL_FEATURE_ID_FENCE))
+    readback->fence = cogl_framebuffer_add_fence_callback (framebuffer,
+                                                           on_fence,
+                                                           readback);
+
+  return readback;
+}
+
+/*
+ * _shell_stage_readback_finish:
+ * @readback: (transfer full): a readback started by
+ *   _shell_stage_readback_start()
+ * @captures: (out): the captured images, as returned by
+ *   clutter_stage_capture()
+ * @n_captures: (out): the number of captured images
+ *
+ * Maps the pixels that were read back, waiting for the GPU if it isn't
+ * done yet, and frees @readback.
+ *
+ * Returns: %FALSE if the pixels couldn't be mapped
+ */
+gboolean
+_shell_stage_readback_finish (ShellStageReadback  *readback,
+                              ClutterCapture     **captures,
+                              int                 *n_captures)
+{
+  cairo_surface_t *image;
+  guint8 *data;
+
+  data = cogl_buffer_map (COGL_BUFFER (readback->buffer),
+                          COGL_BUFFER_ACCESS_READ, 0);
+  if (data == NULL)
+    {
+      _shell_stage_readback_free (readback);
+      return FALSE;
+    }
+
+  image = cairo_image_surface_create (CAIRO_FORMAT_ARGB32,
+                                      readback->rect.width,
+                                      readback->rect.height);
+  g_assert (cairo_image_surface_get_stride (image) == readback->stride);
+
+  memcpy (cairo_image_surface_get_data (image), data,
+          readback->stride * readback->rect.height);
+  cairo_surface_mark_dirty (image);
+
+  cogl_buffer_unmap (COGL_BUFFER (readback->buffer));
+
+  *captures = g_new0 (ClutterCapture, 1);
+  (*captures)[0].image = image;
+  (*captures)[0].rect = readback->rect;
+  *n_captures = 1;
+
+  _shell_stage_readback_free (readback);
+
+  return TRUE;
+}
+
+void
+_shell_stage_readback_free (ShellStageReadback *readback)
+{
+  if (readback->fence != NULL)
+    cogl_framebuffer_cancel_fence_callback (readback->framebuffer,
+                                            readback->fence);
+
+  cogl_object_unref (readback->framebuffer);
+  cogl_object_unref (readback->buffer);
+  g_free (readback);
+}
@@ -0,0 +1,24 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+#ifndef __SHELL_STAGE_READBACK_H__
+#define __SHELL_STAGE_READBACK_H__
+
+#include <clutter/clutter.h>
+
+G_BEGIN_DECLS
+
+typedef struct _ShellStageReadback ShellStageReadback;
+
+typedef void (*ShellStageReadbackReadyFunc) (gpointer user_data);
+
+ShellStageReadback *_shell_stage_readback_start  (ClutterStage                 *stage,
+                                                  const cairo_rectangle_int_t  *rect,
+                                                  ShellStageReadbackReadyFunc   ready_func,
+                                                  gpointer                      user_data);
+gboolean            _shell_stage_readback_finish (ShellStageReadback           *readback,
+                                                  ClutterCapture              **captures,
+                                                  int                          *n_captures);
+void                _shell_stage_readback_free   (ShellStageReadback           *readback);
+
+G_END_DECLS
+
+#endif /* __SHELL_STAGE_READBACK_H__ */
@@ -0,0 +1,20 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+#ifndef __SHELL_UTIL_PRIVATE_H__
+#define __SHELL_UTIL_PRIVATE_H__
+
+#include "shell-util.h"
+
+gboolean _shell_util_copy_capture_image (cairo_surface_t *image,
+                                         ClutterCapture  *capture,
+                                         int              x,
+                                         int              y);
+
+gboolean _shell_util_blend_image (cairo_surface_t *image,
+                                  cairo_surface_t *src,
+                                  int              x,
+                                  int              y);
+
+gboolean _shell_util_is_software_rendering (void);
+gboolean _shell_util_has_gl_extension      (const char *name);
+
+#endif
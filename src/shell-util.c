@@ -5,6 +5,7 @@
 #include <errno.h>
 #include <math.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/types.h>
@@ -17,6 +18,7 @@
 #include <cogl/cogl.h>
 
 #include "shell-util.h"
+#include "shell-util-private.h"
 #include <glib/gi18n-lib.h>
 #include <gtk/gtk.h>
 #include <gdk-pixbuf/gdk-pixbuf.h>
@@ -394,6 +396,91 @@ get_gl_vendor (void)
   return vendor;
 }
 
+/*
+ * _shell_util_is_software_rendering:
+ *
+ * Returns: %TRUE if the GL driver renders on the CPU, like llvmpipe
+ */
+gboolean
+_shell_util_is_software_rendering (void)
+{
+  static int is_software = -1;
+
+  if (is_software < 0)
+    {
+      ShellGLGetString gl_get_string;
+      const gchar *renderer = NULL;
+
+      gl_get_string = (ShellGLGetString) cogl_get_proc_address ("glGetString");
+      if (gl_get_string)
+        renderer = gl_get_string (GL_RENDERER);
+
+      is_software = (renderer != NULL &&
+                     (strstr (renderer, "llvmpipe") != NULL ||
+                      strstr (renderer, "softpipe") != NULL ||
+                      strstr (renderer, "Software Rasterizer") != NULL));
+    }
+
+  return is_software;
+}
+
+typedef const gchar *(*ShellGLGetStringi) (GLenum, GLuint);
+typedef void (*ShellGLGetIntegerv) (GLenum, GLint *);
+
+#ifndef GL_NUM_EXTENSIONS
+#define GL_NUM_EXTENSIONS 0x821D
+#endif
+
+/*
+ * _shell_util_has_gl_extension:
+ * @name: the name of a GL extension
+ *
+ * Returns: %TRUE if the GL driver supports the extension @name
+ */
+gboolean
+_shell_util_has_gl_extension (const char *name)
+{
+  ShellGLGetStringi gl_get_stringi;
+  ShellGLGetIntegerv gl_get_integerv;
+  ShellGLGetString gl_get_string;
+  const gchar *extensions;
+  gboolean found;
+  gchar **names;
+
+  /* Core profiles only list the extensions one by one */
+  gl_get_stringi = (ShellGLGetStringi) cogl_get_proc_address ("glGetStringi");
+  gl_get_integerv = (ShellGLGetIntegerv) cogl_get_proc_address ("glGetIntegerv");
+  if (gl_get_stringi && gl_get_integerv)
+    {
+      GLint n_extensions = 0;
+      GLint i;
+
+      gl_get_integerv (GL_NUM_EXTENSIONS, &n_extensions);
+      for (i = 0; i < n_extensions; i++)
+        {
+          if (g_strcmp0 (gl_get_stringi (GL_EXTENSIONS, i), name) == 0)
+            return TRUE;
+        }
+
+      if (n_extensions > 0)
+        return FALSE;
+    }
+
+  gl_get_string = (ShellGLGetString) cogl_get_proc_address ("glGetString");
+  if (!gl_get_string)
+    return FALSE;
+
+  extensions = gl_get_string (GL_EXTENSIONS);
+  if (!extensions)
+    return FALSE;
+
+  names = g_strsplit (extensions, " ", -1);
+  found = g_strv_contains ((const gchar * const *) names, name);
+  g_strfreev (names);
+
+  return found;
+}
+
 gboolean
 shell_util_need_background_refresh (void)
 {
@@ -461,6 +548,182 @@ shell_util_get_content_for_window_actor (MetaWindowActor *window_actor,
   return content;
 }
 
+/*
+ * _shell_util_copy_capture_image:
+ * @image: the image to copy into
+ * @capture: the capture to copy
+ * @x: the X coordinate of @image in stage coordinates
+ * @y: the Y coordinate of @image in stage coordinates
+ *
+ * Copies @capture into @image, replacing what was there before, as
+ * plain rows of pixels. This is the common case of captures that don't
+ * need to be scaled and is a lot cheaper than going through cairo.
+ *
+ * Returns: %FALSE if @capture has a different format or scale than
+ *   @image, or isn't aligned to its pixels, and needs to be painted
+ *   instead
+ */
+gboolean
+_shell_util_copy_capture_image (cairo_surface_t *image,
+                                ClutterCapture  *capture,
+                                int              x,
+                                int              y)
+{
+  cairo_format_t format;
+  double image_scale, capture_scale, unused;
+  double offset_x, offset_y;
+  int src_x, src_y, dest_x, dest_y;
+  int width, height;
+  int src_stride, dest_stride;
+  uint8_t *src, *dest;
+  int i;
+
+  format = cairo_image_surface_get_format (image);
+  if (format != CAIRO_FORMAT_ARGB32 && format != CAIRO_FORMAT_RGB24)
+    return FALSE;
+
+  if (cairo_image_surface_get_format (capture->image) != format)
+    return FALSE;
+
+  cairo_surface_get_device_scale (image, &image_scale, &unused);
+  cairo_surface_get_device_scale (capture->image, &capture_scale, &unused);
+  if (image_scale != capture_scale)
+    return FALSE;
+
+  offset_x = (capture->rect.x - x) * image_scale;
+  offset_y = (capture->rect.y - y) * image_scale;
+  if (offset_x != floor (offset_x) || offset_y != floor (offset_y))
+    return FALSE;
+
+  dest_x = MAX (0, (int) offset_x);
+  dest_y = MAX (0, (int) offset_y);
+  src_x = dest_x - (int) offset_x;
+  src_y = dest_y - (int) offset_y;
+
+  width = MIN (cairo_image_surface_get_width (capture->image) - src_x,
+               cairo_image_surface_get_width (image) - dest_x);
+  height = MIN (cairo_image_surface_get_height (capture->image) - src_y,
+                cairo_image_surface_get_height (image) - dest_y);
+
+  if (width <= 0 || height <= 0)
+    return TRUE;
+
+  cairo_surface_flush (capture->image);
+  cairo_surface_flush (image);
+
+  src_stride = cairo_image_surface_get_stride (capture->image);
+  dest_stride = cairo_image_surface_get_stride (image);
+  src = cairo_image_surface_get_data (capture->image) + src_y * src_stride + src_x * 4;
+  dest = cairo_image_surface_get_data (image) + dest_y * dest_stride + dest_x * 4;
+
+  for (i = 0; i < height; i++)
+    {
+      memcpy (dest, src, width * 4);
+      src += src_stride;
+      dest += dest_stride;
+    }
+
+  cairo_surface_mark_dirty (image);
+
+  return TRUE;
+}
+
+/* Premultiplied OVER of one ARGB32 pixel; the blue and red channels and
+ * the green and alpha channels are each scaled by 255 - alpha in one
+ * multiplication, with the division by 255 rounded like cairo does.
+ */
+static inline uint32_t
+blend_pixel (uint32_t src,
+             uint32_t dest)
+{
+  uint32_t alpha = src >> 24;
+  uint32_t rb, ag;
+
+  if (alpha == 0xff)
+    return src;
+  if (alpha == 0)
+    return dest;
+
+  rb = (dest & 0x00ff00ff) * (0xff - alpha) + 0x00800080;
+  rb = ((rb + ((rb >> 8) & 0x00ff00ff)) >> 8) & 0x00ff00ff;
+
+  ag = ((dest >> 8) & 0x00ff00ff) * (0xff - alpha) + 0x00800080;
+  ag = (ag + ((ag >> 8) & 0x00ff00ff)) & 0xff00ff00;
+
+  return src + rb + ag;
+}
+
+/*
+ * _shell_util_blend_image:
+ * @image: the image to blend into
+ * @src: the ARGB32 image to blend on top
+ * @x: the X coordinate of @src in pixels of @image
+ * @y: the Y coordinate of @src in pixels of @image
+ *
+ * Blends @src on top of @image pixel by pixel, ignoring the device
+ * scale of both. This is meant for small images like the cursor, for
+ * which setting up cairo costs more than the blending itself.
+ *
+ * Returns: %FALSE if @image doesn't have a format this can blend into
+ */
+gboolean
+_shell_util_blend_image (cairo_surface_t *image,
+                         cairo_surface_t *src,
+                         int              x,
+                         int              y)
+{
+  cairo_format_t format;
+  int src_x, src_y, dest_x, dest_y;
+  int width, height;
+  int src_stride, dest_stride;
+  uint8_t *src_data, *dest_data;
+  int i, j;
+
+  format = cairo_image_surface_get_format (image);
+  if (format != CAIRO_FORMAT_ARGB32 && format != CAIRO_FORMAT_RGB24)
+    return FALSE;
+
+  if (cairo_image_surface_get_format (src) != CAIRO_FORMAT_ARGB32)
+    return FALSE;
+
+  dest_x = MAX (0, x);
+  dest_y = MAX (0, y);
+  src_x = dest_x - x;
+  src_y = dest_y - y;
+
+  width = MIN (cairo_image_surface_get_width (src) - src_x,
+               cairo_image_surface_get_width (image) - dest_x);
+  height = MIN (cairo_image_surface_get_height (src) - src_y,
+                cairo_image_surface_get_height (image) - dest_y);
+
+  if (width <= 0 || height <= 0)
+    return TRUE;
+
+  cairo_surface_flush (src);
+  cairo_surface_flush (image);
+
+  src_stride = cairo_image_surface_get_stride (src);
+  dest_stride = cairo_image_surface_get_stride (image);
+  src_data = cairo_image_surface_get_data (src) + src_y * src_stride + src_x * 4;
+  dest_data = cairo_image_surface_get_data (image) + dest_y * dest_stride + dest_x * 4;
+
+  for (i = 0; i < height; i++)
+    {
+      const uint32_t *s = (const uint32_t *) src_data;
+      uint32_t *d = (uint32_t *) dest_data;
+
+      for (j = 0; j < width; j++)
+        d[j] = blend_pixel (s[j], d[j]);
+
+      src_data += src_stride;
+      dest_data += dest_stride;
+    }
+
+  cairo_surface_mark_dirty (image);
+
+  return TRUE;
+}
+
 cairo_surface_t *
 shell_util_composite_capture_images (ClutterCapture  *captures,
                                      int              n_captures,
@@ -488,6 +751,9 @@ shell_util_composite_capture_images (ClutterCapture  *captures,
     {
       ClutterCapture *capture = &captures[i];
 
+      if (_shell_util_copy_capture_image (image, capture, x, y))
+        continue;
+
       cairo_save (cr);
 
       cairo_translate (cr,
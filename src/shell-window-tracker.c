@@ -14,6 +14,7 @@
 
 #include "shell-window-tracker-private.h"
 #include "shell-app-private.h"
+#include "shell-app-system-private.h"
 #include "shell-global.h"
 #include "st.h"
 
@@ -42,6 +43,10 @@ struct _ShellWindowTracker
 
   /* <MetaWindow * window, ShellApp *app> */
   GHashTable *window_to_app;
+
+  /* <char *key, ShellApp *app> results of get_app_from_window_properties(),
+   * with %NULL for windows that didn't match an app */
+  GHashTable *app_cache;
 };
 
 G_DEFINE_TYPE (ShellWindowTracker, shell_window_tracker, G_TYPE_OBJECT);
@@ -273,6 +278,89 @@ get_app_from_sandboxed_app_id (MetaWindow  *window)
   return get_app_from_id (window, id);
 }
 
+static char *
+get_app_cache_key (MetaWindow *window)
+{
+  const char *properties[] = {
+    meta_window_get_sandboxed_app_id (window),
+    meta_window_get_gtk_application_id (window),
+    meta_window_get_wm_class_instance (window),
+    meta_window_get_wm_class (window),
+  };
+  GString *key = g_string_new (NULL);
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (properties); i++)
+    {
+      /* Tell unset properties apart from empty ones */
+      if (properties[i] != NULL)
+        {
+          g_string_append_c (key, '+');
+          g_string_append (key, properties[i]);
+        }
+      else
+        {
+          g_string_append_c (key, '-');
+        }
+
+      g_string_append_c (key, '\x1f');
+    }
+
+  return g_string_free (key, FALSE);
+}
+
+/*
+ * get_app_from_window_properties:
+ * @tracker: a #ShellWindowTracker
+ * @window: a #MetaWindow
+ *
+ * Looks only at the sandboxed app ID, GApplication ID and WM_CLASS of
+ * @window, and attempts to determine an application from them. As the
+ * result only depends on those properties and the installed apps, it
+ * is cached until the installed apps change; that way, apps with many
+ * windows don't go through the heuristics for each of them.
+ *
+ * Return value: (transfer full): A newly-referenced #ShellApp, or %NULL
+ */
+static ShellApp *
+get_app_from_window_properties (ShellWindowTracker *tracker,
+                                MetaWindow         *window)
+{
+  ShellApp *result;
+  gpointer cached;
+  char *key;
+
+  key = get_app_cache_key (window);
+
+  if (g_hash_table_lookup_extended (tracker->app_cache, key, NULL, &cached))
+    {
+      g_free (key);
+      return cached ? g_object_ref (cached) : NULL;
+    }
+
+  /* Check if the window was opened from within a sandbox; if this
+   * is the case, a corresponding .desktop file is guaranteed to match;
+   */
+  result = get_app_from_sandboxed_app_id (window);
+
+  /* Check if the window has a GApplication ID attached; this is
+   * canonical if it does
+   */
+  if (result == NULL)
+    result = get_app_from_gapplication_id (window);
+
+  /* Check if the app's WM_CLASS specifies an app; this is
+   * canonical if it does.
+   */
+  if (result == NULL)
+    result = get_app_from_window_wmclass (window);
+
+  g_hash_table_insert (tracker->app_cache, key,
+                       result ? g_object_ref (result) : NULL);
+
+  return result;
+}
+
 /*
  * get_app_from_window_group:
  * @monitor: a #ShellWindowTracker
@@ -391,24 +479,7 @@ get_app_for_window (ShellWindowTracker    *tracker,
   if (meta_window_is_remote (window))
     return _shell_app_new_for_window (window);
 
-  /* Check if the window was opened from within a sandbox; if this
-   * is the case, a corresponding .desktop file is guaranteed to match;
-   */
-  result = get_app_from_sandboxed_app_id (window);
-  if (result != NULL)
-    return result;
-
-  /* Check if the window has a GApplication ID attached; this is
-   * canonical if it does
-   */
-  result = get_app_from_gapplication_id (window);
-  if (result != NULL)
-    return result;
-
-  /* Check if the app's WM_CLASS specifies an app; this is
-   * canonical if it does.
-   */
-  result = get_app_from_window_wmclass (window);
+  result = get_app_from_window_properties (tracker, window);
   if (result != NULL)
     return result;
 
@@ -652,6 +723,20 @@ init_window_tracking (ShellWindowTracker *self)
   shell_window_tracker_on_n_workspaces_changed (workspace_manager, NULL, self);
 }
 
+static void
+app_cache_value_free (ShellApp *app)
+{
+  if (app != NULL)
+    g_object_unref (app);
+}
+
+static void
+on_installed_changed (ShellAppSystem     *app_system,
+                      ShellWindowTracker *self)
+{
+  g_hash_table_remove_all (self->app_cache);
+}
+
 static void
 on_startup_sequence_changed (MetaStartupNotification *sn,
                              MetaStartupSequence     *sequence,
@@ -674,7 +759,11 @@ shell_window_tracker_init (ShellWindowTracker *self)
 
   self->window_to_app = g_hash_table_new_full (g_direct_hash, g_direct_equal,
                                                NULL, (GDestroyNotify) g_object_unref);
+  self->app_cache = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                           g_free, (GDestroyNotify) app_cache_value_free);
 
+  g_signal_connect (shell_app_system_get_default (), "installed-changed",
+                    G_CALLBACK (on_installed_changed), self);
 
   g_signal_connect (sn, "changed",
                     G_CALLBACK (on_startup_sequence_changed), self);
@@ -689,6 +778,7 @@ shell_window_tracker_finalize (GObject *object)
   ShellWindowTracker *self = SHELL_WINDOW_TRACKER (object);
 
   g_hash_table_destroy (self->window_to_app);
+  g_hash_table_destroy (self->app_cache);
 
   G_OBJECT_CLASS (shell_window_tracker_parent_class)->finalize(object);
 }
@@ -727,34 +817,7 @@ ShellApp *
 shell_window_tracker_get_app_from_pid (ShellWindowTracker *tracker,
                                        int                 pid)
 {
-  GSList *running = shell_app_system_get_running (shell_app_system_get_default());
-  GSList *iter;
-  ShellApp *result = NULL;
-
-  for (iter = running; iter; iter = iter->next)
-    {
-      ShellApp *app = iter->data;
-      GSList *pids = shell_app_get_pids (app);
-      GSList *pids_iter;
-
-      for (pids_iter = pids; pids_iter; pids_iter = pids_iter->next)
-        {
-          int app_pid = GPOINTER_TO_INT (pids_iter->data);
-          if (app_pid == pid)
-            {
-              result = app;
-              break;
-            }
-        }
-      g_slist_free (pids);
-
-      if (result != NULL)
-        break;
-    }
-
-  g_slist_free (running);
-
-  return result;
+  return _shell_app_system_lookup_pid (shell_app_system_get_default (), pid);
 }
 
 static void
@@ -104,6 +104,8 @@ st_bin_allocate (ClutterActor          *self,
 {
   StBinPrivate *priv = st_bin_get_instance_private (ST_BIN (self));
 
+  _st_perf_counter_inc (ST_PERF_COUNTER_ALLOCATIONS);
+
   clutter_actor_set_allocation (self, box, flags);
 
   if (priv->child && clutter_actor_is_visible (priv->child))
@@ -131,6 +133,8 @@ st_bin_get_preferred_width (ClutterActor *self,
   StBinPrivate *priv = st_bin_get_instance_private (ST_BIN (self));
   StThemeNode *theme_node = st_widget_get_theme_node (ST_WIDGET (self));
 
+  _st_perf_counter_inc (ST_PERF_COUNTER_SIZE_REQUESTS);
+
   st_theme_node_adjust_for_height (theme_node, &for_height);
 
   if (priv->child == NULL || !clutter_actor_is_visible (priv->child))
@@ -160,6 +164,8 @@ st_bin_get_preferred_height (ClutterActor *self,
   StBinPrivate *priv = st_bin_get_instance_private (ST_BIN (self));
   StThemeNode *theme_node = st_widget_get_theme_node (ST_WIDGET (self));
 
+  _st_perf_counter_inc (ST_PERF_COUNTER_SIZE_REQUESTS);
+
   st_theme_node_adjust_for_width (theme_node, &for_width);
 
   if (priv->child == NULL || !clutter_actor_is_visible (priv->child))
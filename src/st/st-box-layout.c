@@ -47,6 +47,8 @@
  *
  */
 
+#include "config.h"
+
 #include <stdlib.h>
 
 #include "st-box-layout.h"
@@ -286,6 +288,8 @@ st_box_layout_allocate (ClutterActor          *actor,
   ClutterActorBox content_box;
   gfloat avail_width, avail_height, min_width, natural_width, min_height, natural_height;
 
+  _st_perf_counter_inc (ST_PERF_COUNTER_ALLOCATIONS);
+
   st_theme_node_get_content_box (theme_node, box, &viewport_content_box);
   clutter_actor_box_get_size (&viewport_content_box, &avail_width, &avail_height);
 
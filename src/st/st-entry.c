@@ -366,6 +366,8 @@ st_entry_get_preferred_width (ClutterActor *actor,
   StThemeNode *theme_node = st_widget_get_theme_node (ST_WIDGET (actor));
   gfloat hint_w, icon_w;
 
+  _st_perf_counter_inc (ST_PERF_COUNTER_SIZE_REQUESTS);
+
   st_theme_node_adjust_for_height (theme_node, &for_height);
 
   clutter_actor_get_preferred_width (priv->entry, for_height,
@@ -419,6 +421,8 @@ st_entry_get_preferred_height (ClutterActor *actor,
   StThemeNode *theme_node = st_widget_get_theme_node (ST_WIDGET (actor));
   gfloat hint_h, icon_h;
 
+  _st_perf_counter_inc (ST_PERF_COUNTER_SIZE_REQUESTS);
+
   st_theme_node_adjust_for_width (theme_node, &for_width);
 
   clutter_actor_get_preferred_height (priv->entry, for_width,
@@ -477,6 +481,8 @@ st_entry_allocate (ClutterActor          *actor,
   ClutterActor *left_icon, *right_icon;
   gboolean is_rtl;
 
+  _st_perf_counter_inc (ST_PERF_COUNTER_ALLOCATIONS);
+
   is_rtl = clutter_actor_get_text_direction (actor) == CLUTTER_TEXT_DIRECTION_RTL;
 
   if (is_rtl)
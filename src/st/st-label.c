@@ -136,6 +136,8 @@ st_label_get_preferred_width (ClutterActor *actor,
   StLabelPrivate *priv = ST_LABEL (actor)->priv;
   StThemeNode *theme_node = st_widget_get_theme_node (ST_WIDGET (actor));
 
+  _st_perf_counter_inc (ST_PERF_COUNTER_SIZE_REQUESTS);
+
   st_theme_node_adjust_for_height (theme_node, &for_height);
 
   clutter_actor_get_preferred_width (priv->label, for_height,
@@ -154,6 +156,8 @@ st_label_get_preferred_height (ClutterActor *actor,
   StLabelPrivate *priv = ST_LABEL (actor)->priv;
   StThemeNode *theme_node = st_widget_get_theme_node (ST_WIDGET (actor));
 
+  _st_perf_counter_inc (ST_PERF_COUNTER_SIZE_REQUESTS);
+
   st_theme_node_adjust_for_width (theme_node, &for_width);
 
   clutter_actor_get_preferred_height (priv->label, for_width,
@@ -172,6 +176,8 @@ st_label_allocate (ClutterActor          *actor,
   StThemeNode *theme_node = st_widget_get_theme_node (ST_WIDGET (actor));
   ClutterActorBox content_box;
 
+  _st_perf_counter_inc (ST_PERF_COUNTER_ALLOCATIONS);
+
   clutter_actor_set_allocation (actor, box, flags);
 
   st_theme_node_get_content_box (theme_node, box, &content_box);
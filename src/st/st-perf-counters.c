@@ -0,0 +1,65 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+/*
+ * st-perf-counters.c: Counters for style and layout work
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * SECTION:st-perf-counters
+ * @short_description: Counters for style and layout work
+ *
+ * When gnome-shell is built with the perf_counters option, St counts
+ * how often widgets are restyled, create theme nodes and are asked for
+ * their size or allocated. The counters only ever increase; callers
+ * interested in per-frame values should compute the difference between
+ * two reads. Without the option, the counters always read as zero and
+ * counting compiles to nothing.
+ */
+
+#include "config.h"
+
+#include "st-perf-counters.h"
+#include "st-private.h"
+
+guint _st_perf_counters[ST_PERF_COUNTER_LAST];
+
+/**
+ * st_perf_counters_get_enabled:
+ *
+ * Returns: %TRUE if St was built with performance counters
+ */
+gboolean
+st_perf_counters_get_enabled (void)
+{
+#ifdef ENABLE_PERF_COUNTERS
+  return TRUE;
+#else
+  return FALSE;
+#endif
+}
+
+/**
+ * st_perf_counters_get:
+ * @counter: a #StPerfCounter
+ *
+ * Returns: the number of times @counter has been incremented since
+ *   startup
+ */
+guint
+st_perf_counters_get (StPerfCounter counter)
+{
+  g_return_val_if_fail (counter < ST_PERF_COUNTER_LAST, 0);
+
+  return _st_perf_counters[counter];
+}
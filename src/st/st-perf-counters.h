@@ -0,0 +1,59 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+/*
+ * st-perf-counters.h: Counters for style and layout work
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#if !defined(ST_H_INSIDE) && !defined(ST_COMPILATION)
+#error "Only <st/st.h> can be included directly.h"
+#endif
+
+#ifndef __ST_PERF_COUNTERS_H__
+#define __ST_PERF_COUNTERS_H__
+
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+/**
+ * StPerfCounter:
+ * @ST_PERF_COUNTER_RESTYLES: number of times a widget's style was recomputed
+ *   and resulted in a different theme node
+ * @ST_PERF_COUNTER_THEME_NODES_CREATED: number of theme nodes created
+ *   by widgets looking up their style
+ * @ST_PERF_COUNTER_THEME_NODE_INTERN_HITS: number of created theme nodes
+ *   that were replaced by an identical interned node
+ * @ST_PERF_COUNTER_SIZE_REQUESTS: number of get_preferred_width() and
+ *   get_preferred_height() calls on St widgets
+ * @ST_PERF_COUNTER_ALLOCATIONS: number of allocate() calls on St widgets
+ * @ST_PERF_COUNTER_LAST: the number of counters
+ *
+ * Counters for the style and layout work done by St widgets.
+ */
+typedef enum {
+  ST_PERF_COUNTER_RESTYLES,
+  ST_PERF_COUNTER_THEME_NODES_CREATED,
+  ST_PERF_COUNTER_THEME_NODE_INTERN_HITS,
+  ST_PERF_COUNTER_SIZE_REQUESTS,
+  ST_PERF_COUNTER_ALLOCATIONS,
+
+  ST_PERF_COUNTER_LAST
+} StPerfCounter;
+
+gboolean st_perf_counters_get_enabled (void);
+guint    st_perf_counters_get         (StPerfCounter counter);
+
+G_END_DECLS
+
+#endif /* __ST_PERF_COUNTERS_H__ */
@@ -28,6 +28,7 @@
 #include "st-widget.h"
 #include "st-bin.h"
 #include "st-shadow.h"
+#include "st-perf-counters.h"
 
 G_BEGIN_DECLS
 
@@ -37,6 +38,18 @@ G_BEGIN_DECLS
 #define ST_PARAM_WRITABLE  (G_PARAM_WRITABLE  | G_PARAM_STATIC_STRINGS)
 #define ST_PARAM_READWRITE (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)
 
+extern guint _st_perf_counters[ST_PERF_COUNTER_LAST];
+
+/* Only compiled in with the perf_counters build option, so that the
+ * hot style and layout paths don't pay for it otherwise. Files using
+ * this must include config.h.
+ */
+#ifdef ENABLE_PERF_COUNTERS
+#define _st_perf_counter_inc(counter) (_st_perf_counters[(counter)]++)
+#else
+#define _st_perf_counter_inc(counter) G_STMT_START { } G_STMT_END
+#endif
+
 G_END_DECLS
 
 ClutterActor *_st_widget_get_dnd_clone (StWidget *widget);
@@ -292,6 +292,8 @@ st_scroll_bar_get_preferred_width (ClutterActor *self,
   gfloat trough_min_width, trough_natural_width;
   gfloat handle_min_width, handle_natural_width;
 
+  _st_perf_counter_inc (ST_PERF_COUNTER_SIZE_REQUESTS);
+
   st_theme_node_adjust_for_height (theme_node, &for_height);
 
   _st_actor_get_preferred_width (priv->trough, for_height, TRUE,
@@ -332,6 +334,8 @@ st_scroll_bar_get_preferred_height (ClutterActor *self,
   gfloat trough_min_height, trough_natural_height;
   gfloat handle_min_height, handle_natural_height;
 
+  _st_perf_counter_inc (ST_PERF_COUNTER_SIZE_REQUESTS);
+
   st_theme_node_adjust_for_width (theme_node, &for_width);
 
   _st_actor_get_preferred_height (priv->trough, for_width, TRUE,
@@ -367,6 +371,8 @@ st_scroll_bar_allocate (ClutterActor          *actor,
 {
   StScrollBar *bar = ST_SCROLL_BAR (actor);
 
+  _st_perf_counter_inc (ST_PERF_COUNTER_ALLOCATIONS);
+
   clutter_actor_set_allocation (actor, box, flags);
 
   scroll_bar_allocate_children (bar, box, flags);
@@ -58,6 +58,8 @@
  * detailed description of the considerations involved.
  */
 
+#include "config.h"
+
 #include "st-enum-types.h"
 #include "st-private.h"
 #include "st-scroll-view.h"
@@ -365,6 +367,8 @@ st_scroll_view_get_preferred_width (ClutterActor *actor,
   gfloat min_width = 0, natural_width;
   gfloat child_min_width, child_natural_width;
 
+  _st_perf_counter_inc (ST_PERF_COUNTER_SIZE_REQUESTS);
+
   if (!priv->child)
     return;
 
@@ -444,6 +448,8 @@ st_scroll_view_get_preferred_height (ClutterActor *actor,
   gfloat child_min_width;
   gfloat sb_width;
 
+  _st_perf_counter_inc (ST_PERF_COUNTER_SIZE_REQUESTS);
+
   if (!priv->child)
     return;
 
@@ -544,6 +550,8 @@ st_scroll_view_allocate (ClutterActor          *actor,
   StScrollViewPrivate *priv = ST_SCROLL_VIEW (actor)->priv;
   StThemeNode *theme_node = st_widget_get_theme_node (ST_WIDGET (actor));
 
+  _st_perf_counter_inc (ST_PERF_COUNTER_ALLOCATIONS);
+
   clutter_actor_set_allocation (actor, box, flags);
 
   st_theme_node_get_content_box (theme_node, box, &content_box);
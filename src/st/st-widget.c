@@ -360,6 +360,8 @@ st_widget_get_preferred_width (ClutterActor *self,
 {
   StThemeNode *theme_node = st_widget_get_theme_node (ST_WIDGET (self));
 
+  _st_perf_counter_inc (ST_PERF_COUNTER_SIZE_REQUESTS);
+
   st_theme_node_adjust_for_width (theme_node, &for_height);
 
   CLUTTER_ACTOR_CLASS (st_widget_parent_class)->get_preferred_width (self, for_height, min_width_p, natural_width_p);
@@ -375,6 +377,8 @@ st_widget_get_preferred_height (ClutterActor *self,
 {
   StThemeNode *theme_node = st_widget_get_theme_node (ST_WIDGET (self));
 
+  _st_perf_counter_inc (ST_PERF_COUNTER_SIZE_REQUESTS);
+
   st_theme_node_adjust_for_width (theme_node, &for_width);
 
   CLUTTER_ACTOR_CLASS (st_widget_parent_class)->get_preferred_height (self, for_width, min_height_p, natural_height_p);
@@ -390,6 +394,8 @@ st_widget_allocate (ClutterActor          *actor,
   StThemeNode *theme_node = st_widget_get_theme_node (ST_WIDGET (actor));
   ClutterActorBox content_box;
 
+  _st_perf_counter_inc (ST_PERF_COUNTER_ALLOCATIONS);
+
   /* Note that we can't just chain up to clutter_actor_real_allocate --
    * Clutter does some dirty tricks for backwards compatibility.
    * Clutter also passes the actor's allocation directly to the layout
@@ -639,6 +645,7 @@ st_widget_get_theme_node (StWidget *widget)
         pseudo_class = direction_pseudo_class;
 
       context = st_theme_context_get_for_stage (stage);
+      _st_perf_counter_inc (ST_PERF_COUNTER_THEME_NODES_CREATED);
       tmp_node = st_theme_node_new (context, parent_node, priv->theme,
                                     G_OBJECT_TYPE (widget),
                                     clutter_actor_get_name (CLUTTER_ACTOR (widget)),
@@ -651,6 +658,8 @@ st_widget_get_theme_node (StWidget *widget)
 
       priv->theme_node = g_object_ref (st_theme_context_intern_node (context,
                                                                      tmp_node));
+      if (priv->theme_node != tmp_node)
+        _st_perf_counter_inc (ST_PERF_COUNTER_THEME_NODE_INTERN_HITS);
       g_object_unref (tmp_node);
     }
 
@@ -1762,6 +1771,8 @@ st_widget_recompute_style (StWidget    *widget,
       return;
     }
 
+  _st_perf_counter_inc (ST_PERF_COUNTER_RESTYLES);
+
   _st_theme_node_apply_margins (new_theme_node, CLUTTER_ACTOR (widget));
 
   if (old_theme_node)
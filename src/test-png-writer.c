@@ -0,0 +1,271 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+/*
+ * test-png-writer.c: round-trip test for the PNG writer used for
+ * screenshots
+ *
+ * Images are written with _shell_png_writer_write(), read back with
+ * gdk-pixbuf and compared pixel by pixel with what was written.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+#include "shell-png-writer.h"
+
+static gboolean fail;
+
+static const char *test;
+
+/* Sizes with widths that aren't a multiple of anything in particular,
+ * and heights that need one or several bands of rows */
+static const struct {
+  int width;
+  int height;
+} sizes[] = {
+  { 1, 1 },
+  { 3, 5 },
+  { 37, 70 },
+  { 129, 257 },
+};
+
+static const char * const text[] = {
+  "Software", "gnome-shell",
+  "Title", "Caf\xc3\xa9",                   /* fits in Latin-1, tEXt */
+  "Description", "\xe2\x9c\x93 check mark", /* doesn't, iTXt */
+  NULL
+};
+
+/* A premultiplied pixel with alpha 0, 255 or something in between,
+ * depending on the position */
+static guint32
+make_pixel (int x,
+            int y)
+{
+  static const guint8 alphas[] = { 0, 1, 0x7f, 0x80, 0xfe, 0xff };
+  guint32 alpha = alphas[(x + 2 * y) % G_N_ELEMENTS (alphas)];
+  guint32 red = ((x * 7 + y * 3) & 0xff) * alpha / 255;
+  guint32 green = ((x * 13 + y * 11) & 0xff) * alpha / 255;
+  guint32 blue = ((x * 5 + y * 17) & 0xff) * alpha / 255;
+
+  return alpha << 24 | red << 16 | green << 8 | blue;
+}
+
+static cairo_surface_t *
+create_image (cairo_format_t format,
+              int            width,
+              int            height)
+{
+  cairo_surface_t *image;
+  guint8 *data;
+  int stride;
+  int x, y;
+
+  image = cairo_image_surface_create (format, width, height);
+  cairo_surface_flush (image);
+
+  data = cairo_image_surface_get_data (image);
+  stride = cairo_image_surface_get_stride (image);
+
+  for (y = 0; y < height; y++)
+    {
+      guint32 *row = (guint32 *) (data + y * stride);
+
+      for (x = 0; x < width; x++)
+        {
+          row[x] = make_pixel (x, y);
+
+          /* The unused byte of RGB24 pixels must be ignored */
+          if (format == CAIRO_FORMAT_RGB24)
+            row[x] = (row[x] & 0x00ffffff) | 0x5a000000;
+        }
+    }
+
+  cairo_surface_mark_dirty (image);
+
+  return image;
+}
+
+static gboolean
+check_channel (int    x,
+               int    y,
+               char   channel,
+               int    expected,
+               int    actual,
+               int    tolerance)
+{
+  if (abs (expected - actual) <= tolerance)
+    return TRUE;
+
+  g_print ("%s: pixel %d,%d: %c: expected: %d, got: %d\n",
+           test, x, y, channel, expected, actual);
+  fail = TRUE;
+
+  return FALSE;
+}
+
+static void
+check_pixbuf (GdkPixbuf       *pixbuf,
+              cairo_surface_t *image)
+{
+  cairo_format_t format = cairo_image_surface_get_format (image);
+  int width = cairo_image_surface_get_width (image);
+  int height = cairo_image_surface_get_height (image);
+  const guint8 *pixels = gdk_pixbuf_read_pixels (pixbuf);
+  int rowstride = gdk_pixbuf_get_rowstride (pixbuf);
+  int x, y;
+
+  if (gdk_pixbuf_get_width (pixbuf) != width ||
+      gdk_pixbuf_get_height (pixbuf) != height)
+    {
+      g_print ("%s: expected size: %dx%d, got: %dx%d\n", test,
+               width, height,
+               gdk_pixbuf_get_width (pixbuf), gdk_pixbuf_get_height (pixbuf));
+      fail = TRUE;
+      return;
+    }
+
+  if (!gdk_pixbuf_get_has_alpha (pixbuf) ||
+      gdk_pixbuf_get_n_channels (pixbuf) != 4 ||
+      gdk_pixbuf_get_bits_per_sample (pixbuf) != 8)
+    {
+      g_print ("%s: expected 8-bit RGBA\n", test);
+      fail = TRUE;
+      return;
+    }
+
+  for (y = 0; y < height; y++)
+    {
+      for (x = 0; x < width; x++)
+        {
+          const guint8 *rgba = pixels + y * rowstride + x * 4;
+          guint32 pixel = make_pixel (x, y);
+          int alpha = format == CAIRO_FORMAT_ARGB32 ? pixel >> 24 : 0xff;
+          int tolerance = 0;
+          int red, green, blue;
+
+          red = (pixel >> 16) & 0xff;
+          green = (pixel >> 8) & 0xff;
+          blue = pixel & 0xff;
+
+          if (alpha == 0)
+            {
+              red = green = blue = 0;
+            }
+          else if (alpha < 0xff)
+            {
+              /* Unpremultiplying can't restore what premultiplying
+               * rounded away, but must get within one of it */
+              red = MIN (255, (int) (red * 255.0 / alpha + 0.5));
+              green = MIN (255, (int) (green * 255.0 / alpha + 0.5));
+              blue = MIN (255, (int) (blue * 255.0 / alpha + 0.5));
+              tolerance = 1;
+            }
+
+          if (!check_channel (x, y, 'a', alpha, rgba[3], 0) ||
+              !check_channel (x, y, 'r', red, rgba[0], tolerance) ||
+              !check_channel (x, y, 'g', green, rgba[1], tolerance) ||
+              !check_channel (x, y, 'b', blue, rgba[2], tolerance))
+            return;
+        }
+    }
+}
+
+static void
+check_text (GdkPixbuf *pixbuf)
+{
+  int i;
+
+  for (i = 0; text[i] != NULL; i += 2)
+    {
+      char *key = g_strconcat ("tEXt::", text[i], NULL);
+      const char *value = gdk_pixbuf_get_option (pixbuf, key);
+
+      if (g_strcmp0 (value, text[i + 1]) != 0)
+        {
+          g_print ("%s: %s: expected: %s, got: %s\n",
+                   test, key, text[i + 1], value ? value : "(null)");
+          fail = TRUE;
+        }
+
+      g_free (key);
+    }
+}
+
+static void
+test_round_trip (cairo_format_t format,
+                 int            width,
+                 int            height,
+                 int            compression_level)
+{
+  cairo_surface_t *image;
+  GOutputStream *stream;
+  GdkPixbufLoader *loader;
+  GdkPixbuf *pixbuf;
+  GError *error = NULL;
+  char *name;
+
+  name = g_strdup_printf ("%s %dx%d level %d",
+                          format == CAIRO_FORMAT_ARGB32 ? "ARGB32" : "RGB24",
+                          width, height, compression_level);
+  test = name;
+
+  image = create_image (format, width, height);
+  stream = g_memory_output_stream_new_resizable ();
+
+  if (!_shell_png_writer_write (image, stream, compression_level, text,
+                                NULL, &error) ||
+      !g_output_stream_close (stream, NULL, &error))
+    {
+      g_print ("%s: writing failed: %s\n", test, error->message);
+      fail = TRUE;
+      goto out;
+    }
+
+  loader = gdk_pixbuf_loader_new_with_type ("png", &error);
+  if (loader == NULL ||
+      !gdk_pixbuf_loader_write (loader,
+                                g_memory_output_stream_get_data (G_MEMORY_OUTPUT_STREAM (stream)),
+                                g_memory_output_stream_get_data_size (G_MEMORY_OUTPUT_STREAM (stream)),
+                                &error) ||
+      !gdk_pixbuf_loader_close (loader, &error))
+    {
+      g_print ("%s: reading failed: %s\n", test, error->message);
+      fail = TRUE;
+      g_clear_object (&loader);
+      goto out;
+    }
+
+  pixbuf = gdk_pixbuf_loader_get_pixbuf (loader);
+  check_pixbuf (pixbuf, image);
+  check_text (pixbuf);
+
+  g_object_unref (loader);
+
+ out:
+  g_clear_error (&error);
+  g_object_unref (stream);
+  cairo_surface_destroy (image);
+  g_free (name);
+}
+
+int
+main (int argc, char **argv)
+{
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (sizes); i++)
+    {
+      test_round_trip (CAIRO_FORMAT_ARGB32, sizes[i].width, sizes[i].height, -1);
+      test_round_trip (CAIRO_FORMAT_RGB24, sizes[i].width, sizes[i].height, -1);
+    }
+
+  /* Stored and best compression produce very different zlib streams */
+  test_round_trip (CAIRO_FORMAT_ARGB32, 37, 70, 0);
+  test_round_trip (CAIRO_FORMAT_ARGB32, 37, 70, 9);
+
+  return fail ? 1 : 0;
+}